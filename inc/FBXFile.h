@@ -74,6 +74,10 @@ struct FBXTexture
 	int				width;
 	int				height;
 	int				format;
+
+	// data holds levels mip levels one after another, largest first, size bytes in all
+	unsigned int	size;
+	unsigned int	levels;
 };
 
 // A simple FBX material that supports 8 texture channels
@@ -223,9 +227,17 @@ public:
 	FBXTrack();
 	~FBXTrack();
 
+	// fills m_times from the keyframes
+	void			calculateTimes(unsigned int a_startFrame);
+
+	// index of the key at or before a_time, in frames from the animation's start,
+	// checking a_cursor and the key after it before searching the whole track
+	unsigned int	findKey(float a_time, unsigned int a_cursor) const;
+
 	unsigned int	m_boneIndex;
 	unsigned int	m_keyframeCount;
 	FBXKeyFrame*	m_keyframes;
+	float*			m_times;	// each key's frames from the animation's start
 };
 
 // An animation that contains a collection of animated bone tracks
@@ -249,6 +261,29 @@ public:
 	FBXTrack*		m_tracks;
 };
 
+// A skeleton's local bone transforms kept as translation, rotation and scale,
+// so poses can be blended and layered before any matrices are built
+class FBXPose
+{
+public:
+
+	FBXPose() : m_boneCount(0) {}
+
+	// keeps existing bones, new ones start as identity
+	void			resize(unsigned int a_boneCount);
+
+	// cross-fades from a_from to a_to, either of which may be this pose
+	void			blend(const FBXPose& a_from, const FBXPose& a_to, float a_weight);
+
+	// layers on the difference between a_additive and a_reference
+	void			add(const FBXPose& a_additive, const FBXPose& a_reference, float a_weight);
+
+	unsigned int			m_boneCount;
+	std::vector<glm::vec3>	m_translations;
+	std::vector<glm::quat>	m_rotations;
+	std::vector<glm::vec3>	m_scales;
+};
+
 // A hierarchy of bones that can be animated
 class FBXSkeleton
 {
@@ -257,9 +292,37 @@ public:
 	FBXSkeleton();
 	~FBXSkeleton();
 
+	// each track's last key, so playback only steps forward a key or two;
+	// skeletons shared by several animated instances should keep one each
+	class Cursor
+	{
+	public:
+		Cursor() : m_animation(nullptr) {}
+
+		const FBXAnimation*			m_animation;
+		std::vector<unsigned int>	m_keys;
+	};
+
 	void			evaluate(const FBXAnimation* a_animation, float a_time, bool a_loop = true, float a_fps = 24.0f);
+	void			evaluate(const FBXAnimation* a_animation, float a_time, Cursor& a_cursor, bool a_loop = true, float a_fps = 24.0f);
 	void			updateBones();
 
+	// Pose versions of the above.  getLocalPose() starts a pose from the nodes'
+	// local transforms, evaluate() overwrites the bones the animation has tracks
+	// for, and updateBones() builds m_bones from a pose without touching nodes.
+	// Bones past the end of a smaller pose use their node's local transform
+	void			getLocalPose(FBXPose& a_pose) const;
+	void			evaluate(const FBXAnimation* a_animation, float a_time, FBXPose& a_pose, Cursor& a_cursor, bool a_loop = true, float a_fps = 24.0f) const;
+	void			updateBones(const FBXPose& a_pose);
+
+	// Evaluates a_count instances of this skeleton playing a_animation, one time
+	// each, four at once with SSE.  a_palettes receives a_count * m_boneCount
+	// bones laid out like m_bones, ready to upload in one go.  Nodes aren't
+	// written, and a_cursors, if given, holds one per instance, so threads can
+	// share a skeleton as long as each passes its own palettes and cursors
+	void			evaluateBatch(const FBXAnimation* a_animation, const float* a_times, unsigned int a_count, glm::mat4* a_palettes,
+								  Cursor* a_cursors = nullptr, bool a_loop = true, float a_fps = 24.0f) const;
+
 	unsigned int	m_boneCount;
 	FBXNode**		m_nodes;
 	int*			m_parentIndex;
@@ -268,6 +331,8 @@ public:
 	glm::mat4*		m_bindPoses;
 
 	void*			m_userData;
+
+	Cursor			m_cursor;
 };
 
 // An FBX scene representing the contents on an FBX file.
@@ -277,7 +342,7 @@ class FBXFile
 {
 public:
 
-	FBXFile() : m_root(nullptr), m_importAssistor(nullptr) {}
+	FBXFile() : m_root(nullptr), m_weldMode(WELD_HASHED), m_weldEpsilon(1e-5f), m_textureListener(nullptr), m_uploadBuffer(0), m_importAssistor(nullptr) {}
 	~FBXFile() 
 	{
 		unload();
@@ -296,13 +361,54 @@ public:
 		UNITS_MILE,
 	};
 
+	// how load() merges duplicate vertices within each mesh
+	enum WELD_MODE
+	{
+		WELD_SORTED,	// sorts by the whole vertex, only merging exact copies
+		WELD_HASHED,	// merges vertices whose attributes match within an epsilon, keeping first-occurrence order
+	};
+
+	// set before load(), the epsilon only applies to WELD_HASHED
+	void			setVertexWelding(WELD_MODE a_mode, float a_epsilon = 1e-5f)	{	m_weldMode = a_mode; m_weldEpsilon = a_epsilon;	}
+
 	// must unload a scene before loading a new one over top
-	bool			load(const char* a_filename, UNIT_SCALE a_scale = FBXFile::UNITS_METER, bool a_loadTextures = true, bool a_loadAnimations = true, bool a_flipTextureY = true);
+	// With a_useCache the processed scene is saved beside the file, as a_filename
+	// plus ".cache", and later loads read that instead while the file is unchanged
+	// and the same options are used.  Textures are still decoded from their images.
+	bool			load(const char* a_filename, UNIT_SCALE a_scale = FBXFile::UNITS_METER, bool a_loadTextures = true, bool a_loadAnimations = true, bool a_flipTextureY = true,
+						 bool a_useCache = true);
 	bool			loadAnimationsOnly(const char* a_filename, UNIT_SCALE a_scale = FBXFile::UNITS_METER );
 	void			unload();
 
-	// goes through all loaded textures and creates their GL versions
-	void			initialiseOpenGLTextures();
+	// goes through all loaded textures and creates their GL versions, then
+	// frees their image data; textures still decoding are left for a later call.
+	// Uploads stream through a pixel buffer, and a_byteBudget limits how much
+	// is uploaded per call (0 uploads everything, one texture always goes)
+	void			initialiseOpenGLTextures(size_t a_byteBudget = 0);
+
+	// Textures are decoded on a fixed pool of worker threads shared by every
+	// FBXFile.  Without a listener load() waits for them.  With one it returns
+	// once they're queued, and initialiseOpenGLTextures() can be called each
+	// frame until texturesLoaded().  Listeners are called on the worker threads,
+	// and unload() waits for calls in progress, so they mustn't call back into FBXFile.
+	// A file without textures calls texturesLoaded() from load() itself
+	class TextureListener
+	{
+	public:
+		virtual ~TextureListener() {}
+		virtual void	textureLoaded(FBXFile* a_file, FBXTexture* a_texture, unsigned int a_loaded, unsigned int a_total) {}
+		virtual void	texturesLoaded(FBXFile* a_file) {}
+	};
+
+	// set before load()
+	void			setTextureListener(TextureListener* a_listener)	{	m_textureListener = a_listener;	}
+
+	// true once every texture is decoded and uploaded
+	bool			texturesLoaded() const;
+
+	// the most image data the pool holds at once, decoding or decoded and waiting
+	// for initialiseOpenGLTextures(), though one image is always allowed
+	static void		setTextureDecodeBudget(size_t a_bytes);
 
 	// the folder path of the FBX file
 	// useful for accessing texture locations
@@ -354,17 +460,47 @@ private:
 		
 	FBXMaterial*	extractMaterial(void* a_mesh, int a_materialIndex);
 
-	static void		optimiseMesh(FBXMeshNode* a_mesh);
+	static void		optimiseMesh(FBXMeshNode* a_mesh, WELD_MODE a_weldMode, float a_weldEpsilon);
+	static void		weldSorted(FBXMeshNode* a_mesh);
+	static void		weldHashed(FBXMeshNode* a_mesh, float a_epsilon);
 	static void		calculateTangentsBinormals(std::vector<FBXVertex>& a_vertices, const std::vector<unsigned int>& a_indices);
 
 	unsigned int	nodeCount(FBXNode* a_node);
 
+	// queues every texture's image to decode, and waits for them without a listener
+	void			loadTextures();
+	void			cancelTextures();
+
+	// what a cache must match to be used in place of its FBX file
+	struct CacheKey
+	{
+		unsigned int		magic;
+		unsigned int		version;
+		unsigned int		vertexSize;
+		unsigned int		options;		// unit scale, then load flags from bit 8
+		float				weldEpsilon;	// negative for WELD_SORTED
+		long long			sourceTime;
+		long long			sourceSize;
+	};
+
+	bool			makeCacheKey(const char* a_filename, UNIT_SCALE a_scale, bool a_loadTextures, bool a_loadAnimations, bool a_flipTextureY, CacheKey& a_key) const;
+	bool			loadCache(const char* a_filename, const CacheKey& a_key);
+	bool			saveCache(const char* a_filename, const CacheKey& a_key) const;
+
 private:
 
 	FBXNode*								m_root;
 
 	std::string								m_path;
 
+	WELD_MODE								m_weldMode;
+	float									m_weldEpsilon;
+	TextureListener*						m_textureListener;
+
+	// decoded textures waiting for initialiseOpenGLTextures()
+	std::vector<FBXTexture*>				m_textureUploads;
+	unsigned int							m_uploadBuffer;
+
 	glm::vec4								m_ambientLight;
 	std::vector<FBXMeshNode*>				m_meshes;
 	std::map<std::string,FBXLightNode*>		m_lights;
@@ -421,7 +557,9 @@ inline FBXTexture::FBXTexture()
 	handle(0),
 	width(0),
 	height(0),
-	format(0)
+	format(0),
+	size(0),
+	levels(0)
 {
 
 }
@@ -508,7 +646,8 @@ inline FBXKeyFrame::~FBXKeyFrame()
 inline FBXTrack::FBXTrack()
 	: m_boneIndex(0),
 	m_keyframeCount(0), 
-	m_keyframes(nullptr) 
+	m_keyframes(nullptr),
+	m_times(nullptr)
 {
 
 }
@@ -516,6 +655,7 @@ inline FBXTrack::FBXTrack()
 inline FBXTrack::~FBXTrack()
 {
 	delete[] m_keyframes;
+	delete[] m_times;
 }
 
 inline FBXAnimation::FBXAnimation() 
@@ -1,15 +1,39 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <cstddef>
+#include <mutex>
+#include <vector>
 
 class Gizmos
 {
 public:
 
-	static void		create(unsigned int a_maxLines = 0xffff, unsigned int a_maxTris = 0xffff,
-						   unsigned int a_max2DLines = 0xff, unsigned int a_max2DTris = 0xff);
+	// The sizes are where each buffer starts.  Buffers double when they fill, up to a
+	// fixed size, and halve again once they've stayed mostly empty for a while.
+	static void		create(unsigned int a_maxLines = 0x4000, unsigned int a_maxTris = 0x4000,
+						   unsigned int a_max2DLines = 0xff, unsigned int a_max2DTris = 0xff,
+						   unsigned int a_maxInstances = 0x400);
 	static void		destroy();
 
+	// what the last frame drew, filled in by clear()
+	struct Stats
+	{
+		unsigned int	lines;
+		unsigned int	tris;
+		unsigned int	transparentTris;
+		unsigned int	instances;
+		unsigned int	lines2D;
+		unsigned int	tris2D;
+		unsigned int	dropped;		// primitives that didn't fit even after growing
+		size_t			bytesUploaded;	// written for the GPU to read, mapped or not
+		size_t			bytesAllocated;	// CPU and GPU storage across every buffer
+	};
+	static const Stats&	getStats();
+
+	// Records gizmos on a worker thread, below
+	class Recorder;
+
 	// removes all Gizmos
 	static void		clear();
 
@@ -74,6 +98,18 @@ public:
 							  const glm::mat4* a_transform = nullptr, float a_longMin = 0.f, float a_longMax = 360, 
 							  float a_latMin = -90, float a_latMax = 90 );
 
+	// Instanced shapes are drawn from a unit mesh kept on the GPU, so each one only adds its
+	// transform, colour and size.  They're outlined in white like the filled shapes, and
+	// any transform only rotates them about their center.  a_maxInstances is per shape.
+	static void		addSphereInstance(const glm::vec3& a_center, float a_radius,
+									  const glm::vec4& a_fillColour, const glm::mat4* a_transform = nullptr);
+	static void		addBoxInstance(const glm::vec3& a_center, const glm::vec3& a_extents,
+								   const glm::vec4& a_fillColour, const glm::mat4* a_transform = nullptr);
+
+	// A capsule aligned to the Y-axis, with a_halfLength between the center and each end's sphere
+	static void		addCapsuleInstance(const glm::vec3& a_center, float a_radius, float a_halfLength,
+									   const glm::vec4& a_fillColour, const glm::mat4* a_transform = nullptr);
+
 	// Adds a single Hermite spline curve
 	static void		addHermiteSpline(const glm::vec3& a_start, const glm::vec3& a_end,
 									 const glm::vec3& a_tangentStart, const glm::vec3& a_tangentEnd, unsigned int a_segments, const glm::vec4& a_colour);
@@ -98,7 +134,8 @@ public:
 private:
 
 	Gizmos(unsigned int a_maxLines, unsigned int a_maxTris,
-		   unsigned int a_max2DLines, unsigned int a_max2DTris);
+		   unsigned int a_max2DLines, unsigned int a_max2DTris,
+		   unsigned int a_maxInstances);
 	~Gizmos();
 
 	struct GizmoVertex
@@ -120,49 +157,211 @@ private:
 		GizmoVertex v2;
 	};
 
+	enum InstanceShape
+	{
+		SPHERE_INSTANCE,
+		BOX_INSTANCE,
+		CAPSULE_INSTANCE,
+		INSTANCE_SHAPE_COUNT
+	};
+
+	struct GizmoInstance
+	{
+		glm::vec4 rows[3];	// the top three rows of an affine transform
+		glm::vec4 colour;
+		glm::vec4 scale;	// xyz scales the unit mesh, w moves a capsule's ends apart
+	};
+
+	// where a shape's unit mesh is in the mesh buffer, in vertices
+	struct InstanceMesh
+	{
+		int triFirst;
+		int triCount;
+		int lineFirst;
+		int lineCount;
+	};
+
+	// A vertex buffer that the add functions write into directly.  It holds a
+	// region per frame in flight, persistently mapped where ARB_buffer_storage
+	// is available.  Without it primitives are written to CPU memory and are
+	// uploaded into an orphaned buffer when drawn.
+	struct Stream
+	{
+		unsigned int	vao;
+		unsigned int	vbo;
+		unsigned int	primitiveSize;	// in bytes
+		unsigned int	capacity;		// primitives per region
+		unsigned int	initialCapacity;
+		unsigned int	maxCapacity;
+		unsigned int	idleFrames;		// frames in a row that used under a quarter of it
+		size_t			uploaded;		// bytes drawn from since the last clear
+		unsigned char*	mapped;			// every region, or null when orphaning
+		unsigned char*	cpu;
+
+		void			create(unsigned int a_capacity, unsigned int a_primitiveSize, bool a_persistent);
+		void			destroy();
+		void*			region(unsigned int a_region) const;
+		size_t			allocated() const;
+
+		// reallocates, keeping the first a_count primitives of a region
+		void			resize(unsigned int a_capacity, unsigned int a_region, unsigned int a_count);
+
+		// called each frame with what the frame used, halves the stream once it's been idle long enough
+		bool			trim(unsigned int a_used);
+
+		// uploads the region if it isn't mapped, and returns its offset in bytes
+		size_t			upload(unsigned int a_region, unsigned int a_count);
+
+		// binds the stream for drawing, uploading first if it isn't mapped, and
+		// returns the vertex to start drawing from
+		int				bind(unsigned int a_region, unsigned int a_count, unsigned int a_primitiveVertices);
+	};
+
+	// gizmos a Recorder has handed over, waiting to be copied into the streams
+	struct Recording
+	{
+		std::vector<GizmoLine>		lines;
+		std::vector<GizmoTri>		tris;
+		std::vector<GizmoTri>		transparentTris;
+		std::vector<GizmoLine>		lines2D;
+		std::vector<GizmoTri>		tris2D;
+		std::vector<GizmoInstance>	instances[INSTANCE_SHAPE_COUNT][2];
+		Recording*					next;
+	};
+
+	// points the add functions at a region of every stream
+	void			useRegion(unsigned int a_region);
+
+	// makes room for a_extra more primitives after a_count, growing the stream if
+	// it's full, and counts a drop for each one that still doesn't fit
+	bool			reserve(Stream& a_stream, unsigned int a_count, unsigned int a_extra = 1);
+
+	// copies primitives onto the end of a stream, as many as will fit
+	void			append(Stream& a_stream, unsigned int& a_count, const void* a_primitives, size_t a_primitiveCount);
+
+	// takes a recording from the free list, or allocates one
+	Recording*		newRecording();
+
+	// copies every handed over recording into the streams, then frees them for reuse
+	void			mergeRecordings();
+
+	void			createInstanceMeshes();
+	static void		addInstance(InstanceShape a_shape, const glm::vec3& a_center, const glm::vec4& a_scale,
+								const glm::vec4& a_colour, const glm::mat4* a_transform);
+	unsigned int	instanceCount(bool a_transparent) const;
+
+	// uploads every instance list once a frame, before the passes that draw them
+	void			uploadInstances();
+
+	// draws the opaque or transparent instances' fill, and for opaque, every instance's outline
+	void			drawInstances(const glm::mat4& a_projectionView, bool a_transparent, unsigned int a_shader);
+
+	// Offscreen storage for weighted blended transparency.  Transparent fills
+	// add into it in any order, then it's composited over the framebuffer that
+	// was bound, so they never need sorting.
+	struct TransparencyTarget
+	{
+		unsigned int	fbo;
+		unsigned int	accumTexture;	// colour times alpha times weight, with revealage in alpha
+		unsigned int	weightTexture;	// alpha times weight
+		unsigned int	depthBuffer;
+		unsigned int	vao;			// empty, the composite's triangle comes from gl_VertexID
+		int				width;
+		int				height;
+		bool			supported;		// cleared if the scene's depth can't be copied in
+
+		// binds the target with the scene's depth, or returns false to blend in order instead
+		bool			begin(int a_framebuffer);
+		void			end(int a_framebuffer, unsigned int a_compositeShader);
+		void			create(int a_width, int a_height);
+		void			destroy();
+	};
+
+	static const unsigned int STREAM_REGIONS = 3;
+	static const unsigned int STREAM_IDLE_FRAMES = 120;
+	static const size_t MAX_STREAM_REGION_BYTES = 16 << 20;
+
 	unsigned int	m_shader;
+	unsigned int	m_weightedShader;
+	unsigned int	m_weightedInstanceShader;
+	unsigned int	m_compositeShader;
+	TransparencyTarget	m_transparency;
+	unsigned int	m_region;
+	void*			m_fences[STREAM_REGIONS];	// GLsync, set once a region has been drawn from
+	unsigned int	m_dropped;
+	Stats			m_stats;
+
+	// lists of handed over and free recordings, shared with every Recorder
+	std::mutex		m_recordingMutex;
+	Recording*		m_recordings;
+	Recording*		m_freeRecordings;
 
 	// line data
-	unsigned int	m_maxLines;
 	unsigned int	m_lineCount;
 	GizmoLine*		m_lines;
-
-	unsigned int	m_lineVAO;
-	unsigned int 	m_lineVBO;
+	Stream			m_lineStream;
 
 	// triangle data
-	unsigned int	m_maxTris;
 	unsigned int	m_triCount;
 	GizmoTri*		m_tris;
-
-	unsigned int	m_triVAO;
-	unsigned int 	m_triVBO;
+	Stream			m_triStream;
 	
 	unsigned int	m_transparentTriCount;
 	GizmoTri*		m_transparentTris;
-
-	unsigned int	m_transparentTriVAO;
-	unsigned int 	m_transparentTriVBO;
+	Stream			m_transparentTriStream;
 	
+	// instance data, opaque then transparent for each shape
+	unsigned int	m_instanceShader;
+	unsigned int	m_instanceCounts[INSTANCE_SHAPE_COUNT][2];
+	GizmoInstance*	m_instances[INSTANCE_SHAPE_COUNT][2];
+	Stream			m_instanceStreams[INSTANCE_SHAPE_COUNT][2];
+	size_t			m_instanceOffsets[INSTANCE_SHAPE_COUNT][2];
+	InstanceMesh	m_instanceMeshes[INSTANCE_SHAPE_COUNT];
+	unsigned int	m_instanceMeshVBO;
+	unsigned int	m_instanceVAO;
+
 	// 2D line data
-	unsigned int	m_max2DLines;
 	unsigned int	m_2DlineCount;
 	GizmoLine*		m_2Dlines;
-
-	unsigned int	m_2DlineVAO;
-	unsigned int 	m_2DlineVBO;
+	Stream			m_2DlineStream;
 
 	// 2D triangle data
-	unsigned int	m_max2DTris;
 	unsigned int	m_2DtriCount;
 	GizmoTri*		m_2Dtris;
-
-	unsigned int	m_2DtriVAO;
-	unsigned int 	m_2DtriVBO;
+	Stream			m_2DtriStream;
 
 	static Gizmos*	sm_singleton;
 };
 
+// While a Recorder exists, the add functions called on the thread that made it
+// write into the recorder instead of the shared buffers, so several threads
+// can add gizmos at once.  What it records is handed over in one go when it's
+// flushed or destroyed, and copied into the shared buffers at the next draw.
+// Recorders can nest on a thread, with the innermost one recording.
+class Gizmos::Recorder
+{
+public:
+
+	Recorder();
+	~Recorder();
+
+	// hands over everything recorded so far
+	void			flush();
+
+private:
+
+	Recorder(const Recorder&);
+	Recorder& operator=(const Recorder&);
+
+	friend class Gizmos;
+
+	// the recording to write to, started on first use
+	Gizmos::Recording&	recording();
+
+	Gizmos::Recording*	m_recording;
+	Recorder*			m_previous;
+};
+
 inline void Gizmos::draw(const glm::mat4& a_projection, const glm::mat4& a_view)
 {
 	draw(a_projection * a_view);
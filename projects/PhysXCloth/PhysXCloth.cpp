@@ -382,7 +382,7 @@ void PhysXTutorial::addBox(PxShape * pShape, PxRigidDynamic * actor)
 	glm::vec4 colour = glm::vec4(1, 0, 0, 1);
 
 	//create our box gizmo
-	Gizmos::addAABBFilled(position, extents, colour, &M);
+	Gizmos::addBoxInstance(position, extents, colour, &M);
 }
 
 PxCloth* PhysXTutorial::createCloth(const glm::vec3& a_position,
@@ -177,7 +177,7 @@ PhysXTutorial::~PhysXTutorial()
 bool PhysXTutorial::onCreate(int a_argc, char* a_argv[])
 {
 	// initialise the Gizmos helper class
-	Gizmos::create(100000, 100000);
+	Gizmos::create();
 
 	// create a world-space matrix for a camera
 	m_cameraMatrix = glm::inverse(glm::lookAt(glm::vec3(10, 10, 10), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0)));
@@ -434,7 +434,7 @@ void PhysXTutorial::addBox(PxShape * pShape, PxRigidActor * actor)
 	glm::vec4 colour = glm::vec4(1, 0, 0, 1);
 
 	//create our box gizmo
-	Gizmos::addAABBFilled(position, extents, colour, &M);
+	Gizmos::addBoxInstance(position, extents, colour, &M);
 }
 void PhysXTutorial::addSphere(PxShape * pShape, PxRigidActor * actor)
 {
@@ -458,11 +458,11 @@ void PhysXTutorial::addSphere(PxShape * pShape, PxRigidActor * actor)
 	position.y = m.getPosition().y;
 	position.z = m.getPosition().z;
 	//create a widget to represent it
-	Gizmos::addSphere(position, radius, 10, 10, glm::vec4(1, 0, 1, 1));
+	Gizmos::addSphereInstance(position, radius, glm::vec4(1, 0, 1, 1), &M);
 }
 void PhysXTutorial::addCapsule(PxShape* pShape, PxRigidActor * actor)
 {
-	//creates a gizmo representation of a capsule using 2 spheres and a cylinder
+	//creates a gizmo representation of a capsule
 	glm::vec4 colour(0, 0, 1, 1);  //make our capsule blue
 	PxCapsuleGeometry capsuleGeometry;
 	float radius = 1; //temporary values whilst we try and get the real value from PhysX
@@ -483,15 +483,10 @@ void PhysXTutorial::addCapsule(PxShape* pShape, PxRigidActor * actor)
 	glm::mat4 M = Px2Glm(m);
 	//get the world position from the PhysX tranform
 	glm::vec3 position = Px2GlV3(transform.p);
-	glm::vec4 axis(halfHeight, 0, 0, 0);	//axis for the capsule
-	axis = M * axis; //rotate axis to correct orientation
-	//add our 2 end cap spheres...
-	Gizmos::addSphere(position + axis.xyz, radius, 10, 10, colour);
-	Gizmos::addSphere(position - axis.xyz, radius, 10, 10, colour);
-	//the cylinder gizmo is oriented 90 degrees to what we want so we need to change the rotation matrix...
+	//the capsule gizmo is oriented 90 degrees to what we want so we need to change the rotation matrix...
 	glm::mat4 m2 = glm::rotate(M, 11 / 7.0f, glm::vec3(0.0f, 0.0f, 1.0f)); //adds an additional rotation onto the matrix
-	//now we can use this matrix and the other data to create the cylinder...
-	Gizmos::addCylinderFilled(position, radius, halfHeight, 10, colour, &m2);
+	//now we can use this matrix and the other data to create the capsule...
+	Gizmos::addCapsuleInstance(position, radius, halfHeight, colour, &m2);
 }
 
 void PhysXTutorial::useBallGun()
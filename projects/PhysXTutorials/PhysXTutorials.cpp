@@ -275,7 +275,7 @@ void PhysXTutorial::addBox(PxShape * pShape, PxRigidDynamic * actor)
 	glm::vec4 colour = glm::vec4(1, 0, 0, 1);
 
 	//create our box gizmo
-	Gizmos::addAABBFilled(position, extents, colour, &M);
+	Gizmos::addBoxInstance(position, extents, colour, &M);
 }
 
 #ifdef PVD_AVAILABLE
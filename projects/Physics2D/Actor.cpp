@@ -1,48 +1,76 @@
 #include "Actor.h"
+#include <cmath>
 
-void Actor::Update(float a_deltaTime, const glm::vec3& a_gravity)
+Actor::Actor(const Geometry& a_geometry, const glm::vec4& a_color, bool a_dynamic,
+			 const Material& a_material,
+			 const glm::vec3& a_velocity, const glm::vec3& a_angularVelocity,
+			 float a_mass, const glm::mat3& a_inertiaTensor,
+			 float a_minSpeed, float a_minAngularSpeed)
+	: m_color(a_color), m_geometry(a_geometry.Clone()), m_material(a_material),
+	  m_mass(a_mass), m_inertiaTensor(a_inertiaTensor)
 {
-	if (nullptr != m_geometry)
-	{
-		// static movement
-		Spin(m_angularVelocity * a_deltaTime);
-		Move(m_velocity * a_deltaTime);
+	CreateBody(a_dynamic, a_velocity, a_angularVelocity, a_minSpeed, a_minAngularSpeed);
+}
+Actor::Actor(const Geometry& a_geometry, const glm::vec4& a_color,
+			 const Material& a_material,
+			 const glm::vec3& a_velocity, const glm::vec3& a_angularVelocity,
+			 float a_mass, const glm::mat3& a_inertiaTensor,
+			 float a_minSpeed, float a_minAngularSpeed)
+	: m_color(a_color), m_geometry(a_geometry.Clone()), m_material(a_material),
+	  m_mass(a_mass), m_inertiaTensor(a_inertiaTensor)
+{
+	CreateBody(true, a_velocity, a_angularVelocity, a_minSpeed, a_minAngularSpeed);
+}
+Actor::~Actor()
+{
+	m_bodies->Destroy(m_body);
+	delete m_ownBodies;
+	m_ownBodies = nullptr;
+	delete m_geometry;
+	m_geometry = nullptr;
+}
 
-		if (m_dynamic)
-		{
-			// linear force
-			glm::vec3 force = m_force + a_gravity;
-			if (0 < m_material.linearDrag)
-				force -= GetVelocity() * m_material.linearDrag;
+void Actor::CreateBody(bool a_dynamic,
+					   const glm::vec3& a_velocity, const glm::vec3& a_angularVelocity,
+					   float a_minSpeed, float a_minAngularSpeed)
+{
+	m_ownBodies = new RigidBodyStore();
+	m_bodies = m_ownBodies;
+	m_body = m_bodies->Create(m_geometry, a_dynamic);
+	unsigned int index = GetBodyIndex();
+	m_bodies->velocity[index] = a_velocity;
+	m_bodies->angularVelocity[index] = a_angularVelocity;
+	m_bodies->linearDrag[index] = m_material.linearDrag;
+	m_bodies->rotationalDrag[index] = m_material.rotationalDrag;
+	m_bodies->minSpeed2[index] = a_minSpeed * a_minSpeed;
+	m_bodies->minAngularSpeed2[index] = a_minAngularSpeed * a_minAngularSpeed;
+	UpdateMassProperties();
+}
 
-			// linear acceleration
-			float m = GetMass();
-			if (glm::vec3(0) != force && 0 != m)
-			{
-				glm::vec3 deltaV = (force / m) * a_deltaTime;
-				Move(0.5f * deltaV * a_deltaTime);
-				Accelerate(deltaV);
-			}
+void Actor::Attach(RigidBodyStore& a_bodies)
+{
+	if (&a_bodies == m_bodies)
+		return;
+	m_body = m_bodies->Transfer(m_body, a_bodies);
+	m_bodies = &a_bodies;
 
-			// angular force
-			glm::vec3 torque = m_torque;
-			if (0 < m_material.rotationalDrag)
-			{
-				torque -= GetAngularVelocity() * m_material.rotationalDrag;
-			}
+	delete m_ownBodies;
+	m_ownBodies = nullptr;
+}
 
-			// angular acceleration
-			float i = GetRotationalInertia(torque);
-			if (0 != i)
-			{
-				glm::vec3 deltaAV = torque * a_deltaTime / i;
-				Spin(0.5f * deltaAV * a_deltaTime);
-				AccelerateRotation(deltaAV);
-			}
+void Actor::UpdateMassProperties()
+{
+	float mass = (0 != m_mass ? m_mass : m_material.density * m_geometry->volume());
+	glm::mat3 inertiaTensor = (glm::mat3(0) != m_inertiaTensor ? m_inertiaTensor :
+							   m_geometry->interiaTensorDividedByMass() * mass);
+	m_bodies->SetMassProperties(GetBodyIndex(), mass, inertiaTensor);
+}
 
-			EnforceMinSpeed();
-		}
-	}
+void Actor::Update(float a_deltaTime, const glm::vec3& a_gravity)
+{
+	unsigned int index = GetBodyIndex();
+	m_bodies->Integrate(index, a_deltaTime, a_gravity);
+	m_bodies->WriteBack(index);
 }
 
 void Actor::ResolveCollision(Actor* a_actor1, Actor* a_actor2)
@@ -51,6 +79,15 @@ void Actor::ResolveCollision(Actor* a_actor1, Actor* a_actor2)
 	if (nullptr != a_actor1 && nullptr != a_actor2 && a_actor1 != a_actor2 &&
 		(a_actor1->IsDynamic() || a_actor2->IsDynamic()) &&
 		Geometry::DetectCollision(a_actor1->GetGeometry(), a_actor2->GetGeometry(), &collision))
+		ResolveCollision(a_actor1, a_actor2, collision);
+}
+
+void Actor::ResolveCollision(Actor* a_actor1, Actor* a_actor2,
+							 const Geometry::Collision& a_collision)
+{
+	Geometry::Collision collision = a_collision;
+	if (nullptr != a_actor1 && nullptr != a_actor2 && a_actor1 != a_actor2 &&
+		(a_actor1->IsDynamic() || a_actor2->IsDynamic()))
 	{
 		// resolve interpenetration
 		if (a_actor1->IsDynamic() && a_actor2->IsDynamic())
@@ -73,12 +110,12 @@ void Actor::ResolveCollision(Actor* a_actor1, Actor* a_actor2)
 		float e = 1.0f + fmin(a_actor1->m_material.elasticity, a_actor2->m_material.elasticity);
 		glm::vec3 n = collision.normal;
 		glm::vec3 Vr = a_actor2->GetVelocity() - a_actor1->GetVelocity();
-		float invM = (a_actor1->IsDynamic() ? 1.0f / a_actor1->GetMass() : 0) +
-					 (a_actor2->IsDynamic() ? 1.0f / a_actor2->GetMass() : 0);
+		float invM = (a_actor1->IsDynamic() ? a_actor1->GetInverseMass() : 0) +
+					 (a_actor2->IsDynamic() ? a_actor2->GetInverseMass() : 0);
 		glm::vec3 r1 = collision.point - a_actor1->GetPosition();
 		glm::vec3 r2 = collision.point - a_actor2->GetPosition();
-		glm::mat3 invI1 = (a_actor1->IsDynamic() ? glm::inverse(a_actor1->GetInertiaTensor()) : glm::mat3(0));
-		glm::mat3 invI2 = (a_actor2->IsDynamic() ? glm::inverse(a_actor2->GetInertiaTensor()) : glm::mat3(0));
+		glm::mat3 invI1 = (a_actor1->IsDynamic() ? a_actor1->GetInverseInertiaTensor() : glm::mat3(0));
+		glm::mat3 invI2 = (a_actor2->IsDynamic() ? a_actor2->GetInverseInertiaTensor() : glm::mat3(0));
 		glm::vec3 J = -e * n * glm::dot(Vr, n) /
 					  (invM + glm::dot(n, glm::cross(invI1 * glm::cross(r1, n), r1)) +
 							  glm::dot(n, glm::cross(invI2 * glm::cross(r2, n), r2)));
@@ -149,14 +186,16 @@ glm::vec3 Actor::GetPointVelocity(const glm::vec3& a_point, bool a_ignoreOutside
 {
 	if (a_ignoreOutside && !m_geometry->Contains(a_point))
 		return glm::vec3(0);
-	if (a_point == GetPosition() || glm::vec3(0) == m_angularVelocity)
-		return m_velocity;
-	return m_velocity + glm::cross(m_angularVelocity, a_point - GetPosition());
+	const glm::vec3& velocity = GetVelocity();
+	const glm::vec3& angularVelocity = GetAngularVelocity();
+	if (a_point == GetPosition() || glm::vec3(0) == angularVelocity)
+		return velocity;
+	return velocity + glm::cross(angularVelocity, a_point - GetPosition());
 }
 
 static bool validImpulse(const glm::vec3& a_vec3, float a_threshold = 0.0001f)
 {
-	return !(isnan(a_vec3.x) || isnan(a_vec3.y) || isnan(a_vec3.z) ||
+	return !(std::isnan(a_vec3.x) || std::isnan(a_vec3.y) || std::isnan(a_vec3.z) ||
 			 glm::vec3(0) == a_vec3 || glm::length2(a_vec3) < a_threshold);
 }
 
@@ -176,7 +215,7 @@ void Actor::ApplyAngularImpulse(const glm::vec3& a_angularImpulse)
 	{
 		float i = GetRotationalInertia(a_angularImpulse);
 		if (0 != i)
-			AccelerateRotation(glm::inverse(GetInertiaTensor()) * a_angularImpulse);
+			AccelerateRotation(GetInverseInertiaTensor() * a_angularImpulse);
 		EnforceMinSpeed();
 	}
 }
@@ -192,17 +231,9 @@ void Actor::ApplyImpulse(const glm::vec3& a_impulse, const glm::vec3& contactPoi
 		}
 		else
 		{
-			glm::vec3 linearImpulse = d * fabs(glm::dot(a_impulse, d));
+			glm::vec3 linearImpulse = d * fabsf(glm::dot(a_impulse, d));
 			ApplyLinearImpulse(linearImpulse);
 			ApplyAngularImpulse(glm::cross(r, a_impulse));// -linearImpulse));
 		}
 	}
-}
-
-void Actor::EnforceMinSpeed()
-{
-	if (glm::length2(m_velocity) < m_minSpeed2)
-		m_velocity = glm::vec3(0);
-	if (glm::length2(m_angularVelocity) < m_minAngularSpeed2)
-		m_angularVelocity = glm::vec3(0);
-}
+}
\ No newline at end of file
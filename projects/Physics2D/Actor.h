@@ -1,6 +1,6 @@
 #pragma once
-#include "Gizmos.h"
 #include "Geometry.h"
+#include "RigidBodyStore.h"
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
@@ -33,11 +33,7 @@ public:
 		  float a_mass = 0.0f,
 		  const glm::mat3& a_inertiaTensor = glm::mat3(0),
 		  float a_minSpeed = 0.1f,
-		  float a_minAngularSpeed = 0.1f)
-		: m_color(a_color), m_geometry(a_geometry.Clone()), m_dynamic(a_dynamic),
-		  m_material(a_material), m_velocity(a_velocity), m_angularVelocity(a_angularVelocity),
-		  m_mass(a_mass), m_inertiaTensor(a_inertiaTensor), m_force(0), m_torque(0),
-		  m_minSpeed2(a_minSpeed * a_minSpeed), m_minAngularSpeed2(a_minAngularSpeed * a_minAngularSpeed) {}
+		  float a_minAngularSpeed = 0.1f);
 	Actor(const Geometry& a_geometry,
 		  const glm::vec4& a_color,
 		  const Material& a_material,
@@ -46,14 +42,16 @@ public:
 		  float a_mass = 0.0f,
 		  const glm::mat3& a_inertiaTensor = glm::mat3(0),
 		  float a_minSpeed = 0.1f,
-		  float a_minAngularSpeed = 0.1f)
-		: m_color(a_color), m_geometry(a_geometry.Clone()), m_dynamic(true),
-		  m_material(a_material), m_velocity(a_velocity), m_angularVelocity(a_angularVelocity),
-		  m_mass(a_mass), m_inertiaTensor(a_inertiaTensor), m_force(0), m_torque(0),
-		  m_minSpeed2(a_minSpeed * a_minSpeed), m_minAngularSpeed2(a_minAngularSpeed * a_minAngularSpeed) {}
-	~Actor() { delete m_geometry; m_geometry = nullptr; }
-
-	virtual void Update(float a_deltaTime, const glm::vec3& a_gravity = glm::vec3(0));
+		  float a_minAngularSpeed = 0.1f);
+	~Actor();
+
+	// moves this actor's body into the given store, e.g. when it's added to a scene
+	void Attach(RigidBodyStore& a_bodies);
+	RigidBodyStore::Handle GetBody() const { return m_body; }
+	unsigned int GetBodyIndex() const { return m_bodies->Index(m_body); }
+
+	// steps this body on its own - Scene integrates all of its bodies in one pass instead
+	void Update(float a_deltaTime, const glm::vec3& a_gravity = glm::vec3(0));
 	virtual void Render()
 	{
 		m_geometry->Render(m_color);
@@ -61,22 +59,18 @@ public:
 
 	const glm::vec4& GetColor() const { return m_color; }
 	void SetColor(const glm::vec4& a_color) { m_color = a_color; }
-	const glm::vec3& GetPosition() const { return m_geometry->position; }
-	const glm::quat& GetOrientation() const { return m_geometry->orientation(); }
+	const glm::vec3& GetPosition() const { return m_bodies->position[GetBodyIndex()]; }
+	const glm::quat& GetOrientation() const { return m_bodies->orientation[GetBodyIndex()]; }
 	const Geometry& GetGeometry() const { return *m_geometry; }
-	Geometry& GetGeometry() { return *m_geometry; }
-	const glm::vec3& GetVelocity() const { return m_velocity; }
-	const glm::vec3& GetAngularVelocity() const { return m_angularVelocity; }
+	Geometry& GetGeometry() { return *m_geometry; }	// move the actor, not the geometry
+	const Material& GetMaterial() const { return m_material; }
+	const glm::vec3& GetVelocity() const { return m_bodies->velocity[GetBodyIndex()]; }
+	const glm::vec3& GetAngularVelocity() const { return m_bodies->angularVelocity[GetBodyIndex()]; }
 	glm::vec3 GetPointVelocity(const glm::vec3& a_point, bool a_ignoreOutside = true) const;
-	float GetMass() const
-	{
-		return (0 != m_mass ? m_mass : m_material.density * m_geometry->volume());
-	}
-	glm::mat3 GetInertiaTensor() const
-	{
-		return glm::mat3(0) != m_inertiaTensor ? m_inertiaTensor :
-				m_geometry->interiaTensorDividedByMass() * GetMass();
-	}
+	float GetMass() const { return m_bodies->GetMass(GetBodyIndex()); }
+	float GetInverseMass() const { return m_bodies->inverseMass[GetBodyIndex()]; }
+	const glm::mat3& GetInertiaTensor() const { return m_bodies->inertia[GetBodyIndex()]; }
+	const glm::mat3& GetInverseInertiaTensor() const { return m_bodies->inverseInertia[GetBodyIndex()]; }
 	float GetRotationalInertia(const glm::vec3& a_axis) const
 	{
 		if (glm::vec3(0) == a_axis)
@@ -84,62 +78,91 @@ public:
 		glm::vec3 axis = glm::normalize(a_axis);
 		return glm::dot(axis, GetInertiaTensor() * axis);
 	}
-	bool IsDynamic() const { return m_dynamic; }
+	bool IsDynamic() const { return 0 != m_bodies->dynamic[GetBodyIndex()]; }
+
+	// Continuous actors are swept along their motion each step, and stopped at
+	// the first thing they'd hit, so fast ones can't tunnel through thin
+	// geometry.  Only spheres are swept.
+	bool IsContinuous() const { return 0 != m_bodies->continuous[GetBodyIndex()]; }
+	void SetContinuous(bool a_continuous = true) { m_bodies->continuous[GetBodyIndex()] = (a_continuous ? 1 : 0); }
+
+	// sleeping actors aren't moved or collision tested until something touches
+	// them or they're moved, pushed or given a velocity
+	bool IsAwake() const { return m_bodies->IsAwake(GetBodyIndex()); }
+	void Wake() { m_bodies->Wake(GetBodyIndex()); }
 
-	void SetMass(float a_mass = 0.0f) { m_mass = a_mass; }
+	// a mass or inertia tensor of zero is calculated from the material density and geometry
+	void SetMass(float a_mass = 0.0f) { m_mass = a_mass; UpdateMassProperties(); }
+	void UpdateMassProperties();
+	// setting the pose teleports the actor, so it isn't interpolated from where it was
 	void SetPosition(const glm::vec3& a_position = glm::vec3(0))
 	{
+		m_bodies->position[GetBodyIndex()] = a_position;
+		m_bodies->previousPosition[GetBodyIndex()] = a_position;
 		m_geometry->position = a_position;
+		Wake();
 	}
 	void SetOrientation(const glm::quat& a_orientation = glm::quat(0, glm::vec3(0)))
 	{
+		m_bodies->orientation[GetBodyIndex()] = a_orientation;
+		m_bodies->previousOrientation[GetBodyIndex()] = a_orientation;
 		m_geometry->orientation(a_orientation);
+		Wake();
 	}
 	void SetVelocity(const glm::vec3& a_velocity = glm::vec3(0))
 	{
-		m_velocity = a_velocity;
+		m_bodies->velocity[GetBodyIndex()] = a_velocity;
+		Wake();
 	}
 	void SetAngularVelocity(const glm::vec3& a_angularVelocity = glm::vec3(0))
 	{
-		m_angularVelocity = a_angularVelocity;
+		m_bodies->angularVelocity[GetBodyIndex()] = a_angularVelocity;
+		Wake();
 	}
 	void Move(const glm::vec3& a_displacement = glm::vec3(0))
 	{
-		m_geometry->position += a_displacement;
+		SetPosition(GetPosition() + a_displacement);
 	}
 	void Spin(const glm::vec3& a_rotation = glm::vec3(0))
 	{
-		m_geometry->spin(a_rotation);
+		SetOrientation(Geometry::Rotation(a_rotation) * GetOrientation());
 	}
 	void Accelerate(const glm::vec3& a_deltaV = glm::vec3(0))
 	{
-		m_velocity += a_deltaV;
+		m_bodies->velocity[GetBodyIndex()] += a_deltaV;
+		Wake();
 	}
 	void AccelerateRotation(const glm::vec3& a_deltaAV = glm::vec3(0))
 	{
-		m_angularVelocity += a_deltaAV;
+		m_bodies->angularVelocity[GetBodyIndex()] += a_deltaAV;
+		Wake();
 	}
 
 	void ApplyImpulse(const glm::vec3& a_impulse, const glm::vec3& contactPoint);
 	void ApplyLinearImpulse(const glm::vec3& a_impulse);
 	void ApplyAngularImpulse(const glm::vec3& a_angularImpulse);
 
-	void EnforceMinSpeed();
+	void EnforceMinSpeed() { m_bodies->EnforceMinSpeed(GetBodyIndex()); }
 
 	static void ResolveCollision(Actor* a_actor1, Actor* a_actor2);
+	static void ResolveCollision(Actor* a_actor1, Actor* a_actor2,
+								 const Geometry::Collision& a_collision);
 
 protected:
 
+	void CreateBody(bool a_dynamic,
+					const glm::vec3& a_velocity, const glm::vec3& a_angularVelocity,
+					float a_minSpeed, float a_minAngularSpeed);
+
 	glm::vec4 m_color;
 	Geometry* m_geometry;
-	bool m_dynamic;
 	float m_mass;
 	glm::mat3 m_inertiaTensor;
 	Material m_material;
-	glm::vec3 m_velocity;
-	glm::vec3 m_angularVelocity;
-	glm::vec3 m_force;
-	glm::vec3 m_torque;
-	float m_minSpeed2;
-	float m_minAngularSpeed2;
+
+	// dynamic state lives in the store, so actors are just handles to it; until
+	// it's attached to a scene an actor keeps its body in a store of its own
+	RigidBodyStore* m_bodies;
+	RigidBodyStore::Handle m_body;
+	RigidBodyStore* m_ownBodies;
 };
@@ -0,0 +1,65 @@
+#include "Broadphase.h"
+#include <cfloat>
+#include <cmath>
+
+//
+// Bounds
+//
+
+Broadphase::Bounds::Bounds(const Geometry& a_geometry)
+{
+	glm::vec3 extents = a_geometry.AxisAlignedExtents();
+	min = a_geometry.position - extents;
+	max = a_geometry.position + extents;
+}
+bool Broadphase::Bounds::IsFinite() const
+{
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		if (!(fabs(min[i]) <= FLT_MAX && fabs(max[i]) <= FLT_MAX))
+			return false;
+	}
+	return true;
+}
+bool Broadphase::Bounds::Intersects(const glm::vec3& a_start, const glm::vec3& a_displacement, float a_radius) const
+{
+	// clip the segment against each slab of the bounds grown by the radius
+	float enter = 0, exit = 1;
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		float low = min[i] - a_radius, high = max[i] + a_radius;
+		if (0 == a_displacement[i])
+		{
+			if (a_start[i] < low || high < a_start[i])
+				return false;
+			continue;
+		}
+		float inverse = 1.0f / a_displacement[i];
+		float t1 = (low - a_start[i]) * inverse;
+		float t2 = (high - a_start[i]) * inverse;
+		enter = fmax(enter, fmin(t1, t2));
+		exit = fmin(exit, fmax(t1, t2));
+		if (enter > exit)
+			return false;
+	}
+	return true;
+}
+
+//
+// Broadphase
+//
+
+void Broadphase::Query(const Segment* a_segments, unsigned int a_count,
+					   std::vector<Actor*>& a_actors, std::vector<unsigned int>& a_starts)
+{
+	a_actors.clear();
+	a_starts.resize(a_count + 1);
+	std::vector<Actor*> actors;
+	for (unsigned int i = 0; i < a_count; ++i)
+	{
+		a_starts[i] = (unsigned int)a_actors.size();
+		Query(a_segments[i], actors);
+		a_actors.insert(a_actors.end(), actors.begin(), actors.end());
+	}
+	a_starts[a_count] = (unsigned int)a_actors.size();
+}
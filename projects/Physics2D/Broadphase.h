@@ -0,0 +1,283 @@
+#pragma once
+#include "Actor.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// Finds the pairs of actors whose axis-aligned bounding boxes overlap, so that
+// only those pairs need to go through Geometry::DetectCollision.
+class Broadphase
+{
+public:
+
+	struct Bounds
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+
+		Bounds(const glm::vec3& a_min = glm::vec3(0), const glm::vec3& a_max = glm::vec3(0))
+			: min(a_min), max(a_max) {}
+		Bounds(const Geometry& a_geometry);
+
+		bool Overlaps(const Bounds& a_bounds) const
+		{
+			return (min.x <= a_bounds.max.x && a_bounds.min.x <= max.x &&
+					min.y <= a_bounds.max.y && a_bounds.min.y <= max.y &&
+					min.z <= a_bounds.max.z && a_bounds.min.z <= max.z);
+		}
+		bool Contains(const Bounds& a_bounds) const
+		{
+			return (min.x <= a_bounds.min.x && a_bounds.max.x <= max.x &&
+					min.y <= a_bounds.min.y && a_bounds.max.y <= max.y &&
+					min.z <= a_bounds.min.z && a_bounds.max.z <= max.z);
+		}
+		bool IsFinite() const;
+
+		// whether a sphere of a_radius moving from a_start along a_displacement
+		// passes through these bounds - zero radius tests a line segment
+		bool Intersects(const glm::vec3& a_start, const glm::vec3& a_displacement, float a_radius = 0) const;
+	};
+
+	struct Segment
+	{
+		glm::vec3 start;
+		glm::vec3 displacement;
+		float radius;
+
+		Segment(const glm::vec3& a_start = glm::vec3(0), const glm::vec3& a_displacement = glm::vec3(0),
+				float a_radius = 0)
+			: start(a_start), displacement(a_displacement), radius(a_radius) {}
+	};
+
+	struct Pair
+	{
+		Actor* actor1;
+		Actor* actor2;
+
+		Pair(Actor* a_actor1 = nullptr, Actor* a_actor2 = nullptr)
+			: actor1(a_actor1), actor2(a_actor2) {}
+	};
+
+	// implemented broadphase types
+	class SweepAndPrune;
+	class UniformGrid;
+	class DynamicTree;
+
+	virtual ~Broadphase() {}
+
+	virtual void Add(Actor* a_actor) = 0;
+	virtual bool Remove(Actor* a_actor) = 0;	// returns false if actor not tracked
+	virtual void Clear() = 0;
+
+	// replaces the contents of a_pairs with every potentially colliding pair,
+	// skipping pairs where neither actor is dynamic
+	virtual void FindPairs(std::vector<Pair>& a_pairs) = 0;
+
+	// Queries see actors where they were at the last UpdateBounds or FindPairs,
+	// and each replaces the contents of a_actors with the actors whose bounds
+	// overlap a_bounds or that a_segment passes through, in no particular order.
+	virtual void UpdateBounds() = 0;
+	virtual void Query(const Bounds& a_bounds, std::vector<Actor*>& a_actors) = 0;
+	virtual void Query(const Segment& a_segment, std::vector<Actor*>& a_actors) = 0;
+
+	// runs a batch of segment queries, with the actors for segment i from
+	// a_starts[i] up to a_starts[i + 1] in a_actors
+	virtual void Query(const Segment* a_segments, unsigned int a_count,
+					   std::vector<Actor*>& a_actors, std::vector<unsigned int>& a_starts);
+
+protected:
+
+	static bool ShouldCollide(const Actor* a_actor1, const Actor* a_actor2)
+	{
+		return a_actor1->IsDynamic() || a_actor2->IsDynamic();
+	}
+};
+
+// Keeps proxies sorted along the axis with the most spread and sweeps along
+// it.  The sort is an insertion sort on the previous order, so it is close to
+// linear while the scene is coherent from step to step.
+class Broadphase::SweepAndPrune : public Broadphase
+{
+public:
+
+	SweepAndPrune() : m_axis(0), m_sorted(false) {}
+
+	virtual void Add(Actor* a_actor);
+	virtual bool Remove(Actor* a_actor);
+	virtual void Clear() { m_proxies.clear(); }
+	virtual void FindPairs(std::vector<Pair>& a_pairs);
+
+	// queries test every proxy
+	virtual void UpdateBounds();
+	virtual void Query(const Bounds& a_bounds, std::vector<Actor*>& a_actors);
+	virtual void Query(const Segment& a_segment, std::vector<Actor*>& a_actors);
+	using Broadphase::Query;
+
+protected:
+
+	struct Proxy
+	{
+		Actor* actor;
+		Bounds bounds;
+	};
+
+	void SelectAxis();
+
+	std::vector<Proxy> m_proxies;
+	unsigned int m_axis;
+	bool m_sorted;
+};
+
+// Buckets proxies into uniform cells and only tests proxies that share a cell.
+// Proxies that are unbounded (planes) or that would cover more than
+// a_maxCellsPerProxy cells are tested against everything instead.
+class Broadphase::UniformGrid : public Broadphase
+{
+public:
+
+	UniformGrid(float a_cellSize = 4.0f, unsigned int a_maxCellsPerProxy = 64)
+		: m_cellSize(a_cellSize), m_maxCellsPerProxy(a_maxCellsPerProxy) {}
+
+	virtual void Add(Actor* a_actor);
+	virtual bool Remove(Actor* a_actor);
+	virtual void Clear() { m_proxies.clear(); }
+	virtual void FindPairs(std::vector<Pair>& a_pairs);
+
+	// queries test every proxy
+	virtual void UpdateBounds();
+	virtual void Query(const Bounds& a_bounds, std::vector<Actor*>& a_actors);
+	virtual void Query(const Segment& a_segment, std::vector<Actor*>& a_actors);
+	using Broadphase::Query;
+
+	float GetCellSize() const { return m_cellSize; }
+	void SetCellSize(float a_cellSize) { m_cellSize = a_cellSize; }
+
+protected:
+
+	struct Proxy
+	{
+		Actor* actor;
+		Bounds bounds;
+		glm::ivec3 minCell;
+		glm::ivec3 maxCell;
+		bool oversized;
+	};
+
+	struct CellEntry
+	{
+		unsigned long long key;
+		glm::ivec3 cell;
+		unsigned int proxy;
+
+		bool operator<(const CellEntry& a_entry) const
+		{
+			return key < a_entry.key || (key == a_entry.key && proxy < a_entry.proxy);
+		}
+	};
+
+	float m_cellSize;
+	unsigned int m_maxCellsPerProxy;
+	std::vector<Proxy> m_proxies;
+	std::vector<CellEntry> m_entries;
+	std::vector<unsigned int> m_oversized;
+};
+
+// A bounding volume hierarchy that's kept up to date incrementally.  Leaves are
+// refit in place as their actors move, and only reinserted once an actor leaves
+// the bounds it went in with fattened by the margin, so a coherent scene keeps
+// most of its tree from step to step.  Insertions pick the sibling that adds
+// the least surface area, then rotate to keep the tree balanced.  Pairs come
+// from descending the tree against itself, and the same tree answers scene
+// queries.  Unbounded proxies (planes) stay out of the tree and are tested
+// against everything.
+class Broadphase::DynamicTree : public Broadphase
+{
+public:
+
+	DynamicTree(float a_margin = 0.05f) : m_margin(a_margin), m_root(NULL_NODE), m_freeNode(NULL_NODE) {}
+
+	virtual void Add(Actor* a_actor);
+	virtual bool Remove(Actor* a_actor);
+	virtual void Clear();
+	virtual void FindPairs(std::vector<Pair>& a_pairs);
+
+	virtual void UpdateBounds();
+	virtual void Query(const Bounds& a_bounds, std::vector<Actor*>& a_actors);
+	virtual void Query(const Segment& a_segment, std::vector<Actor*>& a_actors);
+
+	// segments are taken down the tree together, so each node is visited once
+	// for the whole batch
+	virtual void Query(const Segment* a_segments, unsigned int a_count,
+					   std::vector<Actor*>& a_actors, std::vector<unsigned int>& a_starts);
+
+	// how far leaves' bounds are grown past their actors' - a bigger margin means
+	// fewer reinsertions but looser culling
+	float GetMargin() const { return m_margin; }
+	void SetMargin(float a_margin) { m_margin = a_margin; }
+
+	int GetHeight() const { return (NULL_NODE != m_root ? m_nodes[m_root].height : 0); }
+
+protected:
+
+	static const unsigned int NULL_NODE = 0xFFFFFFFF;
+
+	struct Node
+	{
+		Bounds bounds;
+		unsigned int parent;	// the next free node, for free nodes
+		unsigned int child1;
+		unsigned int child2;
+		unsigned int proxy;		// leaves only
+		int height;				// leaves are zero
+
+		bool IsLeaf() const { return NULL_NODE == child1; }
+	};
+
+	struct Proxy
+	{
+		Actor* actor;
+		Bounds bounds;
+		Bounds fattened;		// by the margin, when its leaf went into the tree
+		unsigned int node;		// null while unbounded
+	};
+
+	struct NodePair
+	{
+		unsigned int node1;
+		unsigned int node2;
+
+		NodePair(unsigned int a_node1, unsigned int a_node2) : node1(a_node1), node2(a_node2) {}
+	};
+
+	// a segment still being taken down the tree in a batch, and a hit it found
+	struct Visit
+	{
+		unsigned int node;
+		unsigned int first;
+		unsigned int count;
+	};
+	struct Hit
+	{
+		unsigned int segment;
+		unsigned int proxy;
+	};
+
+	unsigned int AllocateNode();
+	void FreeNode(unsigned int a_node);
+	void InsertLeaf(unsigned int a_leaf);
+	void RemoveLeaf(unsigned int a_leaf);
+	unsigned int Balance(unsigned int a_node);
+	void Refit(unsigned int a_node);	// from a_node up to the root
+	void Track(unsigned int a_proxy);	// puts a proxy in the tree or the unbounded list
+
+	float m_margin;
+	unsigned int m_root;
+	unsigned int m_freeNode;
+	std::vector<Node> m_nodes;
+	std::vector<Proxy> m_proxies;
+	std::vector<unsigned int> m_unbounded;
+	std::vector<unsigned int> m_stack;
+	std::vector<NodePair> m_nodePairs;
+	std::vector<Visit> m_visits;
+	std::vector<unsigned int> m_active;
+	std::vector<Hit> m_hits;
+};
@@ -0,0 +1,505 @@
+#include "Broadphase.h"
+#include <algorithm>
+
+typedef Broadphase::Bounds Bounds;
+
+static Bounds Combine(const Bounds& a_bounds1, const Bounds& a_bounds2)
+{
+	return Bounds(glm::min(a_bounds1.min, a_bounds2.min), glm::max(a_bounds1.max, a_bounds2.max));
+}
+
+static bool Equal(const Bounds& a_bounds1, const Bounds& a_bounds2)
+{
+	return a_bounds1.min == a_bounds2.min && a_bounds1.max == a_bounds2.max;
+}
+
+// surface area, which is what the chance of a random ray hitting goes with
+static float Area(const Bounds& a_bounds)
+{
+	glm::vec3 size = a_bounds.max - a_bounds.min;
+	return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// depth first through the nodes that pass a_test, handing leaves to a_visit
+template <typename Node, typename Test, typename Visit>
+static void Traverse(const std::vector<Node>& a_nodes, unsigned int a_root, std::vector<unsigned int>& a_stack,
+					 Test a_test, Visit a_visit)
+{
+	a_stack.clear();
+	a_stack.push_back(a_root);
+	while (!a_stack.empty())
+	{
+		const Node& node = a_nodes[a_stack.back()];
+		a_stack.pop_back();
+		if (!a_test(node.bounds))
+			continue;
+		if (node.IsLeaf())
+			a_visit(node.proxy);
+		else
+		{
+			a_stack.push_back(node.child1);
+			a_stack.push_back(node.child2);
+		}
+	}
+}
+
+//
+// Proxies
+//
+
+void Broadphase::DynamicTree::Add(Actor* a_actor)
+{
+	if (nullptr == a_actor)
+		return;
+	Proxy proxy;
+	proxy.actor = a_actor;
+	proxy.bounds = Bounds(a_actor->GetGeometry());
+	proxy.node = NULL_NODE;
+	m_proxies.push_back(proxy);
+	Track((unsigned int)m_proxies.size() - 1);
+}
+bool Broadphase::DynamicTree::Remove(Actor* a_actor)
+{
+	for (unsigned int i = 0; i < m_proxies.size(); ++i)
+	{
+		if (m_proxies[i].actor != a_actor)
+			continue;
+		if (NULL_NODE != m_proxies[i].node)
+		{
+			RemoveLeaf(m_proxies[i].node);
+			FreeNode(m_proxies[i].node);
+		}
+		else
+			m_unbounded.erase(std::find(m_unbounded.begin(), m_unbounded.end(), i));
+
+		// the last proxy fills the gap, so only it needs renumbering
+		unsigned int last = (unsigned int)m_proxies.size() - 1;
+		if (i != last)
+		{
+			m_proxies[i] = m_proxies[last];
+			if (NULL_NODE != m_proxies[i].node)
+				m_nodes[m_proxies[i].node].proxy = i;
+			else
+				*std::find(m_unbounded.begin(), m_unbounded.end(), last) = i;
+		}
+		m_proxies.pop_back();
+		return true;
+	}
+	return false;
+}
+void Broadphase::DynamicTree::Clear()
+{
+	m_proxies.clear();
+	m_unbounded.clear();
+	m_nodes.clear();
+	m_root = NULL_NODE;
+	m_freeNode = NULL_NODE;
+}
+
+void Broadphase::DynamicTree::Track(unsigned int a_proxy)
+{
+	Proxy& proxy = m_proxies[a_proxy];
+	if (!proxy.bounds.IsFinite())
+	{
+		m_unbounded.push_back(a_proxy);
+		return;
+	}
+	proxy.fattened = Bounds(proxy.bounds.min - glm::vec3(m_margin), proxy.bounds.max + glm::vec3(m_margin));
+	unsigned int leaf = AllocateNode();
+	Node& node = m_nodes[leaf];
+	node.bounds = proxy.bounds;
+	node.child1 = node.child2 = NULL_NODE;
+	node.proxy = a_proxy;
+	node.height = 0;
+	proxy.node = leaf;
+	InsertLeaf(leaf);
+}
+
+// Leaves are refit to their actors' bounds where they are, and only move in
+// the tree once their actors leave the fattened bounds they went in with.
+void Broadphase::DynamicTree::UpdateBounds()
+{
+	for (unsigned int i = 0; i < m_proxies.size(); ++i)
+	{
+		Proxy& proxy = m_proxies[i];
+		proxy.bounds = Bounds(proxy.actor->GetGeometry());
+		bool finite = proxy.bounds.IsFinite();
+		if (NULL_NODE == proxy.node)
+		{
+			if (finite)
+			{
+				m_unbounded.erase(std::find(m_unbounded.begin(), m_unbounded.end(), i));
+				Track(i);
+			}
+		}
+		else if (!finite)
+		{
+			RemoveLeaf(proxy.node);
+			FreeNode(proxy.node);
+			proxy.node = NULL_NODE;
+			m_unbounded.push_back(i);
+		}
+		else if (!proxy.fattened.Contains(proxy.bounds))
+		{
+			RemoveLeaf(proxy.node);
+			proxy.fattened = Bounds(proxy.bounds.min - glm::vec3(m_margin), proxy.bounds.max + glm::vec3(m_margin));
+			m_nodes[proxy.node].bounds = proxy.bounds;
+			InsertLeaf(proxy.node);
+		}
+		else if (!Equal(m_nodes[proxy.node].bounds, proxy.bounds))
+		{
+			// ancestors above one that doesn't change won't either
+			m_nodes[proxy.node].bounds = proxy.bounds;
+			for (unsigned int index = m_nodes[proxy.node].parent; NULL_NODE != index; index = m_nodes[index].parent)
+			{
+				Node& node = m_nodes[index];
+				Bounds bounds = Combine(m_nodes[node.child1].bounds, m_nodes[node.child2].bounds);
+				if (Equal(node.bounds, bounds))
+					break;
+				node.bounds = bounds;
+			}
+		}
+	}
+}
+
+//
+// Tree
+//
+
+unsigned int Broadphase::DynamicTree::AllocateNode()
+{
+	if (NULL_NODE == m_freeNode)
+	{
+		m_nodes.push_back(Node());
+		return (unsigned int)m_nodes.size() - 1;
+	}
+	unsigned int index = m_freeNode;
+	m_freeNode = m_nodes[index].parent;
+	return index;
+}
+void Broadphase::DynamicTree::FreeNode(unsigned int a_node)
+{
+	m_nodes[a_node].parent = m_freeNode;
+	m_nodes[a_node].height = -1;
+	m_freeNode = a_node;
+}
+
+void Broadphase::DynamicTree::InsertLeaf(unsigned int a_leaf)
+{
+	if (NULL_NODE == m_root)
+	{
+		m_root = a_leaf;
+		m_nodes[a_leaf].parent = NULL_NODE;
+		return;
+	}
+
+	// Walk down to the sibling that costs the least area.  Pairing with a node
+	// costs their combined bounds, and going further down grows this node too.
+	Bounds bounds = m_nodes[a_leaf].bounds;
+	unsigned int index = m_root;
+	while (!m_nodes[index].IsLeaf())
+	{
+		const Node& node = m_nodes[index];
+		float area = Area(node.bounds);
+		float combined = Area(Combine(node.bounds, bounds));
+		float cost = 2 * combined;
+		float inherited = 2 * (combined - area);
+		float childCosts[2];
+		unsigned int children[2] = { node.child1, node.child2 };
+		for (unsigned int i = 0; i < 2; ++i)
+		{
+			const Node& child = m_nodes[children[i]];
+			childCosts[i] = Area(Combine(child.bounds, bounds)) + inherited;
+			if (!child.IsLeaf())
+				childCosts[i] -= Area(child.bounds);
+		}
+		if (cost < childCosts[0] && cost < childCosts[1])
+			break;
+		index = (childCosts[0] < childCosts[1] ? children[0] : children[1]);
+	}
+
+	// a new parent takes the sibling's place
+	unsigned int sibling = index;
+	unsigned int oldParent = m_nodes[sibling].parent;
+	unsigned int parent = AllocateNode();
+	Node& node = m_nodes[parent];
+	node.parent = oldParent;
+	node.bounds = Combine(m_nodes[sibling].bounds, bounds);
+	node.child1 = sibling;
+	node.child2 = a_leaf;
+	node.proxy = NULL_NODE;
+	node.height = m_nodes[sibling].height + 1;
+	if (NULL_NODE == oldParent)
+		m_root = parent;
+	else if (m_nodes[oldParent].child1 == sibling)
+		m_nodes[oldParent].child1 = parent;
+	else
+		m_nodes[oldParent].child2 = parent;
+	m_nodes[sibling].parent = parent;
+	m_nodes[a_leaf].parent = parent;
+	Refit(parent);
+}
+
+void Broadphase::DynamicTree::RemoveLeaf(unsigned int a_leaf)
+{
+	if (m_root == a_leaf)
+	{
+		m_root = NULL_NODE;
+		return;
+	}
+
+	// the leaf's sibling takes its parent's place
+	unsigned int parent = m_nodes[a_leaf].parent;
+	unsigned int grandparent = m_nodes[parent].parent;
+	unsigned int sibling = (m_nodes[parent].child1 == a_leaf ? m_nodes[parent].child2 : m_nodes[parent].child1);
+	m_nodes[sibling].parent = grandparent;
+	FreeNode(parent);
+	if (NULL_NODE == grandparent)
+	{
+		m_root = sibling;
+		return;
+	}
+	if (m_nodes[grandparent].child1 == parent)
+		m_nodes[grandparent].child1 = sibling;
+	else
+		m_nodes[grandparent].child2 = sibling;
+	Refit(grandparent);
+}
+
+void Broadphase::DynamicTree::Refit(unsigned int a_node)
+{
+	for (unsigned int index = a_node; NULL_NODE != index; index = m_nodes[index].parent)
+	{
+		index = Balance(index);
+		Node& node = m_nodes[index];
+		const Node& child1 = m_nodes[node.child1];
+		const Node& child2 = m_nodes[node.child2];
+		node.height = 1 + glm::max(child1.height, child2.height);
+		node.bounds = Combine(child1.bounds, child2.bounds);
+	}
+}
+
+// If one child is more than one level taller than the other, rotates its
+// taller child up into a_node's place.  Returns the node now in that place.
+unsigned int Broadphase::DynamicTree::Balance(unsigned int a_node)
+{
+	Node& a = m_nodes[a_node];
+	if (a.IsLeaf() || 2 > a.height)
+		return a_node;
+	int balance = m_nodes[a.child2].height - m_nodes[a.child1].height;
+	if (-1 <= balance && balance <= 1)
+		return a_node;
+
+	// b is the taller child, which moves up, and c stays under a
+	bool secondTaller = (0 < balance);
+	unsigned int up = (secondTaller ? a.child2 : a.child1);
+	Node& b = m_nodes[up];
+	const Node& c = m_nodes[secondTaller ? a.child1 : a.child2];
+
+	b.parent = a.parent;
+	a.parent = up;
+	if (NULL_NODE == b.parent)
+		m_root = up;
+	else if (m_nodes[b.parent].child1 == a_node)
+		m_nodes[b.parent].child1 = up;
+	else
+		m_nodes[b.parent].child2 = up;
+
+	// b's taller child stays with it, and its shorter one goes to a
+	unsigned int taller = b.child1, shorter = b.child2;
+	if (m_nodes[taller].height < m_nodes[shorter].height)
+		std::swap(taller, shorter);
+	b.child1 = a_node;
+	b.child2 = taller;
+	if (secondTaller)
+		a.child2 = shorter;
+	else
+		a.child1 = shorter;
+	m_nodes[shorter].parent = a_node;
+
+	a.bounds = Combine(c.bounds, m_nodes[shorter].bounds);
+	a.height = 1 + glm::max(c.height, m_nodes[shorter].height);
+	b.bounds = Combine(a.bounds, m_nodes[taller].bounds);
+	b.height = 1 + glm::max(a.height, m_nodes[taller].height);
+	return up;
+}
+
+//
+// Pairs and queries
+//
+
+void Broadphase::DynamicTree::FindPairs(std::vector<Pair>& a_pairs)
+{
+	a_pairs.clear();
+	UpdateBounds();
+
+	// Descend the tree against itself.  A node is visited paired with itself
+	// until its children are paired with each other, and a pair of nodes only
+	// goes further down while their bounds overlap, splitting the taller one.
+	if (NULL_NODE != m_root)
+	{
+		m_nodePairs.clear();
+		m_nodePairs.push_back(NodePair(m_root, m_root));
+		while (!m_nodePairs.empty())
+		{
+			NodePair visit = m_nodePairs.back();
+			m_nodePairs.pop_back();
+			const Node& node1 = m_nodes[visit.node1];
+			const Node& node2 = m_nodes[visit.node2];
+			if (visit.node1 == visit.node2)
+			{
+				if (!node1.IsLeaf())
+				{
+					m_nodePairs.push_back(NodePair(node1.child1, node1.child1));
+					m_nodePairs.push_back(NodePair(node1.child2, node1.child2));
+					if (m_nodes[node1.child1].bounds.Overlaps(m_nodes[node1.child2].bounds))
+						m_nodePairs.push_back(NodePair(node1.child1, node1.child2));
+				}
+			}
+			else if (node1.IsLeaf() && node2.IsLeaf())
+			{
+				const Proxy& proxy1 = m_proxies[node1.proxy];
+				const Proxy& proxy2 = m_proxies[node2.proxy];
+				if (ShouldCollide(proxy1.actor, proxy2.actor) && proxy1.bounds.Overlaps(proxy2.bounds))
+					a_pairs.push_back(Pair(proxy1.actor, proxy2.actor));
+			}
+			else
+			{
+				// pairs are only pushed once their bounds are known to overlap
+				bool split1 = (node2.IsLeaf() || (!node1.IsLeaf() && node1.height >= node2.height));
+				const Node& split = (split1 ? node1 : node2);
+				const Node& other = (split1 ? node2 : node1);
+				unsigned int otherIndex = (split1 ? visit.node2 : visit.node1);
+				if (m_nodes[split.child1].bounds.Overlaps(other.bounds))
+					m_nodePairs.push_back(NodePair(split.child1, otherIndex));
+				if (m_nodes[split.child2].bounds.Overlaps(other.bounds))
+					m_nodePairs.push_back(NodePair(split.child2, otherIndex));
+			}
+		}
+	}
+
+	// unbounded proxies are tested against everything
+	for (auto index : m_unbounded)
+	{
+		const Proxy& proxy1 = m_proxies[index];
+		for (unsigned int i = 0; i < m_proxies.size(); ++i)
+		{
+			const Proxy& proxy2 = m_proxies[i];
+			if (i == index || (NULL_NODE == proxy2.node && i < index) ||
+				!ShouldCollide(proxy1.actor, proxy2.actor) ||
+				!proxy1.bounds.Overlaps(proxy2.bounds))
+				continue;
+			a_pairs.push_back(Pair(proxy1.actor, proxy2.actor));
+		}
+	}
+}
+
+void Broadphase::DynamicTree::Query(const Bounds& a_bounds, std::vector<Actor*>& a_actors)
+{
+	a_actors.clear();
+	for (auto index : m_unbounded)
+	{
+		if (m_proxies[index].bounds.Overlaps(a_bounds))
+			a_actors.push_back(m_proxies[index].actor);
+	}
+	if (NULL_NODE == m_root)
+		return;
+	Traverse(m_nodes, m_root, m_stack,
+			 [&](const Bounds& a_node) { return a_node.Overlaps(a_bounds); },
+			 [&](unsigned int a_proxy)
+			 {
+				if (m_proxies[a_proxy].bounds.Overlaps(a_bounds))
+					a_actors.push_back(m_proxies[a_proxy].actor);
+			 });
+}
+
+void Broadphase::DynamicTree::Query(const Segment& a_segment, std::vector<Actor*>& a_actors)
+{
+	a_actors.clear();
+	for (auto index : m_unbounded)
+	{
+		if (m_proxies[index].bounds.Intersects(a_segment.start, a_segment.displacement, a_segment.radius))
+			a_actors.push_back(m_proxies[index].actor);
+	}
+	if (NULL_NODE == m_root)
+		return;
+	Traverse(m_nodes, m_root, m_stack,
+			 [&](const Bounds& a_node) { return a_node.Intersects(a_segment.start, a_segment.displacement, a_segment.radius); },
+			 [&](unsigned int a_proxy)
+			 {
+				const Proxy& proxy = m_proxies[a_proxy];
+				if (proxy.bounds.Intersects(a_segment.start, a_segment.displacement, a_segment.radius))
+					a_actors.push_back(proxy.actor);
+			 });
+}
+
+void Broadphase::DynamicTree::Query(const Segment* a_segments, unsigned int a_count,
+									std::vector<Actor*>& a_actors, std::vector<unsigned int>& a_starts)
+{
+	a_actors.clear();
+	a_starts.assign(a_count + 1, 0);
+	m_hits.clear();
+	for (auto index : m_unbounded)
+	{
+		const Proxy& proxy = m_proxies[index];
+		for (unsigned int i = 0; i < a_count; ++i)
+		{
+			if (proxy.bounds.Intersects(a_segments[i].start, a_segments[i].displacement, a_segments[i].radius))
+				m_hits.push_back({ i, index });
+		}
+	}
+
+	// Each visit carries the range of m_active holding the segments that reached
+	// its node.  The segments that also pass through the node are appended as
+	// the range its children get.  Ranges past the one being popped belong to
+	// finished subtrees, so they can be dropped.
+	if (NULL_NODE != m_root && 0 < a_count)
+	{
+		m_active.resize(a_count);
+		for (unsigned int i = 0; i < a_count; ++i)
+			m_active[i] = i;
+		m_visits.clear();
+		m_visits.push_back({ m_root, 0, a_count });
+		while (!m_visits.empty())
+		{
+			Visit visit = m_visits.back();
+			m_visits.pop_back();
+			m_active.resize(visit.first + visit.count);
+			const Node& node = m_nodes[visit.node];
+			unsigned int first = (unsigned int)m_active.size();
+			for (unsigned int i = visit.first; i < visit.first + visit.count; ++i)
+			{
+				const Segment& segment = a_segments[m_active[i]];
+				if (node.bounds.Intersects(segment.start, segment.displacement, segment.radius))
+					m_active.push_back(m_active[i]);
+			}
+			unsigned int count = (unsigned int)m_active.size() - first;
+			if (0 == count)
+				continue;
+			if (!node.IsLeaf())
+			{
+				m_visits.push_back({ node.child1, first, count });
+				m_visits.push_back({ node.child2, first, count });
+				continue;
+			}
+			const Proxy& proxy = m_proxies[node.proxy];
+			for (unsigned int i = first; i < first + count; ++i)
+			{
+				const Segment& segment = a_segments[m_active[i]];
+				if (proxy.bounds.Intersects(segment.start, segment.displacement, segment.radius))
+					m_hits.push_back({ m_active[i], node.proxy });
+			}
+		}
+	}
+
+	// bucket the hits by segment
+	for (auto& hit : m_hits)
+		++a_starts[hit.segment + 1];
+	for (unsigned int i = 0; i < a_count; ++i)
+		a_starts[i + 1] += a_starts[i];
+	a_actors.resize(m_hits.size());
+	std::vector<unsigned int>& next = m_stack;	// free again, so it holds each bucket's next slot
+	next.assign(a_starts.begin(), a_starts.end() - 1);
+	for (auto& hit : m_hits)
+		a_actors[next[hit.segment]++] = m_proxies[hit.proxy].actor;
+}
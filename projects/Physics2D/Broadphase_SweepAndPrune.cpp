@@ -0,0 +1,121 @@
+#include "Broadphase.h"
+#include <algorithm>
+#include <cmath>
+
+void Broadphase::SweepAndPrune::Add(Actor* a_actor)
+{
+	if (nullptr == a_actor)
+		return;
+	Proxy proxy;
+	proxy.actor = a_actor;
+	proxy.bounds = Bounds(a_actor->GetGeometry());
+	m_proxies.push_back(proxy);
+	m_sorted = false;
+}
+bool Broadphase::SweepAndPrune::Remove(Actor* a_actor)
+{
+	for (auto iter = m_proxies.begin(); iter != m_proxies.end(); ++iter)
+	{
+		if (iter->actor == a_actor)
+		{
+			m_proxies.erase(iter);	// keeps the remaining proxies sorted
+			return true;
+		}
+	}
+	return false;
+}
+
+// sweep along the axis where the actors are most spread out
+void Broadphase::SweepAndPrune::SelectAxis()
+{
+	glm::vec3 sum(0), sumSquared(0);
+	for (auto& proxy : m_proxies)
+	{
+		glm::vec3 p = proxy.actor->GetPosition();
+		sum += p;
+		sumSquared += p * p;
+	}
+	float n = (float)m_proxies.size();
+	glm::vec3 variance = sumSquared / n - (sum / n) * (sum / n);
+	unsigned int axis = (variance.y > variance.x ? 1 : 0);
+	if (variance.z > variance[axis])
+		axis = 2;
+	if (axis != m_axis)
+	{
+		m_axis = axis;
+		m_sorted = false;
+	}
+}
+
+void Broadphase::SweepAndPrune::FindPairs(std::vector<Pair>& a_pairs)
+{
+	a_pairs.clear();
+	if (m_proxies.empty())
+		return;
+
+	UpdateBounds();
+	SelectAxis();
+
+	// sort on the minimum along the sweep axis
+	unsigned int axis = m_axis;
+	if (!m_sorted)
+	{
+		std::sort(m_proxies.begin(), m_proxies.end(),
+				  [axis](const Proxy& a_proxy1, const Proxy& a_proxy2)
+				  {
+					return a_proxy1.bounds.min[axis] < a_proxy2.bounds.min[axis];
+				  });
+		m_sorted = true;
+	}
+	else
+	{
+		for (size_t i = 1; i < m_proxies.size(); ++i)
+		{
+			Proxy proxy = m_proxies[i];
+			size_t j = i;
+			for (; 0 < j && proxy.bounds.min[axis] < m_proxies[j - 1].bounds.min[axis]; --j)
+				m_proxies[j] = m_proxies[j - 1];
+			m_proxies[j] = proxy;
+		}
+	}
+
+	// sweep - each proxy only needs testing against the proxies that start
+	// before it ends on the sweep axis
+	for (size_t i = 0; i < m_proxies.size(); ++i)
+	{
+		const Proxy& proxy1 = m_proxies[i];
+		for (size_t j = i + 1;
+			 j < m_proxies.size() && m_proxies[j].bounds.min[axis] <= proxy1.bounds.max[axis];
+			 ++j)
+		{
+			const Proxy& proxy2 = m_proxies[j];
+			if (ShouldCollide(proxy1.actor, proxy2.actor) &&
+				proxy1.bounds.Overlaps(proxy2.bounds))
+				a_pairs.push_back(Pair(proxy1.actor, proxy2.actor));
+		}
+	}
+}
+
+void Broadphase::SweepAndPrune::UpdateBounds()
+{
+	for (auto& proxy : m_proxies)
+		proxy.bounds = Bounds(proxy.actor->GetGeometry());
+}
+void Broadphase::SweepAndPrune::Query(const Bounds& a_bounds, std::vector<Actor*>& a_actors)
+{
+	a_actors.clear();
+	for (auto& proxy : m_proxies)
+	{
+		if (proxy.bounds.Overlaps(a_bounds))
+			a_actors.push_back(proxy.actor);
+	}
+}
+void Broadphase::SweepAndPrune::Query(const Segment& a_segment, std::vector<Actor*>& a_actors)
+{
+	a_actors.clear();
+	for (auto& proxy : m_proxies)
+	{
+		if (proxy.bounds.Intersects(a_segment.start, a_segment.displacement, a_segment.radius))
+			a_actors.push_back(proxy.actor);
+	}
+}
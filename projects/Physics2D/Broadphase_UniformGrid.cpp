@@ -0,0 +1,156 @@
+#include "Broadphase.h"
+#include <algorithm>
+#include <cmath>
+
+// 21 bits per axis - cells that alias are told apart by comparing coordinates
+static unsigned long long CellKey(const glm::ivec3& a_cell)
+{
+	return ((unsigned long long)(a_cell.x & 0x1FFFFF) << 42) |
+		   ((unsigned long long)(a_cell.y & 0x1FFFFF) << 21) |
+		   (unsigned long long)(a_cell.z & 0x1FFFFF);
+}
+
+static bool CellInRange(const glm::vec3& a_cell)
+{
+	const float limit = (float)(1 << 30);
+	return glm::all(glm::lessThan(glm::abs(a_cell), glm::vec3(limit)));
+}
+
+void Broadphase::UniformGrid::Add(Actor* a_actor)
+{
+	if (nullptr == a_actor)
+		return;
+	Proxy proxy;
+	proxy.actor = a_actor;
+	proxy.bounds = Bounds(a_actor->GetGeometry());
+	proxy.oversized = false;
+	m_proxies.push_back(proxy);
+}
+bool Broadphase::UniformGrid::Remove(Actor* a_actor)
+{
+	for (auto iter = m_proxies.begin(); iter != m_proxies.end(); ++iter)
+	{
+		if (iter->actor == a_actor)
+		{
+			m_proxies.erase(iter);
+			return true;
+		}
+	}
+	return false;
+}
+
+void Broadphase::UniformGrid::FindPairs(std::vector<Pair>& a_pairs)
+{
+	a_pairs.clear();
+	m_entries.clear();
+	m_oversized.clear();
+	if (m_proxies.empty() || 0 >= m_cellSize)
+		return;
+
+	// bin every proxy into the cells its bounds cover
+	float inverseCellSize = 1.0f / m_cellSize;
+	for (unsigned int i = 0; i < m_proxies.size(); ++i)
+	{
+		Proxy& proxy = m_proxies[i];
+		proxy.bounds = Bounds(proxy.actor->GetGeometry());
+		proxy.oversized = !proxy.bounds.IsFinite();
+		if (!proxy.oversized)
+		{
+			glm::vec3 minCell = glm::floor(proxy.bounds.min * inverseCellSize);
+			glm::vec3 maxCell = glm::floor(proxy.bounds.max * inverseCellSize);
+			glm::vec3 cells = maxCell - minCell + glm::vec3(1);
+			proxy.oversized = (cells.x * cells.y * cells.z > (float)m_maxCellsPerProxy);
+
+			// cells too far out to convert to ints are treated as oversized too
+			if (!proxy.oversized)
+				proxy.oversized = !CellInRange(minCell) || !CellInRange(maxCell);
+			if (!proxy.oversized)
+			{
+				proxy.minCell = glm::ivec3(minCell);
+				proxy.maxCell = glm::ivec3(maxCell);
+			}
+		}
+		if (proxy.oversized)
+		{
+			m_oversized.push_back(i);
+			continue;
+		}
+		CellEntry entry;
+		entry.proxy = i;
+		for (entry.cell.x = proxy.minCell.x; entry.cell.x <= proxy.maxCell.x; ++entry.cell.x)
+		{
+			for (entry.cell.y = proxy.minCell.y; entry.cell.y <= proxy.maxCell.y; ++entry.cell.y)
+			{
+				for (entry.cell.z = proxy.minCell.z; entry.cell.z <= proxy.maxCell.z; ++entry.cell.z)
+				{
+					entry.key = CellKey(entry.cell);
+					m_entries.push_back(entry);
+				}
+			}
+		}
+	}
+	std::sort(m_entries.begin(), m_entries.end());
+
+	// test proxies that share a cell
+	for (size_t start = 0, end = 0; start < m_entries.size(); start = end)
+	{
+		for (end = start + 1; end < m_entries.size() && m_entries[end].key == m_entries[start].key; ++end);
+		for (size_t i = start; i < end; ++i)
+		{
+			const Proxy& proxy1 = m_proxies[m_entries[i].proxy];
+			for (size_t j = i + 1; j < end; ++j)
+			{
+				if (m_entries[i].cell != m_entries[j].cell)
+					continue;
+				const Proxy& proxy2 = m_proxies[m_entries[j].proxy];
+				if (!ShouldCollide(proxy1.actor, proxy2.actor) ||
+					!proxy1.bounds.Overlaps(proxy2.bounds))
+					continue;
+
+				// pairs that share several cells are only reported from the first one
+				if (glm::max(proxy1.minCell, proxy2.minCell) != m_entries[i].cell)
+					continue;
+				a_pairs.push_back(Pair(proxy1.actor, proxy2.actor));
+			}
+		}
+	}
+
+	// oversized proxies are tested against everything
+	for (auto index : m_oversized)
+	{
+		const Proxy& proxy1 = m_proxies[index];
+		for (unsigned int i = 0; i < m_proxies.size(); ++i)
+		{
+			const Proxy& proxy2 = m_proxies[i];
+			if (i == index || (proxy2.oversized && i < index) ||
+				!ShouldCollide(proxy1.actor, proxy2.actor) ||
+				!proxy1.bounds.Overlaps(proxy2.bounds))
+				continue;
+			a_pairs.push_back(Pair(proxy1.actor, proxy2.actor));
+		}
+	}
+}
+
+void Broadphase::UniformGrid::UpdateBounds()
+{
+	for (auto& proxy : m_proxies)
+		proxy.bounds = Bounds(proxy.actor->GetGeometry());
+}
+void Broadphase::UniformGrid::Query(const Bounds& a_bounds, std::vector<Actor*>& a_actors)
+{
+	a_actors.clear();
+	for (auto& proxy : m_proxies)
+	{
+		if (proxy.bounds.Overlaps(a_bounds))
+			a_actors.push_back(proxy.actor);
+	}
+}
+void Broadphase::UniformGrid::Query(const Segment& a_segment, std::vector<Actor*>& a_actors)
+{
+	a_actors.clear();
+	for (auto& proxy : m_proxies)
+	{
+		if (proxy.bounds.Intersects(a_segment.start, a_segment.displacement, a_segment.radius))
+			a_actors.push_back(proxy.actor);
+	}
+}
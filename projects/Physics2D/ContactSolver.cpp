@@ -0,0 +1,286 @@
+#include "ContactSolver.h"
+#include <algorithm>
+#include <cmath>
+
+static void TangentBasis(const glm::vec3& a_normal, glm::vec3& a_tangent1, glm::vec3& a_tangent2)
+{
+	if (fabs(a_normal.x) >= 0.57735f)
+		a_tangent1 = glm::normalize(glm::vec3(a_normal.y, -a_normal.x, 0));
+	else
+		a_tangent1 = glm::normalize(glm::vec3(0, a_normal.z, -a_normal.y));
+	a_tangent2 = glm::cross(a_normal, a_tangent1);
+}
+
+void ContactSolver::Begin()
+{
+	m_contacts.clear();
+}
+
+void ContactSolver::AddContact(const RigidBodyStore& a_bodies, unsigned int a_body1, unsigned int a_body2,
+							   const Geometry::Collision& a_collision,
+							   float a_friction, float a_restitution, unsigned int a_feature)
+{
+	Contact contact = Contact();
+	contact.id = ContactID(a_bodies.GetHandle(a_body1), a_bodies.GetHandle(a_body2), a_feature);
+	contact.body1 = a_body1;
+	contact.body2 = a_body2;
+	contact.normal = a_collision.normal;
+	contact.r1 = a_collision.point - a_bodies.position[a_body1];
+	contact.r2 = a_collision.point - a_bodies.position[a_body2];
+	contact.depth = a_collision.interpenetration;
+	contact.friction = a_friction;
+	contact.restitution = a_restitution;
+	contact.normalImpulse = 0;
+	contact.tangentImpulse1 = 0;
+	contact.tangentImpulse2 = 0;
+	m_contacts.push_back(contact);
+}
+
+void ContactSolver::Solve(RigidBodyStore& a_bodies)
+{
+	unsigned int bodyCount = a_bodies.Size();
+	m_inverseMass.resize(bodyCount);
+	m_inverseInertia.resize(bodyCount);
+	m_displacement.assign(bodyCount, glm::vec3(0));
+	PrepareBodies(a_bodies, 0, bodyCount);
+	SolveContacts(a_bodies, 0, (unsigned int)m_contacts.size());
+	StoreImpulses();
+}
+
+void ContactSolver::Solve(RigidBodyStore& a_bodies, const IslandBuilder& a_islands, TaskDispatcher& a_dispatcher)
+{
+	unsigned int bodyCount = a_bodies.Size();
+	m_inverseMass.resize(bodyCount);
+	m_inverseInertia.resize(bodyCount);
+	m_displacement.assign(bodyCount, glm::vec3(0));
+	a_dispatcher.RunChunks(bodyCount, 256, [&](unsigned int a_begin, unsigned int a_end)
+	{
+		PrepareBodies(a_bodies, a_begin, a_end);
+	});
+
+	// counting sort of contacts by island, keeping their order within each island
+	// so the result is the same however the islands are spread over threads -
+	// contacts without an island (which the scene never makes) go in a last bucket
+	unsigned int islandCount = a_islands.GetIslandCount();
+	m_islandStarts.assign(islandCount + 2, 0);
+	for (auto& contact : m_contacts)
+	{
+		unsigned int island = a_islands.GetIsland(a_bodies.dynamic[contact.body1] ? contact.body1 : contact.body2);
+		contact.island = (IslandBuilder::NO_ISLAND != island ? island : islandCount);
+		++m_islandStarts[contact.island + 1];
+	}
+	for (unsigned int i = 1; i < m_islandStarts.size(); ++i)
+		m_islandStarts[i] += m_islandStarts[i - 1];
+	m_sorted.resize(m_contacts.size());
+	for (auto& contact : m_contacts)
+		m_sorted[m_islandStarts[contact.island]++] = contact;
+	for (unsigned int i = (unsigned int)m_islandStarts.size() - 1; 0 < i; --i)
+		m_islandStarts[i] = m_islandStarts[i - 1];
+	m_islandStarts[0] = 0;
+	m_contacts.swap(m_sorted);
+
+	a_dispatcher.RunChunks(islandCount + 1, 8, [&](unsigned int a_begin, unsigned int a_end)
+	{
+		for (unsigned int i = a_begin; i < a_end; ++i)
+			SolveContacts(a_bodies, m_islandStarts[i], m_islandStarts[i + 1]);
+	});
+	StoreImpulses();
+}
+
+void ContactSolver::SolveContacts(RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end)
+{
+	if (a_begin == a_end)
+		return;
+	Prepare(a_bodies, a_begin, a_end);
+	for (unsigned int i = 0; i < m_velocityIterations; ++i)
+		SolveVelocities(a_bodies, a_begin, a_end);
+	SolvePositions(a_bodies, a_begin, a_end);
+}
+
+//
+// Setting up constraints
+//
+
+// inverse mass and world inverse inertia, once per body
+void ContactSolver::PrepareBodies(const RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end)
+{
+	for (unsigned int i = a_begin; i < a_end; ++i)
+	{
+		if (a_bodies.dynamic[i])
+		{
+			glm::mat3 rotation = glm::mat3_cast(a_bodies.orientation[i]);
+			m_inverseMass[i] = a_bodies.inverseMass[i];
+			m_inverseInertia[i] = rotation * a_bodies.inverseInertia[i] * glm::transpose(rotation);
+		}
+		else
+		{
+			m_inverseMass[i] = 0;
+			m_inverseInertia[i] = glm::mat3(0);
+		}
+	}
+}
+
+void ContactSolver::Prepare(RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end)
+{
+	for (unsigned int c = a_begin; c < a_end; ++c)
+	{
+		Contact& contact = m_contacts[c];
+		unsigned int b1 = contact.body1, b2 = contact.body2;
+		float im1 = m_inverseMass[b1], im2 = m_inverseMass[b2];
+		const glm::mat3& ii1 = m_inverseInertia[b1];
+		const glm::mat3& ii2 = m_inverseInertia[b2];
+		TangentBasis(contact.normal, contact.tangent1, contact.tangent2);
+
+		// effective mass along the normal and both tangents
+		glm::vec3 axes[3] = { contact.normal, contact.tangent1, contact.tangent2 };
+		float masses[3];
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			glm::vec3 rn1 = glm::cross(contact.r1, axes[i]);
+			glm::vec3 rn2 = glm::cross(contact.r2, axes[i]);
+			float k = im1 + im2 + glm::dot(rn1, ii1 * rn1) + glm::dot(rn2, ii2 * rn2);
+			masses[i] = (0 < k ? 1.0f / k : 0.0f);
+		}
+		contact.normalMass = masses[0];
+		contact.tangentMass1 = masses[1];
+		contact.tangentMass2 = masses[2];
+
+		// bounce off fast enough impacts
+		glm::vec3 dv = a_bodies.velocity[b2] + glm::cross(a_bodies.angularVelocity[b2], contact.r2) -
+					   a_bodies.velocity[b1] - glm::cross(a_bodies.angularVelocity[b1], contact.r1);
+		float vn = glm::dot(dv, contact.normal);
+		contact.velocityBias = (vn < -m_restitutionThreshold ? -contact.restitution * vn : 0.0f);
+	}
+
+	// warm start from the impulses contacts had last step, once every bounce
+	// has been measured so none of them see another contact's impulse
+	if (!m_warmStarting)
+		return;
+	for (unsigned int c = a_begin; c < a_end; ++c)
+	{
+		Contact& contact = m_contacts[c];
+		CachedImpulse key;
+		key.id = contact.id;
+		auto cached = std::lower_bound(m_cache.begin(), m_cache.end(), key);
+		if (cached == m_cache.end() || cached->id != contact.id)
+			continue;
+		contact.normalImpulse = cached->normalImpulse;
+		contact.tangentImpulse1 = glm::dot(cached->tangentImpulse, contact.tangent1);
+		contact.tangentImpulse2 = glm::dot(cached->tangentImpulse, contact.tangent2);
+		ApplyImpulse(a_bodies, contact, contact.normal * contact.normalImpulse +
+										contact.tangent1 * contact.tangentImpulse1 +
+										contact.tangent2 * contact.tangentImpulse2);
+	}
+}
+
+//
+// Iterating
+//
+
+// static bodies are shared between islands, so they're never written to
+void ContactSolver::ApplyImpulse(RigidBodyStore& a_bodies, const Contact& a_contact,
+								 const glm::vec3& a_impulse) const
+{
+	unsigned int b1 = a_contact.body1, b2 = a_contact.body2;
+	if (a_bodies.dynamic[b1])
+	{
+		a_bodies.velocity[b1] -= a_impulse * m_inverseMass[b1];
+		a_bodies.angularVelocity[b1] -= m_inverseInertia[b1] * glm::cross(a_contact.r1, a_impulse);
+	}
+	if (a_bodies.dynamic[b2])
+	{
+		a_bodies.velocity[b2] += a_impulse * m_inverseMass[b2];
+		a_bodies.angularVelocity[b2] += m_inverseInertia[b2] * glm::cross(a_contact.r2, a_impulse);
+	}
+}
+
+void ContactSolver::SolveVelocities(RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end)
+{
+	for (unsigned int c = a_begin; c < a_end; ++c)
+	{
+		Contact& contact = m_contacts[c];
+		const glm::vec3& v1 = a_bodies.velocity[contact.body1];
+		const glm::vec3& w1 = a_bodies.angularVelocity[contact.body1];
+		const glm::vec3& v2 = a_bodies.velocity[contact.body2];
+		const glm::vec3& w2 = a_bodies.angularVelocity[contact.body2];
+
+		// friction, clamped to the friction cone of the current normal impulse
+		glm::vec3 dv = v2 + glm::cross(w2, contact.r2) - v1 - glm::cross(w1, contact.r1);
+		float maxFriction = contact.friction * contact.normalImpulse;
+		float old1 = contact.tangentImpulse1, old2 = contact.tangentImpulse2;
+		float new1 = old1 - glm::dot(dv, contact.tangent1) * contact.tangentMass1;
+		float new2 = old2 - glm::dot(dv, contact.tangent2) * contact.tangentMass2;
+		float length2 = new1 * new1 + new2 * new2;
+		if (length2 > maxFriction * maxFriction)
+		{
+			float scale = (0 < length2 ? maxFriction / sqrt(length2) : 0.0f);
+			new1 *= scale;
+			new2 *= scale;
+		}
+		contact.tangentImpulse1 = new1;
+		contact.tangentImpulse2 = new2;
+		ApplyImpulse(a_bodies, contact, contact.tangent1 * (new1 - old1) + contact.tangent2 * (new2 - old2));
+
+		// normal impulse, with the accumulated impulse never pulling
+		dv = v2 + glm::cross(w2, contact.r2) - v1 - glm::cross(w1, contact.r1);
+		float vn = glm::dot(dv, contact.normal);
+		float oldImpulse = contact.normalImpulse;
+		contact.normalImpulse = glm::max(oldImpulse - contact.normalMass * (vn - contact.velocityBias), 0.0f);
+		ApplyImpulse(a_bodies, contact, contact.normal * (contact.normalImpulse - oldImpulse));
+	}
+}
+
+// push interpenetrating bodies apart, re-measuring each contact's depth from
+// how far its bodies have already been pushed
+void ContactSolver::SolvePositions(RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end)
+{
+	for (unsigned int i = 0; i < m_positionIterations; ++i)
+	{
+		for (unsigned int c = a_begin; c < a_end; ++c)
+		{
+			const Contact& contact = m_contacts[c];
+			unsigned int b1 = contact.body1, b2 = contact.body2;
+			float im1 = m_inverseMass[b1], im2 = m_inverseMass[b2];
+			if (0 == im1 + im2)
+				continue;
+			float depth = contact.depth -
+						  glm::dot(contact.normal, m_displacement[b2] - m_displacement[b1]);
+			float correction = (depth - m_allowedPenetration) * m_positionCorrection;
+			if (0 >= correction)
+				continue;
+			glm::vec3 push = contact.normal * (correction / (im1 + im2));
+			if (0 != im1)
+				m_displacement[b1] -= push * im1;
+			if (0 != im2)
+				m_displacement[b2] += push * im2;
+		}
+	}
+	for (unsigned int c = a_begin; c < a_end; ++c)
+	{
+		const Contact& contact = m_contacts[c];
+		if (a_bodies.dynamic[contact.body1])
+		{
+			a_bodies.position[contact.body1] += m_displacement[contact.body1];
+			m_displacement[contact.body1] = glm::vec3(0);
+		}
+		if (a_bodies.dynamic[contact.body2])
+		{
+			a_bodies.position[contact.body2] += m_displacement[contact.body2];
+			m_displacement[contact.body2] = glm::vec3(0);
+		}
+	}
+}
+
+void ContactSolver::StoreImpulses()
+{
+	m_cache.resize(m_contacts.size());
+	for (unsigned int i = 0; i < m_contacts.size(); ++i)
+	{
+		const Contact& contact = m_contacts[i];
+		m_cache[i].id = contact.id;
+		m_cache[i].normalImpulse = contact.normalImpulse;
+		m_cache[i].tangentImpulse = contact.tangent1 * contact.tangentImpulse1 +
+									contact.tangent2 * contact.tangentImpulse2;
+	}
+	std::sort(m_cache.begin(), m_cache.end());
+}
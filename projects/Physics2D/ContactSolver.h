@@ -0,0 +1,120 @@
+#pragma once
+#include "Geometry.h"
+#include "IslandBuilder.h"
+#include "RigidBodyStore.h"
+#include "TaskDispatcher.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// Sequential impulse (projected Gauss-Seidel) solver for contact constraints.
+// Contacts are gathered for a whole step and then solved together over several
+// iterations.  The impulses each contact ends up with are cached under the
+// contact's ID, and used as the starting guess when the same contact shows up
+// in the next step, so resting stacks settle in far fewer iterations.
+//
+// Islands share no dynamic bodies, so they can be solved in parallel - static
+// bodies are only ever read, never written.
+class ContactSolver
+{
+public:
+
+	ContactSolver(unsigned int a_velocityIterations = 10, unsigned int a_positionIterations = 3)
+		: m_velocityIterations(a_velocityIterations), m_positionIterations(a_positionIterations),
+		  m_restitutionThreshold(0.5f), m_allowedPenetration(0.01f), m_positionCorrection(0.8f),
+		  m_warmStarting(true) {}
+
+	// contacts between the same two bodies and feature get the same ID every step,
+	// so body handles are used instead of indices
+	static unsigned long long ContactID(RigidBodyStore::Handle a_body1, RigidBodyStore::Handle a_body2,
+										unsigned int a_feature = 0)
+	{
+		return ((unsigned long long)(a_body1 & 0xFFFFFF) << 40) |
+			   ((unsigned long long)(a_body2 & 0xFFFFFF) << 16) |
+			   (unsigned long long)(a_feature & 0xFFFF);
+	}
+
+	// starts a new step, keeping the previous step's impulses for warm starting
+	void Begin();
+	void AddContact(const RigidBodyStore& a_bodies, unsigned int a_body1, unsigned int a_body2,
+					const Geometry::Collision& a_collision,
+					float a_friction, float a_restitution, unsigned int a_feature = 0);
+	void Solve(RigidBodyStore& a_bodies);
+	void Solve(RigidBodyStore& a_bodies, const IslandBuilder& a_islands, TaskDispatcher& a_dispatcher);
+
+	unsigned int GetContactCount() const { return (unsigned int)m_contacts.size(); }
+
+	unsigned int GetVelocityIterations() const { return m_velocityIterations; }
+	void SetVelocityIterations(unsigned int a_iterations) { m_velocityIterations = a_iterations; }
+	unsigned int GetPositionIterations() const { return m_positionIterations; }
+	void SetPositionIterations(unsigned int a_iterations) { m_positionIterations = a_iterations; }
+	bool GetWarmStarting() const { return m_warmStarting; }
+	void SetWarmStarting(bool a_warmStarting) { m_warmStarting = a_warmStarting; }
+
+	// closing speeds below this don't bounce
+	float GetRestitutionThreshold() const { return m_restitutionThreshold; }
+	void SetRestitutionThreshold(float a_speed) { m_restitutionThreshold = a_speed; }
+
+protected:
+
+	struct Contact
+	{
+		unsigned long long id;
+		unsigned int body1;
+		unsigned int body2;
+		unsigned int island;
+		glm::vec3 normal;
+		glm::vec3 tangent1;
+		glm::vec3 tangent2;
+		glm::vec3 r1;
+		glm::vec3 r2;
+		float depth;
+		float friction;
+		float restitution;
+		float normalMass;
+		float tangentMass1;
+		float tangentMass2;
+		float velocityBias;
+		float normalImpulse;
+		float tangentImpulse1;
+		float tangentImpulse2;
+	};
+
+	struct CachedImpulse
+	{
+		unsigned long long id;
+		float normalImpulse;
+		glm::vec3 tangentImpulse;
+
+		bool operator<(const CachedImpulse& a_impulse) const { return id < a_impulse.id; }
+	};
+
+	void PrepareBodies(const RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end);
+
+	// solves the contacts in [a_begin, a_end), which mustn't share dynamic bodies
+	// with any other range being solved at the same time
+	void SolveContacts(RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end);
+	void Prepare(RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end);
+	void SolveVelocities(RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end);
+	void SolvePositions(RigidBodyStore& a_bodies, unsigned int a_begin, unsigned int a_end);
+	void ApplyImpulse(RigidBodyStore& a_bodies, const Contact& a_contact, const glm::vec3& a_impulse) const;
+	void StoreImpulses();
+
+	unsigned int m_velocityIterations;
+	unsigned int m_positionIterations;
+	float m_restitutionThreshold;
+	float m_allowedPenetration;
+	float m_positionCorrection;
+	bool m_warmStarting;
+
+	std::vector<Contact> m_contacts;
+	std::vector<CachedImpulse> m_cache;		// sorted on ID
+
+	// contacts sorted by island, and where each island's contacts start
+	std::vector<Contact> m_sorted;
+	std::vector<unsigned int> m_islandStarts;
+
+	// per body, for the step being solved
+	std::vector<float> m_inverseMass;
+	std::vector<glm::mat3> m_inverseInertia;	// in world space
+	std::vector<glm::vec3> m_displacement;
+};
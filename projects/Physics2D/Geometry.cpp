@@ -7,30 +7,12 @@ const glm::quat Geometry::UNROTATED_ORIENTATION = glm::quat(1, 0, 0, 0);
 // Collision
 //
 
-Geometry::Collision::~Collision()
+void Geometry::Collision::Flip()
 {
-	if (nullptr != m_shape1)
-	{
-		delete m_shape1;
-		m_shape1 = nullptr;
-	}
-	if (nullptr != m_shape2)
-	{
-		delete m_shape2;
-		m_shape2 = nullptr;
-	}
-}
-void Geometry::Collision::shape1(const Geometry& a_shape)
-{
-	if (nullptr != m_shape1)
-		delete m_shape1;
-	m_shape1 = a_shape.Clone();
-}
-void Geometry::Collision::shape2(const Geometry& a_shape)
-{
-	if (nullptr != m_shape2)
-		delete m_shape2;
-	m_shape2 = a_shape.Clone();
+	const Geometry* temp = m_shape1;
+	m_shape1 = m_shape2;
+	m_shape2 = temp;
+	normal *= -1.0f;
 }
 
 //
@@ -39,17 +21,26 @@ void Geometry::Collision::shape2(const Geometry& a_shape)
 
 Geometry::Geometry(const glm::vec3& a_position, Shape a_shape)
 	: position(a_position), m_shape(a_shape), m_rotationMatrix(NO_ROTATION),
-	  m_orientation(UNROTATED_ORIENTATION) {}
+	  m_orientation(UNROTATED_ORIENTATION)
+{
+	UpdateRotation();
+}
 Geometry::Geometry(const glm::vec3& a_position,
 				   const glm::mat4& a_rotation,
 				   Shape a_shape)
 	: position(a_position), m_rotationMatrix(a_rotation), m_shape(a_shape),
-	  m_orientation(glm::quat_cast(a_rotation)) {}
+	  m_orientation(glm::quat_cast(a_rotation))
+{
+	UpdateRotation();
+}
 Geometry::Geometry(const glm::vec3& a_position,
 				   const glm::quat& a_orientation,
 				   Shape a_shape)
 	: position(a_position), m_rotationMatrix(glm::mat4_cast(a_orientation)),
-	  m_shape(a_shape), m_orientation(a_orientation) {}
+	  m_shape(a_shape), m_orientation(a_orientation)
+{
+	UpdateRotation();
+}
 Geometry::Geometry(const glm::vec3& a_position,
 				   const glm::vec3& a_forward, const glm::vec3& a_up,
 				   Shape a_shape)
@@ -57,6 +48,7 @@ Geometry::Geometry(const glm::vec3& a_position,
 	  m_rotationMatrix(glm::orientation(a_forward, a_up))
 {
 	m_orientation = glm::quat_cast(m_rotationMatrix);
+	UpdateRotation();
 }
 Geometry::Geometry(const glm::vec3& a_position,
 				   const glm::vec3& a_axis, float a_angle,
@@ -65,6 +57,7 @@ Geometry::Geometry(const glm::vec3& a_position,
 {
 	AxisAngle(m_orientation, a_angle, a_axis);
 	m_rotationMatrix = glm::mat4_cast(m_orientation);
+	UpdateRotation();
 }
 Geometry::Geometry(const glm::vec3& a_position,
 				   float a_yaw, float a_pitch, float a_roll,
@@ -75,6 +68,7 @@ Geometry::Geometry(const glm::vec3& a_position,
 {
 	YawPitchRoll(m_orientation, a_yaw, a_pitch, a_roll, a_yawAxis, a_rollAxis);
 	m_rotationMatrix = glm::mat4_cast(m_orientation);
+	UpdateRotation();
 }
 Geometry::Geometry(const glm::vec3& a_position,
 				   float a_yaw, float a_pitch, float a_roll,
@@ -83,6 +77,7 @@ Geometry::Geometry(const glm::vec3& a_position,
 {
 	YawPitchRoll(m_orientation, a_yaw, a_pitch, a_roll);
 	m_rotationMatrix = glm::mat4_cast(m_orientation);
+	UpdateRotation();
 }
 
 //
@@ -103,7 +98,7 @@ glm::quat Geometry::Rotation(const glm::vec3& a_rotation)
 void Geometry::AxisAngle(glm::quat& a_orientation,
 						 float a_angle, const glm::vec3& a_axis)
 {
-	if (glm::vec3(0) == a_axis)
+	if (glm::vec3(0) == a_axis || 0 == a_angle)
 	{
 		a_orientation = UNROTATED_ORIENTATION;
 		return;
@@ -191,7 +186,8 @@ glm::quat Geometry::YawPitchRoll(float a_yaw, float a_pitch, float a_roll,
 
 glm::vec3 Geometry::ToWorld(const glm::vec3& a_localCoordinate, bool a_isDirection) const
 {
-	return (glm::translate(position) * m_rotationMatrix * glm::vec4(a_localCoordinate, a_isDirection ? 0 : 1)).xyz();
+	glm::vec3 rotated = m_rotation * a_localCoordinate;
+	return (a_isDirection ? rotated : rotated + position);
 }
 glm::vec3 Geometry::ToWorld(float a_localX, float a_localY, float a_localZ, bool a_isDirection) const
 {
@@ -199,7 +195,7 @@ glm::vec3 Geometry::ToWorld(float a_localX, float a_localY, float a_localZ, bool
 }
 glm::vec3 Geometry::ToLocal(const glm::vec3& a_worldCoordinate, bool a_isDirection) const
 {
-	return (glm::inverse(m_rotationMatrix) * glm::translate(-position) * glm::vec4(a_worldCoordinate, a_isDirection ? 0 : 1)).xyz();
+	return m_inverseRotation * (a_isDirection ? a_worldCoordinate : a_worldCoordinate - position);
 }
 glm::vec3 Geometry::ToLocal(float a_worldX, float a_worldY, float a_worldZ, bool a_isDirection) const
 {
@@ -210,16 +206,23 @@ glm::vec3 Geometry::ToLocal(float a_worldX, float a_worldY, float a_worldZ, bool
 // orientation manipulation
 //
 
+void Geometry::UpdateRotation()
+{
+	m_rotation = glm::mat3(m_rotationMatrix);
+	m_inverseRotation = glm::transpose(m_rotation);
+}
+
 void Geometry::orientation(const glm::quat& a_orientation)
 {
 	m_orientation = a_orientation;
 	m_rotationMatrix = glm::mat4_cast(m_orientation);
+	UpdateRotation();
 }
 void Geometry::orientation(const glm::vec3& a_rotation)
 {
 	orientation(Rotation(a_rotation));
 }
-void Geometry::orientation(float a_angle, glm::vec3& a_axis)
+void Geometry::orientation(float a_angle, const glm::vec3& a_axis)
 {
 	orientation(AxisAngle(a_angle, a_axis));
 }
@@ -227,12 +230,13 @@ void Geometry::spin(const glm::quat& a_rotation)
 {
 	m_orientation = a_rotation * m_orientation;
 	m_rotationMatrix = glm::mat4_cast(m_orientation);
+	UpdateRotation();
 }
 void Geometry::spin(const glm::vec3& a_rotation)
 {
 	spin(Rotation(a_rotation));
 }
-void Geometry::spin(float a_angle, glm::vec3& a_axis)
+void Geometry::spin(float a_angle, const glm::vec3& a_axis)
 {
 	spin(AxisAngle(a_angle, a_axis));
 }
@@ -1,5 +1,4 @@
 #pragma once
-#include "Gizmos.h"
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include <vector>
@@ -19,24 +18,50 @@ public:
 		SHAPE_COUNT = 4
 	};
 
+	// Contact between two shapes.  The shapes aren't copied, so a collision
+	// is only meaningful while both shapes are alive and unmoved.
 	struct Collision
 	{
 		glm::vec3 point;
 		glm::vec3 normal; // points from shape1 to shape 2
 		float interpenetration;
+		unsigned int feature;	// tells a pair's contact points apart from step to step
 
-		~Collision();
+		Collision() : point(0), normal(0), interpenetration(0), feature(0) {}
 
 		const Geometry& shape1() const { return *m_shape1; }
-		Geometry& shape1() { return *m_shape1; }
-		void shape1(const Geometry& a_shape);
+		void shape1(const Geometry& a_shape) { m_shape1 = &a_shape; }
 		const Geometry& shape2() const { return *m_shape2; }
-		Geometry& shape2() { return *m_shape2; }
-		void shape2(const Geometry& a_shape);
+		void shape2(const Geometry& a_shape) { m_shape2 = &a_shape; }
+
+		// swap shapes, so the normal points the other way
+		void Flip();
 
 	private:
-		Geometry* m_shape1 = nullptr;
-		Geometry* m_shape2 = nullptr;
+		const Geometry* m_shape1 = nullptr;
+		const Geometry* m_shape2 = nullptr;
+	};
+
+	// Collisions found during a step.  Clearing keeps the storage, so once the
+	// buffer has grown to fit a scene, detecting collisions doesn't allocate.
+	class ContactBuffer
+	{
+	public:
+
+		ContactBuffer(unsigned int a_capacity = 256) { m_contacts.reserve(a_capacity); }
+
+		void Clear() { m_contacts.clear(); }
+		Collision& Append() { m_contacts.push_back(Collision()); return m_contacts.back(); }
+		void Truncate(unsigned int a_size) { if (a_size < Size()) m_contacts.resize(a_size); }
+
+		unsigned int Size() const { return (unsigned int)m_contacts.size(); }
+		bool Empty() const { return m_contacts.empty(); }
+		const Collision& operator[](unsigned int a_index) const { return m_contacts[a_index]; }
+		Collision& operator[](unsigned int a_index) { return m_contacts[a_index]; }
+
+	private:
+
+		std::vector<Collision> m_contacts;
 	};
 
 	// implemented base classes for each shape
@@ -62,6 +87,14 @@ public:
 								  const glm::vec3& a_rollAxis = glm::vec3(0, 0, 1));
 	static bool DetectCollision(const Geometry& a_shape1, const Geometry& a_shape2,
 								Geometry::Collision* a_collision = nullptr);
+	static bool DetectCollision(const Geometry& a_shape1, const Geometry& a_shape2,
+								Geometry::ContactBuffer& a_contacts);	// appends on collision
+
+	// Time of impact, as a fraction of a_displacement, for a sphere moving past
+	// a shape that stays put - zero if they already touch.  Returns false if the
+	// sphere gets all the way there without touching it.
+	static bool Sweep(const Sphere& a_sphere, const glm::vec3& a_displacement,
+					  const Geometry& a_shape, float& a_time, glm::vec3* a_normal = nullptr);
 
 	// abstract functions
 	virtual glm::vec3 AxisAlignedExtents() const = 0;
@@ -89,10 +122,10 @@ public:
 	const glm::quat& orientation() const { return m_orientation; }
 	void orientation(const glm::quat& a_orientation);
 	void orientation(const glm::vec3& a_rotation);
-	void orientation(float a_angle, glm::vec3& a_axis = glm::vec3(0, 0, 1));
+	void orientation(float a_angle, const glm::vec3& a_axis = glm::vec3(0, 0, 1));
 	void spin(const glm::quat& a_rotation);
 	void spin(const glm::vec3& a_rotation);
-	void spin(float a_angle, glm::vec3& a_axis = glm::vec3(0, 0, 1));
+	void spin(float a_angle, const glm::vec3& a_axis = glm::vec3(0, 0, 1));
 
 	// constant values
 	static const glm::mat4 NO_ROTATION;
@@ -128,8 +161,14 @@ protected:
 
 private:
 
+	// recaches the 3x3 rotation and its inverse whenever the rotation changes -
+	// position is read as is, so writing it needs no invalidation
+	void UpdateRotation();
+
 	glm::quat m_orientation;
 	glm::mat4 m_rotationMatrix;
+	glm::mat3 m_rotation;
+	glm::mat3 m_inverseRotation;	// the transpose, since it's a pure rotation
 	Shape m_shape;
 };
 
@@ -1,61 +1,69 @@
 #include "Geometry.h"
-#include <functional>
+#include <cfloat>
+#include <xmmintrin.h>
 
 typedef bool(*CollisionDetector)(const Geometry& a_shape1, const Geometry& a_shape2,
 								 Geometry::Collision* a_collision);
 
-static bool Flip(CollisionDetector a_detector,
-				 const Geometry& a_shape1, const Geometry& a_shape2,
+// The detectors below are written against concrete shapes.  The dispatch table
+// is indexed by GetShape(), so by the time a detector is called both shapes are
+// known and can be downcast statically instead of with dynamic_cast.
+template <typename Shape1, typename Shape2,
+		  bool(*Detector)(const Shape1&, const Shape2&, Geometry::Collision*)>
+static bool Dispatch(const Geometry& a_shape1, const Geometry& a_shape2,
+					 Geometry::Collision* a_collision)
+{
+	return Detector(static_cast<const Shape1&>(a_shape1),
+					static_cast<const Shape2&>(a_shape2), a_collision);
+}
+
+// as above, for pairs that are handled by the detector for the reverse order
+template <typename Shape1, typename Shape2,
+		  bool(*Detector)(const Shape2&, const Shape1&, Geometry::Collision*)>
+static bool Flip(const Geometry& a_shape1, const Geometry& a_shape2,
 				 Geometry::Collision* a_collision)
 {
-	bool result = a_detector(a_shape2, a_shape1, a_collision);
+	bool result = Detector(static_cast<const Shape2&>(a_shape2),
+						   static_cast<const Shape1&>(a_shape1), a_collision);
 	if (result && nullptr != a_collision)
-	{
-		Geometry* temp = a_collision->shape1().Clone();
-		a_collision->shape1(a_collision->shape2());
-		a_collision->shape2(*temp);
-		delete temp;
-		a_collision->normal *= -1.0f;
-	}
+		a_collision->Flip();
 	return result;
 }
 
-static bool PlanePlane(const Geometry& a_shape1, const Geometry& a_shape2,
+typedef Geometry::Plane Plane;
+typedef Geometry::Sphere Sphere;
+typedef Geometry::Box Box;
+
+static bool PlanePlane(const Plane& a_plane1, const Plane& a_plane2,
 					   Geometry::Collision* a_collision);
-static bool PlaneSphere(const Geometry& a_shape1, const Geometry& a_shape2,
+static bool PlaneSphere(const Plane& a_plane, const Sphere& a_sphere,
 						Geometry::Collision* a_collision);
-static bool PlaneBox(const Geometry& a_shape1, const Geometry& a_shape2,
+static bool PlaneBox(const Plane& a_plane, const Box& a_box,
 					 Geometry::Collision* a_collision);
-
-static bool SpherePlane(const Geometry& a_shape1, const Geometry& a_shape2,
-						Geometry::Collision* a_collision)
-{
-	return Flip(PlaneSphere, a_shape1, a_shape2, a_collision);
-}
-static bool SphereSphere(const Geometry& a_shape1, const Geometry& a_shape2,
+static bool SphereSphere(const Sphere& a_sphere1, const Sphere& a_sphere2,
 						 Geometry::Collision* a_collision);
-static bool SphereBox(const Geometry& a_shape1, const Geometry& a_shape2,
+static bool SphereBox(const Sphere& a_sphere, const Box& a_box,
 					  Geometry::Collision* a_collision);
-
-static bool BoxPlane(const Geometry& a_shape1, const Geometry& a_shape2,
-					 Geometry::Collision* a_collision)
-{
-	return Flip(PlaneBox, a_shape1, a_shape2, a_collision);
-}
-static bool BoxSphere(const Geometry& a_shape1, const Geometry& a_shape2,
-					  Geometry::Collision* a_collision)
-{
-	return Flip(SphereBox, a_shape1, a_shape2, a_collision);
-}
-static bool BoxBox(const Geometry& a_shape1, const Geometry& a_shape2,
+static bool BoxBox(const Box& a_box1, const Box& a_box2,
 				   Geometry::Collision* a_collision);
+static bool BoxBoxContacts(const Box& a_box1, const Box& a_box2,
+						   Geometry::ContactBuffer& a_contacts);
 
 static CollisionDetector g_collisionFunctions[Geometry::SHAPE_COUNT][Geometry::SHAPE_COUNT] =
 {
 	{ nullptr, nullptr, nullptr, nullptr },
-	{ nullptr, PlanePlane, PlaneSphere, PlaneBox },
-	{ nullptr, SpherePlane, SphereSphere, SphereBox },
-	{ nullptr, BoxPlane, BoxSphere, BoxBox }
+	{ nullptr,
+	  Dispatch<Plane, Plane, PlanePlane>,
+	  Dispatch<Plane, Sphere, PlaneSphere>,
+	  Dispatch<Plane, Box, PlaneBox> },
+	{ nullptr,
+	  Flip<Sphere, Plane, PlaneSphere>,
+	  Dispatch<Sphere, Sphere, SphereSphere>,
+	  Dispatch<Sphere, Box, SphereBox> },
+	{ nullptr,
+	  Flip<Box, Plane, PlaneBox>,
+	  Flip<Box, Sphere, SphereBox>,
+	  Dispatch<Box, Box, BoxBox> }
 };
 
 bool Geometry::DetectCollision(const Geometry& a_shape1, const Geometry& a_shape2,
@@ -73,31 +81,38 @@ bool Geometry::DetectCollision(const Geometry& a_shape1, const Geometry& a_shape
 		return false;
 	return f(a_shape1, a_shape2, a_collision);
 }
+bool Geometry::DetectCollision(const Geometry& a_shape1, const Geometry& a_shape2,
+							   Geometry::ContactBuffer& a_contacts)
+{
+	// boxes touch over a face or edge, so they get a contact per manifold point
+	if (BOX == a_shape1.GetShape() && BOX == a_shape2.GetShape() && &a_shape1 != &a_shape2)
+		return BoxBoxContacts(static_cast<const Box&>(a_shape1), static_cast<const Box&>(a_shape2), a_contacts);
+
+	unsigned int size = a_contacts.Size();
+	if (DetectCollision(a_shape1, a_shape2, &a_contacts.Append()))
+		return true;
+	a_contacts.Truncate(size);
+	return false;
+}
 
-bool PlanePlane(const Geometry& a_shape1, const Geometry& a_shape2,
+bool PlanePlane(const Plane& a_plane1, const Plane& a_plane2,
 				Geometry::Collision* a_collision)
 {
-	// type check
-	const Geometry::Plane* plane1 = dynamic_cast<const Geometry::Plane*>(&a_shape1);
-	const Geometry::Plane* plane2 = dynamic_cast<const Geometry::Plane*>(&a_shape2);
-	if (nullptr == plane1 || nullptr == plane2)
-		return false;
-
 	// the only non-colliding planes are parallel planes with distance between them
-	glm::vec3 normal1 = plane1->normal();
-	glm::vec3 normal2 = plane2->normal();
+	glm::vec3 normal1 = a_plane1.normal();
+	glm::vec3 normal2 = a_plane2.normal();
 	glm::vec3 cross = glm::cross(normal1, normal2);
 	if (glm::vec3(0) == cross &&
-		0 != glm::dot(normal1, plane2->position - plane1->position))
+		0 != glm::dot(normal1, a_plane2.position - a_plane1.position))
 		return false;
 
 	// otherwise, planes always collide
 	if (nullptr != a_collision)
 	{
-		a_collision->shape1(a_shape1);
-		a_collision->shape2(a_shape2);
+		a_collision->shape1(a_plane1);
+		a_collision->shape2(a_plane2);
 		a_collision->interpenetration = 0;
-		glm::vec3 midpoint = (plane1->position + plane2->position) * 0.5f;
+		glm::vec3 midpoint = (a_plane1.position + a_plane2.position) * 0.5f;
 		if (glm::vec3(0) == cross)
 		{
 			a_collision->normal = normal1;
@@ -107,8 +122,8 @@ bool PlanePlane(const Geometry& a_shape1, const Geometry& a_shape2,
 		{
 			a_collision->normal = glm::normalize(normal1 + (0 > glm::dot(normal1, normal2) ? -normal2 : normal2));
 			glm::vec3 p;
-			float d1 = glm::dot(plane1->position, normal1);
-			float d2 = glm::dot(plane2->position, normal2);
+			float d1 = glm::dot(a_plane1.position, normal1);
+			float d2 = glm::dot(a_plane2.position, normal2);
 			if (0 != cross.z)
 			{
 				p.x = (d1*normal2.y - d2*normal1.y) / cross.z;
@@ -134,96 +149,91 @@ bool PlanePlane(const Geometry& a_shape1, const Geometry& a_shape2,
 	return true;
 }
 
-bool PlaneSphere(const Geometry& a_shape1, const Geometry& a_shape2,
+bool PlaneSphere(const Plane& a_plane, const Sphere& a_sphere,
 				 Geometry::Collision* a_collision)
 {
-	// type check
-	const Geometry::Plane* plane = dynamic_cast<const Geometry::Plane*>(&a_shape1);
-	const Geometry::Sphere* sphere = dynamic_cast<const Geometry::Sphere*>(&a_shape2);
-	if (nullptr == plane || nullptr == sphere)
-		return false;
-
 	// sphere and plane collide if distance between <= radius
-	glm::vec3 normal = plane->normal();
-	glm::vec3 displacement = sphere->position - plane->position;
+	glm::vec3 normal = a_plane.normal();
+	glm::vec3 displacement = a_sphere.position - a_plane.position;
 	float distance = glm::dot(normal, displacement);
 	if (0 > distance)
 	{
 		normal *= -1.0f;
 		distance *= -1;
 	}
-	if (distance <= sphere->radius)
+	if (distance <= a_sphere.radius)
 	{
 		if (nullptr != a_collision)
 		{
-			a_collision->shape1(a_shape1);
-			a_collision->shape2(a_shape2);
+			a_collision->shape1(a_plane);
+			a_collision->shape2(a_sphere);
 			a_collision->normal = normal;
-			a_collision->interpenetration = sphere->radius - distance;
-			a_collision->point = sphere->position - a_collision->normal * distance;
+			a_collision->interpenetration = a_sphere.radius - distance;
+			a_collision->point = a_sphere.position - a_collision->normal * distance;
 		}
 		return true;
 	}
 	return false;
 }
 
-static void GetMinAndMax(const std::vector<glm::vec3>& a_points,
-						 std::function<float(const glm::vec3&)> a_distanceFunction,
+// averages the points that are (within tolerance) furthest each way along the
+// distance function, without allocating
+template <typename DistanceFunction>
+static void GetMinAndMax(const glm::vec3* a_points, unsigned int a_count,
+						 const DistanceFunction& a_distanceFunction,
 						 float& a_min, float& a_max,
 						 glm::vec3& a_minPoint, glm::vec3& a_maxPoint,
 						 float a_tolerance = 0.0001f)
 {
 	if (0 > a_tolerance)
 		a_tolerance *= -1;
-	std::vector<glm::vec3> maxPoints, minPoints;
-	bool start = true;
-	for (auto point : a_points)
+	glm::vec3 minSum(0), maxSum(0);
+	unsigned int minCount = 0, maxCount = 0;
+	for (unsigned int i = 0; i < a_count; ++i)
 	{
+		const glm::vec3& point = a_points[i];
 		float distance = a_distanceFunction(point);
-		if (start || distance >= a_max - a_tolerance)
+		if (0 == i || distance >= a_max - a_tolerance)
 		{
-			if (distance > a_max + a_tolerance)
-				maxPoints.clear();
-			maxPoints.push_back(point);
+			if (0 == i || distance > a_max + a_tolerance)
+			{
+				maxSum = glm::vec3(0);
+				maxCount = 0;
+			}
+			maxSum += point;
+			++maxCount;
 			a_max = distance;
 		}
-		if (start || distance <= a_min + a_tolerance)
+		if (0 == i || distance <= a_min + a_tolerance)
 		{
-			if (distance < a_min - a_tolerance)
-				minPoints.clear();
-			minPoints.push_back(point);
+			if (0 == i || distance < a_min - a_tolerance)
+			{
+				minSum = glm::vec3(0);
+				minCount = 0;
+			}
+			minSum += point;
+			++minCount;
 			a_min = distance;
 		}
-		start = false;
 	}
-	a_minPoint = glm::vec3(0);
-	for (auto point : minPoints)
-		a_minPoint += point;
-	a_minPoint /= (float)(minPoints.size());
-	a_maxPoint = glm::vec3(0);
-	for (auto point : maxPoints)
-		a_maxPoint += point;
-	a_maxPoint /= (float)(maxPoints.size());
+	a_minPoint = minSum / (float)minCount;
+	a_maxPoint = maxSum / (float)maxCount;
 }
 
-bool PlaneBox(const Geometry& a_shape1, const Geometry& a_shape2,
+bool PlaneBox(const Plane& a_plane, const Box& a_box,
 			  Geometry::Collision* a_collision)
 {
-	// type check
-	const Geometry::Plane* plane = dynamic_cast<const Geometry::Plane*>(&a_shape1);
-	const Geometry::Box* box = dynamic_cast<const Geometry::Box*>(&a_shape2);
-	if (nullptr == plane || nullptr == box)
-		return false;
-
 	// get distances from plane to vertices, with positive distances in the normal
 	// direction and negative distances in the opposite direction
-	glm::vec3 normal = plane->normal();
+	glm::vec3 normal = a_plane.normal();
 	float max, min;
 	glm::vec3 minPoint, maxPoint;
-	GetMinAndMax(box->vertices(),
+	glm::vec3 vertices[8];
+	a_box.vertices(vertices);
+	GetMinAndMax(vertices, 8,
 				 [&](const glm::vec3& a_point)
 				 {
-					return glm::dot(normal, a_point - plane->position);
+					return glm::dot(normal, a_point - a_plane.position);
 				 },
 				 min, max, minPoint, maxPoint);
 
@@ -232,8 +242,8 @@ bool PlaneBox(const Geometry& a_shape1, const Geometry& a_shape2,
 	{
 		if (nullptr != a_collision)
 		{
-			a_collision->shape1(a_shape1);
-			a_collision->shape2(a_shape2);
+			a_collision->shape1(a_plane);
+			a_collision->shape2(a_box);
 			a_collision->normal = normal * (fabs(min) > max ? -1.0f : 1.0f);
 			a_collision->interpenetration = fmin(fabs(min), max);
 			glm::vec3 p = (fabs(min) > max ? maxPoint : minPoint);
@@ -244,152 +254,448 @@ bool PlaneBox(const Geometry& a_shape1, const Geometry& a_shape2,
 	return false;
 }
 
-bool SphereSphere(const Geometry& a_shape1, const Geometry& a_shape2,
+bool SphereSphere(const Sphere& a_sphere1, const Sphere& a_sphere2,
 				  Geometry::Collision* a_collision)
 {
-	// type check
-	const Geometry::Sphere* sphere1 = dynamic_cast<const Geometry::Sphere*>(&a_shape1);
-	const Geometry::Sphere* sphere2 = dynamic_cast<const Geometry::Sphere*>(&a_shape2);
-	if (nullptr == sphere1 || nullptr == sphere2)
-		return false;
-
 	// spheres collide if center-center distance is <= sum of radii
-	float squareDistance = glm::distance2(sphere1->position, sphere2->position);
-	float collisionDistance = sphere1->radius + sphere2->radius;
+	float squareDistance = glm::distance2(a_sphere1.position, a_sphere2.position);
+	float collisionDistance = a_sphere1.radius + a_sphere2.radius;
 	if (squareDistance <= collisionDistance*collisionDistance)
 	{
 		if (nullptr != a_collision)
 		{
-			a_collision->shape1(a_shape1);
-			a_collision->shape2(a_shape2);
-			a_collision->normal = glm::normalize(sphere2->position - sphere1->position);
+			a_collision->shape1(a_sphere1);
+			a_collision->shape2(a_sphere2);
+			a_collision->normal = glm::normalize(a_sphere2.position - a_sphere1.position);
 			a_collision->interpenetration = collisionDistance - sqrt(squareDistance);
-			float d = sphere1->radius - a_collision->interpenetration / 2;
-			a_collision->point = sphere1->position + a_collision->normal * d;
+			float d = a_sphere1.radius - a_collision->interpenetration / 2;
+			a_collision->point = a_sphere1.position + a_collision->normal * d;
 		}
 		return true;
 	}
 	return false;
 }
 
-bool SphereBox(const Geometry& a_shape1, const Geometry& a_shape2,
+bool SphereBox(const Sphere& a_sphere, const Box& a_box,
 			   Geometry::Collision* a_collision)
 {
-	// type check
-	const Geometry::Sphere* sphere = dynamic_cast<const Geometry::Sphere*>(&a_shape1);
-	const Geometry::Box* box = dynamic_cast<const Geometry::Box*>(&a_shape2);
-	if (nullptr == sphere || nullptr == box)
-		return false;
-
 	// find closest point on box surface
-	bool inside = box->Contains(sphere->position);
-	glm::vec3 closestPoint = box->ClosestSurfacePointTo(sphere->position);
+	bool inside = a_box.Contains(a_sphere.position);
+	glm::vec3 closestPoint = a_box.ClosestSurfacePointTo(a_sphere.position);
 
 	// if sphere center is inside box or no more than a radius away from the nearest surface point,
 	// then there's a collision.
-	if (inside || sphere->Contains(closestPoint))
+	if (inside || a_sphere.Contains(closestPoint))
 	{
 		if (nullptr != a_collision)
 		{
-			a_collision->shape1(a_shape1);
-			a_collision->shape2(a_shape2);
+			a_collision->shape1(a_sphere);
+			a_collision->shape2(a_box);
 			a_collision->normal =
-				glm::normalize(closestPoint - sphere->position) * (inside ? -1.0f : 1.0f);
-			a_collision->interpenetration = sphere->radius +
-				(glm::distance(closestPoint, sphere->position) * (inside ? 1 : -1));
-			float d = sphere->radius - a_collision->interpenetration / 2;
-			a_collision->point = sphere->position + a_collision->normal * d;
+				glm::normalize(closestPoint - a_sphere.position) * (inside ? -1.0f : 1.0f);
+			a_collision->interpenetration = a_sphere.radius +
+				(glm::distance(closestPoint, a_sphere.position) * (inside ? 1 : -1));
+			float d = a_sphere.radius - a_collision->interpenetration / 2;
+			a_collision->point = a_sphere.position + a_collision->normal * d;
 		}
 		return true;
 	}
 	return false;
 }
 
-// negative value = no overlap
-static float ProjectionOverlap(const glm::vec3& a_axis,
-							   const std::vector<glm::vec3>& a_group1,
-							   const std::vector<glm::vec3>& a_group2,
-							   glm::vec3& a_midPoint)
+//
+// Box-box
+//
+
+// Oriented box separating axis test with SSE.  The rotation between the boxes
+// is held as rows of R[i][j] = dot(box1 axis i, box2 axis j) across lanes j, so
+// the three face tests for each box and the three edge tests for each axis of
+// box 1 are each a handful of vector operations.  The fourth lane is unused.
+
+#define SHUFFLE(v, x, y, z) _mm_shuffle_ps((v), (v), _MM_SHUFFLE(3, (z), (y), (x)))
+
+static inline __m128 Load(const glm::vec3& a_vector)
+{
+	return _mm_setr_ps(a_vector.x, a_vector.y, a_vector.z, 0);
+}
+static inline __m128 Abs(__m128 a_vector)
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), a_vector);
+}
+static inline __m128 Splat(__m128 a_vector, int a_lane)
 {
-	float min1, min2, max1, max2;
-	glm::vec3 minPoint1, minPoint2, maxPoint1, maxPoint2;
-	auto project = [&](const glm::vec3& a_point)
+	switch (a_lane)
 	{
-		return glm::dot(a_axis, a_point);
-	};
-	GetMinAndMax(a_group1, project, min1, max1, minPoint1, maxPoint1);
-	GetMinAndMax(a_group2, project, min2, max2, minPoint2, maxPoint2);
-	bool group1First = fabs(max1 - min2) < fabs(max2 - min1);
-	a_midPoint = (group1First ? maxPoint1 + minPoint2 : maxPoint2 + minPoint1) * 0.5f;
-	return (group1First ? max1 - min2 : max2 - min1);
+	case 0: return _mm_shuffle_ps(a_vector, a_vector, _MM_SHUFFLE(0, 0, 0, 0));
+	case 1: return _mm_shuffle_ps(a_vector, a_vector, _MM_SHUFFLE(1, 1, 1, 1));
+	default: return _mm_shuffle_ps(a_vector, a_vector, _MM_SHUFFLE(2, 2, 2, 2));
+	}
+}
+static inline float Lane(__m128 a_vector, int a_lane)
+{
+	float lanes[4];
+	_mm_storeu_ps(lanes, a_vector);
+	return lanes[a_lane];
 }
 
-bool BoxBox(const Geometry& a_shape1, const Geometry& a_shape2,
-			Geometry::Collision* a_collision)
+// the lane with the smallest value, out of the first three
+static inline int MinLane(__m128 a_vector, float& a_min)
 {
-	// type check
-	const Geometry::Box* box1 = dynamic_cast<const Geometry::Box*>(&a_shape1);
-	const Geometry::Box* box2 = dynamic_cast<const Geometry::Box*>(&a_shape2);
-	if (nullptr == box1 || nullptr == box2)
-		return false;
+	float lanes[4];
+	_mm_storeu_ps(lanes, a_vector);
+	int lane = (lanes[1] < lanes[0] ? 1 : 0);
+	if (lanes[2] < lanes[lane])
+		lane = 2;
+	a_min = lanes[lane];
+	return lane;
+}
+
+// contact points between two boxes, each with its own depth
+struct BoxManifold
+{
+	static const unsigned int MAX_POINTS = 4;
+
+	glm::vec3 normal;	// from box 1 to box 2
+	glm::vec3 points[MAX_POINTS];
+	float depths[MAX_POINTS];
+	unsigned int features[MAX_POINTS];
+	unsigned int count;
+};
+
+// Manifold points are keyed by where they came from, so the solver can match
+// them up between steps even as points come and go: the incident face corner a
+// point started at (2 bits), then up to two side planes (3 bits each) that
+// clipped the edges it's on.
+static const unsigned int CORNER_BITS = 2;
+static const unsigned int PLANE_BITS = 3;
+static const unsigned int EDGE_FEATURE = 0x8000;
+
+// clips a polygon to the side of a plane where dot(a_normal, p) <= a_offset
+static unsigned int ClipPolygon(const glm::vec3* a_in, const unsigned int* a_inKeys, unsigned int a_count,
+								const glm::vec3& a_normal, float a_offset, unsigned int a_plane,
+								glm::vec3* a_out, unsigned int* a_outKeys)
+{
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < a_count; ++i)
+	{
+		const glm::vec3& p1 = a_in[i];
+		const glm::vec3& p2 = a_in[(i + 1) % a_count];
+		float d1 = glm::dot(a_normal, p1) - a_offset;
+		float d2 = glm::dot(a_normal, p2) - a_offset;
+		if (0 >= d1)
+		{
+			a_outKeys[count] = a_inKeys[i];
+			a_out[count++] = p1;
+		}
+		if ((0 > d1) != (0 > d2) && 0 != d1 && 0 != d2)
+		{
+			// the edge's start point, plus this plane in the first free slot
+			unsigned int key = a_inKeys[i] & ((1 << (CORNER_BITS + PLANE_BITS)) - 1);
+			unsigned int shift = (key >> CORNER_BITS ? CORNER_BITS + PLANE_BITS : CORNER_BITS);
+			a_outKeys[count] = key | ((a_plane + 1) << shift);
+			a_out[count++] = p1 + (p2 - p1) * (d1 / (d1 - d2));
+		}
+	}
+	return count;
+}
 
+// clips the face of the incident box that faces most against a_normal to the
+// reference box face with outward normal a_normal, keeping points below it
+static void ClipFaces(const Box& a_reference, unsigned int a_axis, const glm::vec3& a_normal,
+					  const Box& a_incident, BoxManifold& a_manifold, bool a_flip)
+{
+	// incident face, as a quad
+	glm::vec3 incidentAxes[3] = { a_incident.axis(0), a_incident.axis(1), a_incident.axis(2) };
+	float alignment[3] = { glm::dot(incidentAxes[0], a_normal), glm::dot(incidentAxes[1], a_normal),
+						   glm::dot(incidentAxes[2], a_normal) };
+	unsigned int m = (fabs(alignment[1]) > fabs(alignment[0]) ? 1 : 0);
+	if (fabs(alignment[2]) > fabs(alignment[m]))
+		m = 2;
+	unsigned int p = (m + 1) % 3, q = (m + 2) % 3;
+	glm::vec3 center = a_incident.position +
+					   incidentAxes[m] * (0 < alignment[m] ? -a_incident.extents[m] : a_incident.extents[m]);
+	glm::vec3 u = incidentAxes[p] * a_incident.extents[p];
+	glm::vec3 v = incidentAxes[q] * a_incident.extents[q];
+	glm::vec3 polygon1[8] = { center + u + v, center - u + v, center - u - v, center + u - v };
+	glm::vec3 polygon2[8];
+	unsigned int keys1[8] = { 0, 1, 2, 3 };
+	unsigned int keys2[8];
+
+	// clip to the sides of the reference face
+	unsigned int count = 4;
+	for (unsigned int i = 1; i < 3 && 0 < count; ++i)
+	{
+		unsigned int side = (a_axis + i) % 3;
+		glm::vec3 sideAxis = a_reference.axis(side);
+		float offset = glm::dot(sideAxis, a_reference.position);
+		count = ClipPolygon(polygon1, keys1, count, sideAxis, offset + a_reference.extents[side],
+							2 * i - 2, polygon2, keys2);
+		count = ClipPolygon(polygon2, keys2, count, -sideAxis, -offset + a_reference.extents[side],
+							2 * i - 1, polygon1, keys1);
+	}
+
+	// keep points below the reference face, halfway between the two surfaces
+	float faceOffset = glm::dot(a_normal, a_reference.position) + a_reference.extents[a_axis];
+	glm::vec3 points[8];
+	float depths[8];
+	unsigned int keys[8];
+	unsigned int kept = 0;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		float separation = glm::dot(a_normal, polygon1[i]) - faceOffset;
+		if (0 < separation)
+			continue;
+		points[kept] = polygon1[i] - a_normal * (separation * 0.5f);
+		keys[kept] = keys1[i];
+		depths[kept++] = -separation;
+	}
+
+	// four points are enough for a stable face contact - keep the deepest, the
+	// one furthest from it, and the two that span the most area either side
+	unsigned int chosen[4] = { 0, 0, 0, 0 };
+	unsigned int chosenCount = kept;
+	if (kept > BoxManifold::MAX_POINTS)
+	{
+		for (unsigned int i = 1; i < kept; ++i)
+			if (depths[i] > depths[chosen[0]])
+				chosen[0] = i;
+		float best = -1;
+		for (unsigned int i = 0; i < kept; ++i)
+		{
+			float distance2 = glm::distance2(points[i], points[chosen[0]]);
+			if (distance2 > best)
+			{
+				best = distance2;
+				chosen[1] = i;
+			}
+		}
+		float most = 0, least = 0;
+		chosen[2] = chosen[3] = chosen[0];
+		glm::vec3 edge = points[chosen[1]] - points[chosen[0]];
+		for (unsigned int i = 0; i < kept; ++i)
+		{
+			float area = glm::dot(glm::cross(edge, points[i] - points[chosen[0]]), a_normal);
+			if (area > most)
+			{
+				most = area;
+				chosen[2] = i;
+			}
+			if (area < least)
+			{
+				least = area;
+				chosen[3] = i;
+			}
+		}
+		chosenCount = BoxManifold::MAX_POINTS;
+	}
+	else
+	{
+		for (unsigned int i = 0; i < kept; ++i)
+			chosen[i] = i;
+	}
+
+	// the faces involved go in the key too, so a new pair of faces starts afresh
+	unsigned int faces = ((a_flip ? 3 : 0) + a_axis) * 3 + m;
+	a_manifold.normal = (a_flip ? -a_normal : a_normal);
+	a_manifold.count = 0;
+	for (unsigned int i = 0; i < chosenCount; ++i)
+	{
+		// degenerate area picks can repeat a point
+		bool repeated = false;
+		for (unsigned int j = 0; j < i; ++j)
+			repeated = repeated || chosen[j] == chosen[i];
+		if (repeated)
+			continue;
+		a_manifold.points[a_manifold.count] = points[chosen[i]];
+		a_manifold.depths[a_manifold.count] = depths[chosen[i]];
+		a_manifold.features[a_manifold.count++] =
+			(faces << (CORNER_BITS + 2 * PLANE_BITS)) | keys[chosen[i]];
+	}
+}
+
+static bool BoxBoxManifold(const Box& a_box1, const Box& a_box2, BoxManifold& a_manifold)
+{
 	// first check - generalize to sphere to avoid unneccessary calculations
-	float d = glm::distance(box1->extents, glm::vec3(0)) +
-		glm::distance(box2->extents, glm::vec3(0));
-	if (d*d < glm::distance2(box1->position, box2->position))
+	float d = glm::length(a_box1.extents) + glm::length(a_box2.extents);
+	glm::vec3 centerToCenter = a_box2.position - a_box1.position;
+	if (d*d < glm::length2(centerToCenter))
 		return false;
 
-	// get all the axes to test for separation
-	glm::vec3 centerToCenterAxis = glm::normalize(box2->position - box1->position);
-	std::vector<glm::vec3> axes;
-	axes.push_back(centerToCenterAxis);
-	for (unsigned int i = 0; i < 3; ++i)
+	glm::vec3 axes1[3] = { a_box1.axis(0), a_box1.axis(1), a_box1.axis(2) };
+	glm::vec3 axes2[3] = { a_box2.axis(0), a_box2.axis(1), a_box2.axis(2) };
+
+	// rows of R, and of |R| padded so parallel edges don't divide by zero
+	__m128 x2 = _mm_setr_ps(axes2[0].x, axes2[1].x, axes2[2].x, 0);
+	__m128 y2 = _mm_setr_ps(axes2[0].y, axes2[1].y, axes2[2].y, 0);
+	__m128 z2 = _mm_setr_ps(axes2[0].z, axes2[1].z, axes2[2].z, 0);
+	__m128 R[3], absR[3];
+	for (int i = 0; i < 3; ++i)
 	{
-		axes.push_back(box1->axis(i));
-		axes.push_back(box2->axis(i));
-		for (unsigned int j = 0; j < 3; ++j)
-			axes.push_back(glm::cross(box1->axis(i), box2->axis(j)));
+		R[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(axes1[i].x), x2),
+									 _mm_mul_ps(_mm_set1_ps(axes1[i].y), y2)),
+						  _mm_mul_ps(_mm_set1_ps(axes1[i].z), z2));
+		absR[i] = _mm_add_ps(Abs(R[i]), _mm_set1_ps(1e-6f));
 	}
+	__m128 zero = _mm_setzero_ps();
+	__m128 a = Load(a_box1.extents);
+	__m128 b = Load(a_box2.extents);
+	__m128 t = _mm_setr_ps(glm::dot(centerToCenter, axes1[0]), glm::dot(centerToCenter, axes1[1]),
+						   glm::dot(centerToCenter, axes1[2]), 0);
 
-	// test for separation
-	auto vertices1 = box1->vertices();
-	auto vertices2 = box2->vertices();
-	float interpenetration = 0;
-	glm::vec3 midPoint;
-	glm::vec3 normal;
-	bool start = true;
-	for (auto axis : axes)
-	{
-		// test for projection overlap along each axis
-		glm::vec3 p;
-		float overlap = ProjectionOverlap(axis, vertices1, vertices2, p);
+	// box 1 faces, across lanes i, using the columns of |R|
+	__m128 absC[4] = { absR[0], absR[1], absR[2], zero };
+	_MM_TRANSPOSE4_PS(absC[0], absC[1], absC[2], absC[3]);
+	__m128 overlap1 = _mm_sub_ps(_mm_add_ps(a, _mm_add_ps(_mm_add_ps(_mm_mul_ps(Splat(b, 0), absC[0]),
+																	  _mm_mul_ps(Splat(b, 1), absC[1])),
+														   _mm_mul_ps(Splat(b, 2), absC[2]))),
+								 Abs(t));
+
+	// box 2 faces, across lanes j
+	__m128 t2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Splat(t, 0), R[0]), _mm_mul_ps(Splat(t, 1), R[1])),
+						   _mm_mul_ps(Splat(t, 2), R[2]));
+	__m128 overlap2 = _mm_sub_ps(_mm_add_ps(b, _mm_add_ps(_mm_add_ps(_mm_mul_ps(Splat(a, 0), absR[0]),
+																	  _mm_mul_ps(Splat(a, 1), absR[1])),
+														   _mm_mul_ps(Splat(a, 2), absR[2]))),
+								 Abs(t2));
+	if (0 != (_mm_movemask_ps(_mm_cmplt_ps(overlap1, zero)) & 7) ||
+		0 != (_mm_movemask_ps(_mm_cmplt_ps(overlap2, zero)) & 7))
+		return false;
 
-		// if there is no overlap, then there is no collision
-		if (0 > overlap)
+	// edge pairs, box 1 axis i crossed with each box 2 axis j across lanes j
+	__m128 b1 = SHUFFLE(b, 1, 2, 0), b2 = SHUFFLE(b, 2, 0, 1);
+	__m128 edgeOverlaps[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+		__m128 distance = Abs(_mm_sub_ps(_mm_mul_ps(Splat(t, i2), R[i1]), _mm_mul_ps(Splat(t, i1), R[i2])));
+		__m128 ra = _mm_add_ps(_mm_mul_ps(Splat(a, i1), absR[i2]), _mm_mul_ps(Splat(a, i2), absR[i1]));
+		__m128 rb = _mm_add_ps(_mm_mul_ps(b1, SHUFFLE(absR[i], 2, 0, 1)), _mm_mul_ps(b2, SHUFFLE(absR[i], 1, 2, 0)));
+		__m128 overlap = _mm_sub_ps(_mm_add_ps(ra, rb), distance);
+		if (0 != (_mm_movemask_ps(_mm_cmplt_ps(overlap, zero)) & 7))
 			return false;
 
-		// store the collision normal that provides the smallest interpenetration
-		if (start || overlap < interpenetration)
+		// as a distance along the normalized axis, |cross| = sqrt(1 - R^2) - edges
+		// too close to parallel are covered by the face tests
+		__m128 length2 = _mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(R[i], R[i]));
+		__m128 parallel = _mm_cmplt_ps(length2, _mm_set1_ps(1e-6f));
+		__m128 scaled = _mm_div_ps(overlap, _mm_sqrt_ps(_mm_max_ps(length2, _mm_set1_ps(1e-6f))));
+		edgeOverlaps[i] = _mm_or_ps(_mm_and_ps(parallel, _mm_set1_ps(FLT_MAX)), _mm_andnot_ps(parallel, scaled));
+	}
+
+	// least overlap wins, but faces are preferred unless an edge is clearly less,
+	// so resting contacts don't flicker between features
+	const float relativeTolerance = 0.95f, absoluteTolerance = 0.005f;
+	float faceOverlap1, faceOverlap2;
+	int face1 = MinLane(overlap1, faceOverlap1);
+	int face2 = MinLane(overlap2, faceOverlap2);
+	bool useBox2Face = (faceOverlap2 < faceOverlap1 * relativeTolerance - absoluteTolerance);
+	float faceOverlap = (useBox2Face ? faceOverlap2 : faceOverlap1);
+	int edge1 = -1, edge2 = -1;
+	float edgeOverlap = FLT_MAX;
+	for (int i = 0; i < 3; ++i)
+	{
+		float overlap;
+		int j = MinLane(edgeOverlaps[i], overlap);
+		if (overlap < edgeOverlap)
+		{
+			edgeOverlap = overlap;
+			edge1 = i;
+			edge2 = j;
+		}
+	}
+
+	if (edgeOverlap < faceOverlap * relativeTolerance - absoluteTolerance)
+	{
+		// edge-edge - one point, halfway between the closest points on the edges
+		glm::vec3 normal = glm::normalize(glm::cross(axes1[edge1], axes2[edge2]));
+		if (0 > glm::dot(normal, centerToCenter))
+			normal = -normal;
+		glm::vec3 point1 = a_box1.position, point2 = a_box2.position;
+		for (int k = 0; k < 3; ++k)
 		{
-			interpenetration = overlap;
-			normal = (0 > glm::dot(centerToCenterAxis, axis) ? -axis : axis);
-			midPoint = p;	// not even close to accurate, but I don't know how to get the right one
+			if (k != edge1)
+				point1 += axes1[k] * (0 < glm::dot(axes1[k], normal) ? a_box1.extents[k] : -a_box1.extents[k]);
+			if (k != edge2)
+				point2 += axes2[k] * (0 < glm::dot(axes2[k], normal) ? -a_box2.extents[k] : a_box2.extents[k]);
 		}
-		start = false;
+		glm::vec3 r = point1 - point2;
+		float cosine = glm::dot(axes1[edge1], axes2[edge2]);
+		float e = glm::dot(axes1[edge1], r), f = glm::dot(axes2[edge2], r);
+		float s = (cosine * f - e) / (1 - cosine * cosine);
+		s = glm::clamp(s, -a_box1.extents[edge1], a_box1.extents[edge1]);
+		float u = glm::clamp(f + s * cosine, -a_box2.extents[edge2], a_box2.extents[edge2]);
+		a_manifold.normal = normal;
+		a_manifold.points[0] = (point1 + axes1[edge1] * s + point2 + axes2[edge2] * u) * 0.5f;
+		a_manifold.depths[0] = edgeOverlap;
+		a_manifold.features[0] = EDGE_FEATURE | (edge1 * 3 + edge2);
+		a_manifold.count = 1;
+		return true;
 	}
 
-	// make sure the collision normal points from the first box to the second
-	if (0 > glm::dot(normal, axes[0]))
-		normal *= -1;
+	// face contact - the face's box is the reference, the other is clipped to it
+	if (useBox2Face)
+	{
+		glm::vec3 normal = (0 < Lane(t2, face2) ? -axes2[face2] : axes2[face2]);
+		ClipFaces(a_box2, face2, normal, a_box1, a_manifold, true);
+	}
+	else
+	{
+		glm::vec3 normal = (0 > Lane(t, face1) ? -axes1[face1] : axes1[face1]);
+		ClipFaces(a_box1, face1, normal, a_box2, a_manifold, false);
+	}
 
-	// if the projections of each box onto each possible axis always overlap, then the boxes intersect
+	// clipping can only miss on numerical edge cases, so fall back to one point
+	if (0 == a_manifold.count)
+	{
+		a_manifold.points[0] = (a_box1.position + a_box2.position) * 0.5f;
+		a_manifold.depths[0] = faceOverlap;
+		a_manifold.features[0] = 0;
+		a_manifold.count = 1;
+	}
+	return true;
+}
+
+bool BoxBox(const Box& a_box1, const Box& a_box2,
+			Geometry::Collision* a_collision)
+{
+	BoxManifold manifold;
+	if (!BoxBoxManifold(a_box1, a_box2, manifold))
+		return false;
+
+	// one contact stands in for the whole manifold, at its center and deepest depth
 	if (nullptr != a_collision)
 	{
-		a_collision->shape1(a_shape1);
-		a_collision->shape2(a_shape2);
-		a_collision->normal = normal;
-		a_collision->interpenetration = interpenetration;
-		a_collision->point = midPoint;
+		glm::vec3 point(0);
+		float depth = 0;
+		for (unsigned int i = 0; i < manifold.count; ++i)
+		{
+			point += manifold.points[i];
+			depth = fmax(depth, manifold.depths[i]);
+		}
+		a_collision->shape1(a_box1);
+		a_collision->shape2(a_box2);
+		a_collision->normal = manifold.normal;
+		a_collision->interpenetration = depth;
+		a_collision->point = point / (float)manifold.count;
+	}
+	return true;
+}
+
+static bool BoxBoxContacts(const Box& a_box1, const Box& a_box2,
+						   Geometry::ContactBuffer& a_contacts)
+{
+	BoxManifold manifold;
+	if (!BoxBoxManifold(a_box1, a_box2, manifold))
+		return false;
+	for (unsigned int i = 0; i < manifold.count; ++i)
+	{
+		Geometry::Collision& contact = a_contacts.Append();
+		contact.shape1(a_box1);
+		contact.shape2(a_box2);
+		contact.normal = manifold.normal;
+		contact.interpenetration = manifold.depths[i];
+		contact.point = manifold.points[i];
+		contact.feature = manifold.features[i];
 	}
 	return true;
 }
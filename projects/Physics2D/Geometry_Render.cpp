@@ -0,0 +1,28 @@
+#include "Geometry.h"
+
+// Drawing is the only part of the simulation that needs Gizmos, so it's kept
+// here.  Headless builds define PHYSICS2D_HEADLESS, and shapes draw nothing.
+#ifndef PHYSICS2D_HEADLESS
+#include "Gizmos.h"
+
+void Geometry::Plane::Render(const glm::vec4& a_color) const
+{
+	Gizmos::addGrid(position, increments, size, (a_color + glm::vec4(1)) * 0.5f,
+					glm::vec4(1), a_color, rotationMatrix());
+}
+void Geometry::Sphere::Render(const glm::vec4& a_color) const
+{
+	Gizmos::addSphereInstance(position, radius, a_color, rotationMatrix());
+}
+void Geometry::Box::Render(const glm::vec4& a_color) const
+{
+	Gizmos::addBoxInstance(position, extents, a_color, rotationMatrix());
+}
+
+#else
+
+void Geometry::Plane::Render(const glm::vec4& /*a_color*/) const {}
+void Geometry::Sphere::Render(const glm::vec4& /*a_color*/) const {}
+void Geometry::Box::Render(const glm::vec4& /*a_color*/) const {}
+
+#endif
@@ -1,4 +1,5 @@
 #include "Geometry_Shapes.h"
+#include <limits>
 
 //
 // Plane
@@ -16,6 +17,14 @@ Geometry::Plane::Plane(unsigned int a_increments, float a_size,
 	: Geometry(a_origin, a_orientation, PLANE),
 	  increments(a_increments), size(a_size) {}
 
+glm::vec3 Geometry::Plane::AxisAlignedExtents() const
+{
+	glm::vec3 n = normal();
+	glm::vec3 result;
+	for (unsigned int i = 0; i < 3; ++i)
+		result[i] = (1.0f == fabs(n[i]) ? 0.0f : std::numeric_limits<float>::infinity());
+	return result;
+}
 Geometry* Geometry::Plane::Clone() const
 {
 	return new Plane(increments, size, position, orientation());
@@ -32,11 +41,6 @@ bool Geometry::Plane::Contains(const glm::vec3& a_point) const
 {
 	return (0 == glm::dot(a_point - position, normal()));
 }
-void Geometry::Plane::Render(const glm::vec4& a_color) const
-{
-	Gizmos::addGrid(position, increments, size, (a_color + glm::vec4(1)) * 0.5f,
-					glm::vec4(1), a_color, rotationMatrix());
-}
 
 //
 // Sphere
@@ -80,10 +84,6 @@ bool Geometry::Sphere::Contains(const glm::vec3& a_point) const
 {
 	return (glm::distance2(position, a_point) <= radius*radius);
 }
-void Geometry::Sphere::Render(const glm::vec4& a_color) const
-{
-	Gizmos::addSphere(position, radius, 8, 16, a_color, rotationMatrix());
-}
 float Geometry::Sphere::volume() const
 {
 	return radius * radius * radius * glm::pi<float>() * 4 / 3;
@@ -124,21 +124,11 @@ Geometry::Box::Box(const glm::vec3& a_extents, const glm::vec3& a_center,
 
 glm::vec3 Geometry::Box::AxisAlignedExtents() const
 {
-	glm::vec3 corners[4] = { ToWorld(extents, true),
-		ToWorld(glm::vec3(-extents.x, extents.y, extents.z), true),
-		ToWorld(glm::vec3(extents.x, -extents.y, extents.z), true),
-		ToWorld(glm::vec3(extents.x, extents.y, -extents.z), true) };
-	glm::vec3 result(0);
-	for (auto corner : corners)
-	{
-		if (fabs(corner.x) > result.x)
-			result.x = fabs(corner.x);
-		if (fabs(corner.y) > result.y)
-			result.y = fabs(corner.y);
-		if (fabs(corner.z) > result.z)
-			result.z = fabs(corner.z);
-	}
-	return result;
+	// each axis contributes its absolute components, scaled by its extent
+	glm::vec3 x = axis(0), y = axis(1), z = axis(2);
+	return glm::vec3(fabs(x.x), fabs(x.y), fabs(x.z)) * extents.x +
+		   glm::vec3(fabs(y.x), fabs(y.y), fabs(y.z)) * extents.y +
+		   glm::vec3(fabs(z.x), fabs(z.y), fabs(z.z)) * extents.z;
 }
 Geometry* Geometry::Box::Clone() const
 {
@@ -179,10 +169,6 @@ glm::vec3 Geometry::Box::ClosestSurfacePointTo(const glm::vec3& a_point,
 		(0 > local.y ? -1 : 1) * (extents.y - (0 <= distances.y ? distances.y : 0)),
 		(0 > local.z ? -1 : 1) * (extents.z - (0 <= distances.z ? distances.z : 0)));
 }
-void Geometry::Box::Render(const glm::vec4& a_color) const
-{
-	Gizmos::addAABBFilled(position, extents, a_color, rotationMatrix());
-}
 float Geometry::Box::volume() const
 {
 	return extents.x * extents.y * extents.z * 8;
@@ -207,14 +193,21 @@ glm::mat3 Geometry::Box::interiaTensorDividedByMass() const
 
 std::vector<glm::vec3> Geometry::Box::vertices() const
 {
-	std::vector<glm::vec3> points;
-	points.push_back(ToWorld(extents.x, extents.y, extents.z));
-	points.push_back(ToWorld(extents.x, extents.y, -extents.z));
-	points.push_back(ToWorld(extents.x, -extents.y, extents.z));
-	points.push_back(ToWorld(extents.x, -extents.y, -extents.z));
-	points.push_back(ToWorld(-extents.x, extents.y, extents.z));
-	points.push_back(ToWorld(-extents.x, extents.y, -extents.z));
-	points.push_back(ToWorld(-extents.x, -extents.y, extents.z));
-	points.push_back(ToWorld(-extents.x, -extents.y, -extents.z));
-	return points;
+	glm::vec3 points[8];
+	vertices(points);
+	return std::vector<glm::vec3>(points, points + 8);
+}
+void Geometry::Box::vertices(glm::vec3 (&a_vertices)[8]) const
+{
+	glm::vec3 x = axis(0) * extents.x;
+	glm::vec3 y = axis(1) * extents.y;
+	glm::vec3 z = axis(2) * extents.z;
+	a_vertices[0] = position + x + y + z;
+	a_vertices[1] = position + x + y - z;
+	a_vertices[2] = position + x - y + z;
+	a_vertices[3] = position + x - y - z;
+	a_vertices[4] = position - x + y + z;
+	a_vertices[5] = position - x + y - z;
+	a_vertices[6] = position - x - y + z;
+	a_vertices[7] = position - x - y - z;
 }
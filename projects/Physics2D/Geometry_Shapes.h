@@ -11,7 +11,7 @@ struct Geometry::Plane : public Geometry
 		  const glm::vec3& a_origin,
 		  const glm::quat& a_orientation);
 
-	virtual glm::vec3 AxisAlignedExtents() const { return glm::vec3(0); }	// actually infinite
+	virtual glm::vec3 AxisAlignedExtents() const;	// infinite except along an axis-aligned normal
 	virtual glm::vec3 ClosestSurfacePointTo(const glm::vec3& a_point,
 											glm::vec3* a_normal = nullptr) const;
 	virtual bool Contains(const glm::vec3& a_point) const;
@@ -86,6 +86,7 @@ struct Geometry::Box : public Geometry
 
 	glm::vec3 size() const { return extents * 2.0f; }
 	std::vector<glm::vec3> vertices() const;
+	void vertices(glm::vec3 (&a_vertices)[8]) const;	// same order, without allocating
 
 	glm::vec3 extents;
 };
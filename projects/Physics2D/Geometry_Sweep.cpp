@@ -0,0 +1,181 @@
+#include "Geometry.h"
+#include <cfloat>
+
+typedef Geometry::Plane Plane;
+typedef Geometry::Sphere Sphere;
+typedef Geometry::Box Box;
+
+// Times of impact for a sphere moving in a straight line past a shape that
+// stays put, as a fraction of the sphere's displacement.  Touching at the
+// start counts as an impact at time zero.
+
+static bool SweepPlane(const Sphere& a_sphere, const glm::vec3& a_displacement,
+					   const Plane& a_plane, float& a_time, glm::vec3* a_normal)
+{
+	// planes are two-sided, so work from whichever side the sphere starts on
+	glm::vec3 normal = a_plane.normal();
+	float start = glm::dot(normal, a_sphere.position - a_plane.position);
+	if (0 > start)
+	{
+		normal *= -1.0f;
+		start *= -1;
+	}
+	float approach = -glm::dot(normal, a_displacement);
+	if (start <= a_sphere.radius)
+		a_time = 0;
+	else if (start - a_sphere.radius <= approach)
+		a_time = (start - a_sphere.radius) / approach;
+	else
+		return false;
+	if (nullptr != a_normal)
+		*a_normal = normal;
+	return true;
+}
+
+static bool SweepSphere(const Sphere& a_sphere, const glm::vec3& a_displacement,
+						const Sphere& a_target, float& a_time, glm::vec3* a_normal)
+{
+	// solve |offset + t * displacement| = combined radius for the first t
+	glm::vec3 offset = a_sphere.position - a_target.position;
+	float radius = a_sphere.radius + a_target.radius;
+	float c = glm::dot(offset, offset) - radius * radius;
+	if (0 >= c)
+		a_time = 0;
+	else
+	{
+		float a = glm::dot(a_displacement, a_displacement);
+		float b = glm::dot(offset, a_displacement);
+		if (0 <= b || 0 == a)
+			return false;	// not closing
+		float discriminant = b * b - a * c;
+		if (0 > discriminant)
+			return false;
+		a_time = (-b - sqrt(discriminant)) / a;
+		if (1 < a_time)
+			return false;
+	}
+	if (nullptr != a_normal)
+	{
+		glm::vec3 centers = offset + a_displacement * a_time;
+		*a_normal = (glm::vec3(0) != centers ? glm::normalize(centers) : -glm::normalize(a_displacement));
+	}
+	return true;
+}
+
+// how far a sphere centered at a_point (in the box's frame) is from touching it
+static float BoxGap(const glm::vec3& a_point, const glm::vec3& a_extents, float a_radius)
+{
+	return glm::length(a_point - glm::clamp(a_point, -a_extents, a_extents)) - a_radius;
+}
+
+static bool SweepBox(const Sphere& a_sphere, const glm::vec3& a_displacement,
+					 const Box& a_box, float& a_time, glm::vec3* a_normal)
+{
+	// in the box's frame, the sphere's path has to cross the box grown by the
+	// radius - that gives the interval to search
+	glm::vec3 start = a_box.ToLocal(a_sphere.position);
+	glm::vec3 path = a_box.ToLocal(a_displacement, true);
+	glm::vec3 grown = a_box.extents + glm::vec3(a_sphere.radius);
+	float enter = 0, exit = 1;
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		if (0 == path[i])
+		{
+			if (fabs(start[i]) > grown[i])
+				return false;
+			continue;
+		}
+		float t1 = (-grown[i] - start[i]) / path[i];
+		float t2 = (grown[i] - start[i]) / path[i];
+		enter = glm::max(enter, glm::min(t1, t2));
+		exit = glm::min(exit, glm::max(t1, t2));
+		if (enter > exit)
+			return false;
+	}
+
+	// The grown box has square edges and corners where the real one is rounded,
+	// so advance from where the path enters it.  The gap can't close faster than
+	// the sphere moves, so stepping by gap / speed never passes the surface.
+	float speed = glm::length(path);
+	float tolerance = 0.0001f * (a_box.extents.x + a_box.extents.y + a_box.extents.z + a_sphere.radius);
+	float time = enter;
+	bool touching = false;
+	for (unsigned int i = 0; i < 16 && !touching && time <= exit; ++i)
+	{
+		float gap = BoxGap(start + path * time, a_box.extents, a_sphere.radius);
+		touching = (gap <= tolerance);
+		if (!touching)
+			time += gap / speed;
+	}
+
+	// Advancing only stalls when the path grazes the box.  The gap is convex
+	// along a straight path, so find the closest approach, and if that touches,
+	// bisect for the first touch before it.
+	if (!touching)
+	{
+		if (time > exit)
+			return false;
+		const float golden = 0.618034f;
+		float low = time, high = exit;
+		for (unsigned int i = 0; i < 32; ++i)
+		{
+			float t1 = high - (high - low) * golden;
+			float t2 = low + (high - low) * golden;
+			if (BoxGap(start + path * t1, a_box.extents, a_sphere.radius) <
+				BoxGap(start + path * t2, a_box.extents, a_sphere.radius))
+				high = t2;
+			else
+				low = t1;
+		}
+		float closest = (low + high) / 2;
+		if (BoxGap(start + path * closest, a_box.extents, a_sphere.radius) > tolerance)
+			return false;
+		low = time;
+		high = closest;
+		for (unsigned int i = 0; i < 32; ++i)
+		{
+			float middle = (low + high) / 2;
+			if (BoxGap(start + path * middle, a_box.extents, a_sphere.radius) <= tolerance)
+				high = middle;
+			else
+				low = middle;
+		}
+		time = high;
+	}
+
+	a_time = time;
+	if (nullptr != a_normal)
+	{
+		glm::vec3 point = start + path * time;
+		glm::vec3 outward = point - glm::clamp(point, -a_box.extents, a_box.extents);
+		if (glm::vec3(0) == outward)
+		{
+			// the center is inside, so push out through the nearest face
+			glm::vec3 depth = a_box.extents - glm::abs(point);
+			unsigned int axis = (depth.y < depth.x ? 1 : 0);
+			if (depth.z < depth[axis])
+				axis = 2;
+			outward[axis] = (0 > point[axis] ? -1.0f : 1.0f);
+		}
+		*a_normal = glm::normalize(a_box.ToWorld(outward, true));
+	}
+	return true;
+}
+
+bool Geometry::Sweep(const Sphere& a_sphere, const glm::vec3& a_displacement,
+					 const Geometry& a_shape, float& a_time, glm::vec3* a_normal)
+{
+	if (&a_sphere == &a_shape)
+		return false;
+	switch (a_shape.GetShape())
+	{
+	case PLANE:
+		return SweepPlane(a_sphere, a_displacement, static_cast<const Plane&>(a_shape), a_time, a_normal);
+	case SPHERE:
+		return SweepSphere(a_sphere, a_displacement, static_cast<const Sphere&>(a_shape), a_time, a_normal);
+	case BOX:
+		return SweepBox(a_sphere, a_displacement, static_cast<const Box&>(a_shape), a_time, a_normal);
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,99 @@
+#include "IslandBuilder.h"
+
+const unsigned int IslandBuilder::NO_ISLAND;
+
+void IslandBuilder::Begin(unsigned int a_bodyCount)
+{
+	m_parents.resize(a_bodyCount);
+	for (unsigned int i = 0; i < a_bodyCount; ++i)
+		m_parents[i] = i;
+	m_ranks.assign(a_bodyCount, 0);
+	m_islands.clear();
+	m_islandStarts.assign(1, 0);
+	m_islandBodies.clear();
+}
+
+unsigned int IslandBuilder::Find(unsigned int a_body)
+{
+	unsigned int root = a_body;
+	while (m_parents[root] != root)
+		root = m_parents[root];
+
+	// compress the path, so later finds are quicker
+	while (m_parents[a_body] != root)
+	{
+		unsigned int parent = m_parents[a_body];
+		m_parents[a_body] = root;
+		a_body = parent;
+	}
+	return root;
+}
+
+void IslandBuilder::Join(unsigned int a_body1, unsigned int a_body2)
+{
+	unsigned int root1 = Find(a_body1);
+	unsigned int root2 = Find(a_body2);
+	if (root1 == root2)
+		return;
+	if (m_ranks[root1] < m_ranks[root2])
+		m_parents[root1] = root2;
+	else if (m_ranks[root2] < m_ranks[root1])
+		m_parents[root2] = root1;
+	else
+	{
+		m_parents[root2] = root1;
+		++m_ranks[root1];
+	}
+}
+
+void IslandBuilder::Build(const RigidBodyStore& a_bodies)
+{
+	// number the islands in the order their first body appears
+	unsigned int bodyCount = (unsigned int)m_parents.size();
+	m_rootIslands.assign(bodyCount, NO_ISLAND);
+	m_islands.assign(bodyCount, NO_ISLAND);
+	m_islandStarts.assign(1, 0);
+	for (unsigned int i = 0; i < bodyCount; ++i)
+	{
+		if (!a_bodies.dynamic[i] || !a_bodies.awake[i])
+			continue;
+		unsigned int root = Find(i);
+		if (NO_ISLAND == m_rootIslands[root])
+		{
+			m_rootIslands[root] = GetIslandCount();
+			m_islandStarts.push_back(0);
+		}
+		m_islands[i] = m_rootIslands[root];
+		++m_islandStarts[m_islands[i] + 1];
+	}
+
+	// counting sort of bodies by island, reusing the root lookup as the write cursors
+	for (unsigned int i = 1; i < m_islandStarts.size(); ++i)
+		m_islandStarts[i] += m_islandStarts[i - 1];
+	m_islandBodies.resize(m_islandStarts.back());
+	m_rootIslands.assign(m_islandStarts.begin(), m_islandStarts.end() - 1);
+	for (unsigned int i = 0; i < bodyCount; ++i)
+	{
+		if (NO_ISLAND != m_islands[i])
+			m_islandBodies[m_rootIslands[m_islands[i]]++] = i;
+	}
+}
+
+unsigned int IslandBuilder::Sleep(RigidBodyStore& a_bodies, float a_timeToSleep) const
+{
+	unsigned int count = 0;
+	for (unsigned int island = 0; island < GetIslandCount(); ++island)
+	{
+		const unsigned int* bodies = GetBodies(island);
+		unsigned int size = GetBodyCount(island);
+		bool sleepy = true;
+		for (unsigned int i = 0; i < size && sleepy; ++i)
+			sleepy = (a_bodies.sleepTime[bodies[i]] >= a_timeToSleep);
+		if (!sleepy)
+			continue;
+		for (unsigned int i = 0; i < size; ++i)
+			a_bodies.Sleep(bodies[i]);
+		++count;
+	}
+	return count;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "RigidBodyStore.h"
+#include <vector>
+
+// Groups bodies that touch, directly or through other bodies, into islands,
+// using union-find over the contact graph.  Static bodies never join islands,
+// otherwise everything resting on the same floor would be one island.
+class IslandBuilder
+{
+public:
+
+	static const unsigned int NO_ISLAND = 0xffffffff;
+
+	// starts a new step with every body in an island of its own
+	void Begin(unsigned int a_bodyCount);
+	void Join(unsigned int a_body1, unsigned int a_body2);
+	unsigned int Find(unsigned int a_body);
+
+	// lists the awake dynamic bodies of each island, in order of their lowest
+	// body index so the result doesn't depend on the order of Join() calls
+	void Build(const RigidBodyStore& a_bodies);
+
+	unsigned int GetIslandCount() const { return (unsigned int)m_islandStarts.size() - 1; }
+	unsigned int GetBodyCount(unsigned int a_island) const
+	{
+		return m_islandStarts[a_island + 1] - m_islandStarts[a_island];
+	}
+	const unsigned int* GetBodies(unsigned int a_island) const
+	{
+		return m_islandBodies.data() + m_islandStarts[a_island];
+	}
+	// NO_ISLAND for static and sleeping bodies
+	unsigned int GetIsland(unsigned int a_body) const { return m_islands[a_body]; }
+
+	// puts every island whose bodies have all been slow enough for long enough
+	// to sleep, and returns how many islands were put to sleep
+	unsigned int Sleep(RigidBodyStore& a_bodies, float a_timeToSleep) const;
+
+protected:
+
+	std::vector<unsigned int> m_parents;
+	std::vector<unsigned char> m_ranks;
+	std::vector<unsigned int> m_rootIslands;
+
+	std::vector<unsigned int> m_islands;		// per body, the island it's in once built
+	std::vector<unsigned int> m_islandStarts;	// per island, into m_islandBodies
+	std::vector<unsigned int> m_islandBodies;
+};
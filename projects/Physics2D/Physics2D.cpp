@@ -119,8 +119,10 @@ void Physics2D::Setup()
 
 void Physics2D::LaunchProjectile(float a_angle, float a_speed, const glm::vec4& a_color)
 {
-	m_scene->AddActor(new Actor(Geometry::Sphere(0.5f, glm::vec3(-20,0,0)), a_color, Actor::Material(),
-								glm::vec3(glm::cos(a_angle), glm::sin(a_angle), 0) * a_speed));
+	Actor* projectile = new Actor(Geometry::Sphere(0.5f, glm::vec3(-20,0,0)), a_color, Actor::Material(),
+								  glm::vec3(glm::cos(a_angle), glm::sin(a_angle), 0) * a_speed);
+	projectile->SetContinuous();	// fast enough to pass through thin walls in one step
+	m_scene->AddActor(projectile);
 }
 
 void Physics2D::DrawGuide(float a_angle, float a_speed, const glm::vec4& a_color, unsigned int a_segments, float a_segmentTime)
@@ -164,7 +166,7 @@ void Physics2D::onUpdate(float a_deltaTime)
 	{
 		m_points.push_back(DataPoint(actor->GetPosition(), actor->GetColor()));
 	}/**/
-	m_scene->Update();
+	m_scene->Advance(a_deltaTime);
 	m_scene->Render();
 	if (!m_cued)
 	{
@@ -180,11 +182,12 @@ void Physics2D::onUpdate(float a_deltaTime)
 		glm::vec3 worldPos = glm::unProject(screenCoord, viewMatrix, m_projectionMatrix, viewPort);
 		glm::vec3 rayOrigin = m_cameraMatrix[3].xyz();
 		glm::vec3 rayDirection = glm::normalize(worldPos - m_cameraMatrix[3].xyz());
-		glm::vec3 up(0, 1, 0);
-		float d = glm::dot(rayDirection, up);
-		if (0 != d)
+		// the cue goes where a ball swept out from the camera along the ray first touches something
+		Scene::RayHit hit;
+		const Geometry::Sphere& ball = static_cast<const Geometry::Sphere&>(m_cueBall->GetGeometry());
+		if (m_scene->Sweep(Geometry::Sphere(ball.radius, rayOrigin), rayDirection, 1000.0f, hit, m_cueBall))
 		{
-			glm::vec3 cue = rayOrigin + rayDirection * glm::dot(up - rayOrigin, up) / d;
+			glm::vec3 cue = rayOrigin + rayDirection * hit.distance;
 			if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_1) == GLFW_PRESS)
 			{
 				m_aiming = true;
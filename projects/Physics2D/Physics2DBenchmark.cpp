@@ -0,0 +1,347 @@
+#include "Scene.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Runs scripted scenes on the headless simulation for a fixed number of steps
+// and reports how fast they went.  Every scene is built the same way each run,
+// so the final pose hash only changes when the simulation's results do - it
+// should also match across thread counts.
+//
+// The narrowphase mode instead times Geometry::DetectCollision over every pair
+// of a fixed set of shapes, for --steps passes, and reports pairs per second.
+//
+//	Physics2DBenchmark [pool|rain|stacks|all|narrowphase] [--steps n] [--threads n] [--bodies n]
+//					   [--broadphase tree|sap|grid]
+
+struct Options
+{
+	std::string scene;
+	unsigned int steps;
+	unsigned int threads;	// one runs serially, zero uses every hardware thread
+	unsigned int bodies;	// for the scenes that scale, zero picks their default
+	std::string broadphase;
+
+	Options() : scene("all"), steps(1000), threads(1), bodies(0), broadphase("tree") {}
+};
+
+static const glm::vec4 WHITE(1);
+
+static void AddBox(Scene& a_scene, const glm::vec3& a_extents, const glm::vec3& a_center,
+				   const Actor::Material& a_material = Actor::Material())
+{
+	a_scene.AddActor(new Actor(Geometry::Box(a_extents, a_center), WHITE, false, a_material));
+}
+
+//
+// Scenes - each sets up its actors, and can poke them as the steps go by
+//
+
+// a cue ball broken into a racked triangle of fifteen, on a walled table
+static Actor* g_cueBall = nullptr;
+static void SetupPool(Scene& a_scene, unsigned int)
+{
+	Actor::Material felt(1.0f, 0.5f, 2.0f, 2.0f);
+	AddBox(a_scene, glm::vec3(10, 1, 19.5f), glm::vec3(0, -1, 0), felt);
+	AddBox(a_scene, glm::vec3(1, 1, 8), glm::vec3(11, 1, 9.5f), felt);
+	AddBox(a_scene, glm::vec3(1, 1, 8), glm::vec3(11, 1, -9.5f), felt);
+	AddBox(a_scene, glm::vec3(1, 1, 8), glm::vec3(-11, 1, 9.5f), felt);
+	AddBox(a_scene, glm::vec3(1, 1, 8), glm::vec3(-11, 1, -9.5f), felt);
+	AddBox(a_scene, glm::vec3(8, 1, 1), glm::vec3(0, 1, 20.5f), felt);
+	AddBox(a_scene, glm::vec3(8, 1, 1), glm::vec3(0, 1, -20.5f), felt);
+
+	g_cueBall = new Actor(Geometry::Sphere(1, glm::vec3(0, 1, 10)), WHITE, Actor::Material());
+	a_scene.AddActor(g_cueBall);
+	for (int row = 0; row < 5; ++row)
+	{
+		for (int ball = 0; ball <= row; ++ball)
+		{
+			glm::vec3 center((ball * 2 - row) * 1.01f, 1, -10 - row * 1.75f);
+			a_scene.AddActor(new Actor(Geometry::Sphere(1, center), WHITE, Actor::Material()));
+		}
+	}
+}
+static void StepPool(Scene&, unsigned int a_step)
+{
+	if (60 == a_step)
+		g_cueBall->ApplyImpulse(glm::vec3(0.3f, 0, -20) * 2.0f * g_cueBall->GetMass(),
+								g_cueBall->GetPosition() + glm::vec3(0, 0, 1));
+}
+
+// a block of balls dropped into a walled pit
+static void SetupRain(Scene& a_scene, unsigned int a_bodies)
+{
+	unsigned int count = (0 < a_bodies ? a_bodies : 2000);
+	AddBox(a_scene, glm::vec3(20, 1, 20), glm::vec3(0, -1, 0));
+	AddBox(a_scene, glm::vec3(1, 10, 20), glm::vec3(21, 10, 0));
+	AddBox(a_scene, glm::vec3(1, 10, 20), glm::vec3(-21, 10, 0));
+	AddBox(a_scene, glm::vec3(20, 10, 1), glm::vec3(0, 10, 21));
+	AddBox(a_scene, glm::vec3(20, 10, 1), glm::vec3(0, 10, -21));
+
+	// the starting speed gets them past the minimum speed straight away
+	Actor::Material rubber(1.0f, 0.5f);
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		glm::vec3 center(-15.0f + (i % 16) * 2.0f, 2.0f + (i / 256) * 2.0f, -15.0f + ((i / 16) % 16) * 2.0f);
+		center.x += (i / 256) % 2 * 0.5f;
+		a_scene.AddActor(new Actor(Geometry::Sphere(0.5f, center), WHITE, rubber, glm::vec3(0, -1, 0)));
+	}
+}
+
+// columns of boxes, each stacked a little off center
+static void SetupStacks(Scene& a_scene, unsigned int a_bodies)
+{
+	const unsigned int height = 8;
+	unsigned int columns = (0 < a_bodies ? (a_bodies + height - 1) / height : 25);
+	AddBox(a_scene, glm::vec3(30, 1, 30), glm::vec3(0, -1, 0));
+	Actor::Material wood(1.0f, 0.0f);
+	for (unsigned int column = 0; column < columns; ++column)
+	{
+		glm::vec3 base(-20.0f + (column % 10) * 4.0f, 0, -20.0f + (column / 10) * 4.0f);
+		for (unsigned int i = 0; i < height; ++i)
+		{
+			glm::vec3 center = base + glm::vec3(0.02f * i, 0.5f + 1.01f * i, 0);
+			a_scene.AddActor(new Actor(Geometry::Box(glm::vec3(0.5f), center), WHITE, wood, glm::vec3(0, -0.2f, 0)));
+		}
+	}
+}
+
+struct Benchmark
+{
+	const char* name;
+	void(*setup)(Scene&, unsigned int);
+	void(*step)(Scene&, unsigned int);
+};
+
+static const Benchmark BENCHMARKS[] =
+{
+	{ "pool", SetupPool, StepPool },
+	{ "rain", SetupRain, nullptr },
+	{ "stacks", SetupStacks, nullptr },
+};
+
+//
+// Running
+//
+
+// FNV-1a over every body's position and orientation bits
+static unsigned long long PoseHash(const RigidBodyStore& a_bodies)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (unsigned int i = 0; i < a_bodies.Size(); ++i)
+	{
+		const float values[7] = { a_bodies.position[i].x, a_bodies.position[i].y, a_bodies.position[i].z,
+								  a_bodies.orientation[i].x, a_bodies.orientation[i].y,
+								  a_bodies.orientation[i].z, a_bodies.orientation[i].w };
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
+		for (unsigned int j = 0; j < sizeof(values); ++j)
+			hash = (hash ^ bytes[j]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static Broadphase* CreateBroadphase(const std::string& a_name)
+{
+	if ("tree" == a_name)
+		return new Broadphase::DynamicTree();
+	if ("sap" == a_name)
+		return new Broadphase::SweepAndPrune();
+	if ("grid" == a_name)
+		return new Broadphase::UniformGrid();
+	return nullptr;
+}
+
+static void Run(const Benchmark& a_benchmark, const Options& a_options, TaskDispatcher* a_dispatcher)
+{
+	Scene scene;
+	scene.SetDispatcher(a_dispatcher);
+	scene.SetBroadphase(CreateBroadphase(a_options.broadphase));
+	a_benchmark.setup(scene, a_options.bodies);
+
+	Scene::StepStats totals;
+	unsigned long long pairs = 0, contacts = 0;
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+	for (unsigned int step = 0; step < a_options.steps; ++step)
+	{
+		if (nullptr != a_benchmark.step)
+			a_benchmark.step(scene, step);
+		scene.Step(scene.GetTimeStep());
+
+		const Scene::StepStats& stats = scene.GetStepStats();
+		pairs += stats.pairs;
+		contacts += stats.contacts;
+		totals.broadphase += stats.broadphase;
+		totals.narrowphase += stats.narrowphase;
+		totals.solver += stats.solver;
+		totals.integration += stats.integration;
+		totals.sleeping += stats.sleeping;
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	double steps = (double)(0 < a_options.steps ? a_options.steps : 1);
+	double toMilliseconds = 1000.0 / steps;
+	printf("%-8s %7u %6u %10.1f %10.1f %10.1f %8.3f %8.3f %8.3f %8.3f %8.3f  %016llx\n",
+		   a_benchmark.name, scene.GetBodies().Size(), a_options.steps,
+		   (0 < seconds ? a_options.steps / seconds : 0.0), pairs / steps, contacts / steps,
+		   totals.broadphase * toMilliseconds, totals.narrowphase * toMilliseconds,
+		   totals.solver * toMilliseconds, totals.integration * toMilliseconds,
+		   totals.sleeping * toMilliseconds, PoseHash(scene.GetBodies()));
+}
+
+//
+// Narrowphase
+//
+
+// the same spheres and boxes every run, scattered so a good share overlap
+static void CreateShapes(std::vector<Geometry*>& a_shapes, unsigned int a_count)
+{
+	unsigned int seed = 12345;
+	auto random = [&seed]()
+	{
+		seed = seed * 1664525 + 1013904223;
+		return (seed >> 8) / 16777216.0f;
+	};
+	for (unsigned int i = 0; i < a_count; ++i)
+	{
+		glm::vec3 center(random() * 12, random() * 12, random() * 12);
+		if (0 == i % 2)
+			a_shapes.push_back(new Geometry::Sphere(0.5f + random(), center));
+		else
+			a_shapes.push_back(new Geometry::Box(glm::vec3(0.5f) + glm::vec3(random(), random(), random()), center,
+												 random() * 6.28f, random() * 6.28f, random() * 6.28f));
+	}
+}
+
+static void RunNarrowphase(const Options& a_options)
+{
+	std::vector<Geometry*> shapes;
+	CreateShapes(shapes, (0 < a_options.bodies ? a_options.bodies : 256));
+
+	struct PairType
+	{
+		const char* name;
+		Geometry::Shape shape1, shape2;
+		bool all;
+	};
+	static const PairType TYPES[] =
+	{
+		{ "sphere-sphere", Geometry::SPHERE, Geometry::SPHERE, false },
+		{ "sphere-box", Geometry::SPHERE, Geometry::BOX, false },
+		{ "box-box", Geometry::BOX, Geometry::BOX, false },
+		{ "all mixed", Geometry::SPHERE, Geometry::SPHERE, true },
+	};
+
+	printf("%-14s %8s %6s %12s %10s\n", "pair type", "pairs", "passes", "pairs/s", "contacts");
+	printf("%-14s %8s %6s %12s %10s\n", "", "per pass", "", "", "per pass");
+	Geometry::ContactBuffer contacts;
+	for (auto& type : TYPES)
+	{
+		std::vector<std::pair<const Geometry*, const Geometry*>> pairs;
+		for (unsigned int i = 0; i < shapes.size(); ++i)
+		{
+			for (unsigned int j = i + 1; j < shapes.size(); ++j)
+			{
+				Geometry::Shape shape1 = shapes[i]->GetShape(), shape2 = shapes[j]->GetShape();
+				if (type.all ||
+					(shape1 == type.shape1 && shape2 == type.shape2) ||
+					(shape1 == type.shape2 && shape2 == type.shape1))
+					pairs.push_back(std::make_pair(shapes[i], shapes[j]));
+			}
+		}
+
+		unsigned long long found = 0;
+		typedef std::chrono::high_resolution_clock Clock;
+		Clock::time_point start = Clock::now();
+		for (unsigned int pass = 0; pass < a_options.steps; ++pass)
+		{
+			contacts.Clear();
+			for (auto& pair : pairs)
+				Geometry::DetectCollision(*pair.first, *pair.second, contacts);
+			found += contacts.Size();
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		double passes = (double)(0 < a_options.steps ? a_options.steps : 1);
+		printf("%-14s %8u %6u %12.0f %10.1f\n", type.name, (unsigned int)pairs.size(), a_options.steps,
+			   (0 < seconds ? pairs.size() * a_options.steps / seconds : 0.0), found / passes);
+	}
+
+	for (auto shape : shapes)
+		delete shape;
+}
+
+static bool ParseOptions(int a_argc, char** a_argv, Options& a_options)
+{
+	for (int i = 1; i < a_argc; ++i)
+	{
+		const char* argument = a_argv[i];
+		bool hasValue = (i + 1 < a_argc);
+		if (0 == strcmp(argument, "--steps") && hasValue)
+			a_options.steps = (unsigned int)atoi(a_argv[++i]);
+		else if (0 == strcmp(argument, "--threads") && hasValue)
+			a_options.threads = (unsigned int)atoi(a_argv[++i]);
+		else if (0 == strcmp(argument, "--bodies") && hasValue)
+			a_options.bodies = (unsigned int)atoi(a_argv[++i]);
+		else if (0 == strcmp(argument, "--broadphase") && hasValue)
+			a_options.broadphase = a_argv[++i];
+		else if ('-' != argument[0])
+			a_options.scene = argument;
+		else
+			return false;
+	}
+	return true;
+}
+
+int main(int a_argc, char** a_argv)
+{
+	Options options;
+	if (!ParseOptions(a_argc, a_argv, options))
+	{
+		printf("usage: %s [pool|rain|stacks|all|narrowphase] [--steps n] [--threads n] [--bodies n]\n"
+			   "       [--broadphase tree|sap|grid]\n", a_argv[0]);
+		return 1;
+	}
+	Broadphase* broadphase = CreateBroadphase(options.broadphase);
+	if (nullptr == broadphase)
+	{
+		printf("unknown broadphase '%s'\n", options.broadphase.c_str());
+		return 1;
+	}
+	delete broadphase;
+
+	if ("narrowphase" == options.scene)
+	{
+		RunNarrowphase(options);
+		return 0;
+	}
+
+	TaskDispatcher* dispatcher = nullptr;
+	if (1 != options.threads)
+		dispatcher = new TaskDispatcher::ThreadPool(options.threads);
+
+	printf("%-8s %7s %6s %10s %10s %10s %8s %8s %8s %8s %8s  %s\n", "scene", "bodies", "steps",
+		   "steps/s", "pairs", "contacts", "broad", "narrow", "solve", "move", "sleep", "pose hash");
+	printf("%-8s %7s %6s %10s %10s %10s %8s %8s %8s %8s %8s\n", "", "", "", "",
+		   "per step", "per step", "ms/step", "ms/step", "ms/step", "ms/step", "ms/step");
+	bool ran = false;
+	for (auto& benchmark : BENCHMARKS)
+	{
+		if ("all" == options.scene || benchmark.name == options.scene)
+		{
+			Run(benchmark, options, dispatcher);
+			ran = true;
+		}
+	}
+	delete dispatcher;
+
+	if (!ran)
+	{
+		printf("unknown scene '%s'\n", options.scene.c_str());
+		return 1;
+	}
+	return 0;
+}
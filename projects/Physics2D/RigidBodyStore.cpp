@@ -0,0 +1,283 @@
+#include "RigidBodyStore.h"
+
+const RigidBodyStore::Handle RigidBodyStore::INVALID_HANDLE;
+
+//
+// Creating and destroying bodies
+//
+
+void RigidBodyStore::Resize(unsigned int a_size)
+{
+	position.resize(a_size);
+	orientation.resize(a_size);
+	velocity.resize(a_size);
+	angularVelocity.resize(a_size);
+	inverseMass.resize(a_size);
+	inverseInertia.resize(a_size);
+	inertia.resize(a_size);
+	force.resize(a_size);
+	torque.resize(a_size);
+	linearDrag.resize(a_size);
+	rotationalDrag.resize(a_size);
+	minSpeed2.resize(a_size);
+	minAngularSpeed2.resize(a_size);
+	dynamic.resize(a_size);
+	continuous.resize(a_size);
+	geometry.resize(a_size);
+	awake.resize(a_size);
+	sleepTime.resize(a_size);
+	previousPosition.resize(a_size);
+	previousOrientation.resize(a_size);
+	m_handles.resize(a_size);
+}
+
+void RigidBodyStore::Copy(unsigned int a_from, RigidBodyStore& a_destination, unsigned int a_to) const
+{
+	a_destination.position[a_to] = position[a_from];
+	a_destination.orientation[a_to] = orientation[a_from];
+	a_destination.velocity[a_to] = velocity[a_from];
+	a_destination.angularVelocity[a_to] = angularVelocity[a_from];
+	a_destination.inverseMass[a_to] = inverseMass[a_from];
+	a_destination.inverseInertia[a_to] = inverseInertia[a_from];
+	a_destination.inertia[a_to] = inertia[a_from];
+	a_destination.force[a_to] = force[a_from];
+	a_destination.torque[a_to] = torque[a_from];
+	a_destination.linearDrag[a_to] = linearDrag[a_from];
+	a_destination.rotationalDrag[a_to] = rotationalDrag[a_from];
+	a_destination.minSpeed2[a_to] = minSpeed2[a_from];
+	a_destination.minAngularSpeed2[a_to] = minAngularSpeed2[a_from];
+	a_destination.dynamic[a_to] = dynamic[a_from];
+	a_destination.continuous[a_to] = continuous[a_from];
+	a_destination.geometry[a_to] = geometry[a_from];
+	a_destination.awake[a_to] = awake[a_from];
+	a_destination.sleepTime[a_to] = sleepTime[a_from];
+	a_destination.previousPosition[a_to] = previousPosition[a_from];
+	a_destination.previousOrientation[a_to] = previousOrientation[a_from];
+}
+
+RigidBodyStore::Handle RigidBodyStore::Create(Geometry* a_geometry, bool a_dynamic)
+{
+	Handle handle;
+	if (!m_freeHandles.empty())
+	{
+		handle = m_freeHandles.back();
+		m_freeHandles.pop_back();
+	}
+	else
+	{
+		handle = (Handle)m_indices.size();
+		m_indices.push_back(INVALID_HANDLE);
+	}
+	unsigned int index = Size();
+	Resize(index + 1);
+	m_indices[handle] = index;
+	m_handles[index] = handle;
+
+	position[index] = (nullptr != a_geometry ? a_geometry->position : glm::vec3(0));
+	orientation[index] = (nullptr != a_geometry ? a_geometry->orientation() : Geometry::UNROTATED_ORIENTATION);
+	velocity[index] = glm::vec3(0);
+	angularVelocity[index] = glm::vec3(0);
+	inverseMass[index] = 0;
+	inverseInertia[index] = glm::mat3(0);
+	inertia[index] = glm::mat3(0);
+	force[index] = glm::vec3(0);
+	torque[index] = glm::vec3(0);
+	linearDrag[index] = 0;
+	rotationalDrag[index] = 0;
+	minSpeed2[index] = 0;
+	minAngularSpeed2[index] = 0;
+	dynamic[index] = (a_dynamic ? 1 : 0);
+	continuous[index] = 0;
+	geometry[index] = a_geometry;
+	awake[index] = 1;
+	sleepTime[index] = 0;
+	previousPosition[index] = position[index];
+	previousOrientation[index] = orientation[index];
+	return handle;
+}
+
+bool RigidBodyStore::Destroy(Handle a_handle)
+{
+	if (!Contains(a_handle))
+		return false;
+
+	// keep the arrays dense by moving the last body into the gap
+	unsigned int index = m_indices[a_handle];
+	unsigned int last = Size() - 1;
+	if (index != last)
+	{
+		Copy(last, *this, index);
+		m_handles[index] = m_handles[last];
+		m_indices[m_handles[index]] = index;
+	}
+	Resize(last);
+	m_indices[a_handle] = INVALID_HANDLE;
+	m_freeHandles.push_back(a_handle);
+	return true;
+}
+
+RigidBodyStore::Handle RigidBodyStore::Transfer(Handle a_handle, RigidBodyStore& a_destination)
+{
+	if (!Contains(a_handle))
+		return INVALID_HANDLE;
+	if (&a_destination == this)
+		return a_handle;
+	unsigned int index = m_indices[a_handle];
+	Handle handle = a_destination.Create(geometry[index]);
+	Copy(index, a_destination, a_destination.Index(handle));
+	Destroy(a_handle);
+	return handle;
+}
+
+void RigidBodyStore::Clear()
+{
+	Resize(0);
+	m_indices.clear();
+	m_freeHandles.clear();
+}
+
+void RigidBodyStore::SetMassProperties(unsigned int a_index, float a_mass, const glm::mat3& a_inertiaTensor)
+{
+	inverseMass[a_index] = (0 != a_mass ? 1.0f / a_mass : 0.0f);
+	inertia[a_index] = a_inertiaTensor;
+	inverseInertia[a_index] = (0 != glm::determinant(a_inertiaTensor) ?
+							   glm::inverse(a_inertiaTensor) : glm::mat3(0));
+}
+
+//
+// Integration
+//
+
+void RigidBodyStore::Integrate(float a_deltaTime, const glm::vec3& a_gravity)
+{
+	IntegrateRange(0, Size(), a_deltaTime, a_gravity);
+}
+
+void RigidBodyStore::IntegrateRange(unsigned int a_begin, unsigned int a_end,
+									float a_deltaTime, const glm::vec3& a_gravity)
+{
+	for (unsigned int i = a_begin; i < a_end; ++i)
+	{
+		if (awake[i])
+			Integrate(i, a_deltaTime, a_gravity);
+	}
+}
+
+void RigidBodyStore::Integrate(unsigned int a_index, float a_deltaTime, const glm::vec3& a_gravity)
+{
+	glm::vec3& p = position[a_index];
+	glm::quat& q = orientation[a_index];
+	glm::vec3& v = velocity[a_index];
+	glm::vec3& w = angularVelocity[a_index];
+
+	// static movement
+	q = Geometry::Rotation(w * a_deltaTime) * q;
+	p += v * a_deltaTime;
+
+	if (!dynamic[a_index])
+		return;
+
+	// linear force
+	glm::vec3 f = force[a_index] + a_gravity;
+	if (0 < linearDrag[a_index])
+		f -= v * linearDrag[a_index];
+
+	// linear acceleration
+	if (glm::vec3(0) != f && 0 != inverseMass[a_index])
+	{
+		glm::vec3 deltaV = f * inverseMass[a_index] * a_deltaTime;
+		p += 0.5f * deltaV * a_deltaTime;
+		v += deltaV;
+	}
+
+	// angular force
+	glm::vec3 t = torque[a_index];
+	if (0 < rotationalDrag[a_index])
+		t -= w * rotationalDrag[a_index];
+
+	// angular acceleration, using the rotational inertia about the torque axis
+	// (tiny torques can have a length that underflows to zero)
+	float magnitude = glm::length(t);
+	if (0 < magnitude)
+	{
+		glm::vec3 axis = t / magnitude;
+		float i = glm::dot(axis, inertia[a_index] * axis);
+		if (0 != i)
+		{
+			glm::vec3 deltaAV = t * a_deltaTime / i;
+			q = Geometry::Rotation(0.5f * deltaAV * a_deltaTime) * q;
+			w += deltaAV;
+		}
+	}
+
+	EnforceMinSpeed(a_index);
+}
+
+void RigidBodyStore::EnforceMinSpeed(unsigned int a_index)
+{
+	if (glm::length2(velocity[a_index]) < minSpeed2[a_index])
+		velocity[a_index] = glm::vec3(0);
+	if (glm::length2(angularVelocity[a_index]) < minAngularSpeed2[a_index])
+		angularVelocity[a_index] = glm::vec3(0);
+}
+
+//
+// Sleeping
+//
+
+void RigidBodyStore::WakeAll()
+{
+	unsigned int size = Size();
+	for (unsigned int i = 0; i < size; ++i)
+		Wake(i);
+}
+
+void RigidBodyStore::Sleep(unsigned int a_index)
+{
+	awake[a_index] = 0;
+	velocity[a_index] = glm::vec3(0);
+	angularVelocity[a_index] = glm::vec3(0);
+}
+
+void RigidBodyStore::UpdateSleepTimes(float a_deltaTime)
+{
+	unsigned int size = Size();
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		if (!awake[i] || !dynamic[i])
+			continue;
+		if (glm::length2(velocity[i]) <= minSpeed2[i] &&
+			glm::length2(angularVelocity[i]) <= minAngularSpeed2[i])
+			sleepTime[i] += a_deltaTime;
+		else
+			sleepTime[i] = 0;
+	}
+}
+
+//
+// Synchronizing geometry
+//
+
+void RigidBodyStore::WriteBack()
+{
+	WriteBackRange(0, Size());
+}
+
+void RigidBodyStore::WriteBackRange(unsigned int a_begin, unsigned int a_end)
+{
+	for (unsigned int i = a_begin; i < a_end; ++i)
+	{
+		if (awake[i])
+			WriteBack(i);
+	}
+}
+
+void RigidBodyStore::WriteBack(unsigned int a_index)
+{
+	Geometry* shape = geometry[a_index];
+	if (nullptr == shape)
+		return;
+	shape->position = position[a_index];
+	if (shape->orientation() != orientation[a_index])
+		shape->orientation(orientation[a_index]);
+}
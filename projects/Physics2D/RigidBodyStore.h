@@ -0,0 +1,120 @@
+#pragma once
+#include "Geometry.h"
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#include <vector>
+
+// Structure-of-arrays storage for rigid body state.  Bodies are packed densely,
+// so integration is a single linear pass over each array; handles stay valid
+// when other bodies are destroyed and the arrays are compacted.
+//
+// The store is authoritative for position and orientation - geometry is only
+// brought up to date by WriteBack(), which Scene does after each integration.
+class RigidBodyStore
+{
+public:
+
+	typedef unsigned int Handle;
+	static const Handle INVALID_HANDLE = 0xffffffff;
+
+	RigidBodyStore() {}
+
+	// new bodies take their position and orientation from the given geometry,
+	// which must outlive the body
+	Handle Create(Geometry* a_geometry, bool a_dynamic = false);
+	bool Destroy(Handle a_handle);	// returns false if handle not in store
+	Handle Transfer(Handle a_handle, RigidBodyStore& a_destination);
+	void Clear();
+
+	unsigned int Size() const { return (unsigned int)m_handles.size(); }
+	bool Contains(Handle a_handle) const
+	{
+		return a_handle < m_indices.size() && INVALID_HANDLE != m_indices[a_handle];
+	}
+	unsigned int Index(Handle a_handle) const { return m_indices[a_handle]; }
+	Handle GetHandle(unsigned int a_index) const { return m_handles[a_index]; }
+
+	void SetMassProperties(unsigned int a_index, float a_mass, const glm::mat3& a_inertiaTensor);
+	float GetMass(unsigned int a_index) const
+	{
+		return (0 != inverseMass[a_index] ? 1.0f / inverseMass[a_index] : 0.0f);
+	}
+
+	// integrate velocities and then positions, for every awake body, the awake
+	// bodies in [a_begin, a_end), or just one body
+	void Integrate(float a_deltaTime, const glm::vec3& a_gravity = glm::vec3(0));
+	void IntegrateRange(unsigned int a_begin, unsigned int a_end,
+						float a_deltaTime, const glm::vec3& a_gravity = glm::vec3(0));
+	void Integrate(unsigned int a_index, float a_deltaTime, const glm::vec3& a_gravity = glm::vec3(0));
+
+	// copy position and orientation out to the geometry, the same way
+	void WriteBack();
+	void WriteBackRange(unsigned int a_begin, unsigned int a_end);
+	void WriteBack(unsigned int a_index);
+
+	void EnforceMinSpeed(unsigned int a_index);
+
+	// copies the current poses into the previous ones, at the start of a step
+	void StorePreviousPoses()
+	{
+		previousPosition = position;
+		previousOrientation = orientation;
+	}
+
+	// sleeping bodies are skipped by integration and write-back until woken
+	bool IsAwake(unsigned int a_index) const { return 0 != awake[a_index]; }
+	bool IsMoving(unsigned int a_index) const	// awake and dynamic, or static but moved by its velocity
+	{
+		return 0 != awake[a_index] &&
+			   (0 != dynamic[a_index] || glm::vec3(0) != velocity[a_index] ||
+				glm::vec3(0) != angularVelocity[a_index]);
+	}
+	void Wake(unsigned int a_index) { awake[a_index] = 1; sleepTime[a_index] = 0; }
+	void WakeAll();
+	void Sleep(unsigned int a_index);
+
+	// adds the step time for each awake body that's below its minimum speeds,
+	// and resets it for those that aren't
+	void UpdateSleepTimes(float a_deltaTime);
+
+	// hot per-body state, indexed by Index(handle)
+	std::vector<glm::vec3> position;
+	std::vector<glm::quat> orientation;
+	std::vector<glm::vec3> velocity;
+	std::vector<glm::vec3> angularVelocity;
+	std::vector<float> inverseMass;
+	std::vector<glm::mat3> inverseInertia;
+
+	// the rest of what integration reads
+	std::vector<glm::mat3> inertia;
+	std::vector<glm::vec3> force;
+	std::vector<glm::vec3> torque;
+	std::vector<float> linearDrag;
+	std::vector<float> rotationalDrag;
+	std::vector<float> minSpeed2;
+	std::vector<float> minAngularSpeed2;
+	std::vector<unsigned char> dynamic;
+	std::vector<unsigned char> continuous;	// swept each step so it can't pass through anything
+	std::vector<Geometry*> geometry;
+
+	// sleeping
+	std::vector<unsigned char> awake;
+	std::vector<float> sleepTime;	// how long the body has been slow enough to sleep
+
+	// poses at the start of the last step, for interpolating between steps
+	std::vector<glm::vec3> previousPosition;
+	std::vector<glm::quat> previousOrientation;
+
+protected:
+
+	// stores aren't copyable, since handles into them are held elsewhere
+	RigidBodyStore(const RigidBodyStore&);
+	RigidBodyStore& operator=(const RigidBodyStore&);
+
+	void Copy(unsigned int a_from, RigidBodyStore& a_destination, unsigned int a_to) const;
+	void Resize(unsigned int a_size);
+
+	std::vector<unsigned int> m_indices;	// handle -> index
+	std::vector<Handle> m_handles;			// index -> handle
+	std::vector<Handle> m_freeHandles;
+};
@@ -1,12 +1,28 @@
 #include "Scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// how far a continuous body is let into what it hits
+static const float CONTINUOUS_SKIN = 0.005f;
+
+typedef std::chrono::high_resolution_clock Clock;
+static double Seconds(const Clock::time_point& a_start, const Clock::time_point& a_end)
+{
+	return std::chrono::duration<double>(a_end - a_start).count();
+}
 
 void Scene::AddActor(Actor* a_actor)
 {
-	if (nullptr != a_actor)
-		m_actors.insert(a_actor);
+	if (nullptr != a_actor && m_actors.insert(a_actor).second)
+	{
+		a_actor->Attach(m_bodies);
+		m_broadphase->Add(a_actor);
+	}
 }
 void Scene::ClearActors()
 {
+	m_broadphase->Clear();
 	while (!m_actors.empty())
 	{
 		Actor* actor = *m_actors.begin();
@@ -20,34 +36,300 @@ bool Scene::DestroyActor(Actor* a_actor)	// returns false if actor not in scene
 	if (nullptr == a_actor || 0 == m_actors.count(a_actor))
 		return false;
 	m_actors.erase(a_actor);
+	m_broadphase->Remove(a_actor);
 	delete a_actor;
+
+	// anything resting on the actor needs to notice it's gone
+	m_bodies.WakeAll();
 	return true;
 }
 
-void Scene::Update()
+void Scene::SetBroadphase(Broadphase* a_broadphase)
+{
+	if (nullptr == a_broadphase || m_broadphase == a_broadphase)
+		return;
+	delete m_broadphase;
+	m_broadphase = a_broadphase;
+	m_broadphase->Clear();
+	for (auto actor : m_actors)
+		m_broadphase->Add(actor);
+}
+
+unsigned int Scene::Advance(float a_realDeltaTime)
 {
-	float time = Utility::getTotalTime();
-	while (time - m_lastUpdate >= m_timeStep)
+	if (0 >= m_timeStep)
+		return 0;
+	m_accumulator += a_realDeltaTime;
+	unsigned int steps = 0;
+	for (; m_accumulator >= m_timeStep && steps < m_maxSubsteps; ++steps)
 	{
-		// standard physics update
-		m_lastUpdate += m_timeStep;
-		for (auto actor : m_actors)
-			actor->Update(m_timeStep, m_gravity);
+		m_accumulator -= m_timeStep;
+		Step(m_timeStep);
+	}
+
+	// over budget, so drop whole steps but keep the fraction for interpolation
+	if (m_accumulator >= m_timeStep)
+		m_accumulator = fmod(m_accumulator, m_timeStep);
+	return steps;
+}
+
+// One step, as phases that each run their work over the dispatcher.  Work is
+// split so each job only writes what it owns, and anything order-dependent is
+// gathered afterwards in a fixed order, so results don't depend on threading.
+void Scene::Step(float a_deltaTime)
+{
+	TaskDispatcher& dispatcher = GetDispatcher();
+	Clock::time_point start = Clock::now();
+	m_bodies.StorePreviousPoses();
 
-		// collision resolution
-		std::set<Actor*> unchecked(m_actors);
-		while (1 < unchecked.size())
+	// find contacts, only for pairs with overlapping bounds
+	m_broadphase->FindPairs(m_pairs);
+	Clock::time_point broadphase = Clock::now();
+	Narrowphase(dispatcher);
+	Clock::time_point narrowphase = Clock::now();
+
+	// resolve contacts, with independent islands solved in parallel
+	m_islands.Build(m_bodies);
+	m_solver.Solve(m_bodies, m_islands, dispatcher);
+	Clock::time_point solver = Clock::now();
+
+	// then move everything, without letting continuous bodies pass through anything
+	BeginSweeps();
+	dispatcher.RunChunks(m_bodies.Size(), BODIES_PER_JOB, [&](unsigned int a_begin, unsigned int a_end)
+	{
+		m_bodies.IntegrateRange(a_begin, a_end, a_deltaTime, m_gravity);
+		m_bodies.WriteBackRange(a_begin, a_end);
+	});
+	EndSweeps();
+	Clock::time_point integration = Clock::now();
+
+	// islands that have all been slow for long enough go to sleep
+	if (0 < m_timeToSleep)
+	{
+		m_bodies.UpdateSleepTimes(a_deltaTime);
+		m_islands.Sleep(m_bodies, m_timeToSleep);
+	}
+	Clock::time_point sleeping = Clock::now();
+
+	m_stepStats.pairs = (unsigned int)m_pairs.size();
+	m_stepStats.contacts = m_contacts.Size();
+	m_stepStats.islands = m_islands.GetIslandCount();
+	m_stepStats.broadphase = Seconds(start, broadphase);
+	m_stepStats.narrowphase = Seconds(broadphase, narrowphase);
+	m_stepStats.solver = Seconds(narrowphase, solver);
+	m_stepStats.integration = Seconds(solver, integration);
+	m_stepStats.sleeping = Seconds(integration, sleeping);
+}
+
+void Scene::Narrowphase(TaskDispatcher& a_dispatcher)
+{
+	// detect collisions in batches of pairs, each batch into its own buffer
+	unsigned int pairCount = (unsigned int)m_pairs.size();
+	unsigned int batchCount = (pairCount + PAIRS_PER_JOB - 1) / PAIRS_PER_JOB;
+	if (m_batchContacts.size() < batchCount)
+		m_batchContacts.resize(batchCount);
+	m_pairContacts.resize(pairCount);
+	a_dispatcher.RunChunks(pairCount, PAIRS_PER_JOB, [&](unsigned int a_begin, unsigned int a_end)
+	{
+		Geometry::ContactBuffer& contacts = m_batchContacts[a_begin / PAIRS_PER_JOB];
+		contacts.Clear();
+		for (unsigned int i = a_begin; i < a_end; ++i)
+		{
+			// a consistent order keeps contact IDs the same from step to step
+			Broadphase::Pair& pair = m_pairs[i];
+			if (pair.actor2->GetBody() < pair.actor1->GetBody())
+				std::swap(pair.actor1, pair.actor2);
+			m_pairContacts[i] = 0;
+
+			// nothing has changed between bodies that are asleep or don't move
+			if (!m_bodies.IsMoving(pair.actor1->GetBodyIndex()) &&
+				!m_bodies.IsMoving(pair.actor2->GetBodyIndex()))
+				continue;
+
+			unsigned int first = contacts.Size();
+			if (Geometry::DetectCollision(pair.actor1->GetGeometry(), pair.actor2->GetGeometry(), contacts))
+				m_pairContacts[i] = contacts.Size() - first;
+		}
+	});
+
+	// gather the contacts in pair order
+	m_contacts.Clear();
+	m_solver.Begin();
+	m_islands.Begin(m_bodies.Size());
+	for (unsigned int batch = 0, i = 0; batch < batchCount; ++batch)
+	{
+		const Geometry::ContactBuffer& contacts = m_batchContacts[batch];
+		unsigned int next = 0;
+		for (unsigned int end = glm::min(i + PAIRS_PER_JOB, pairCount); i < end; ++i)
 		{
-			Actor* actor1 = *unchecked.begin();
-			unchecked.erase(actor1);
-			for (auto actor2 : unchecked)
-				Actor::ResolveCollision(actor1, actor2);
+			if (0 == m_pairContacts[i])
+				continue;
+			Actor* actor1 = m_pairs[i].actor1;
+			Actor* actor2 = m_pairs[i].actor2;
+			unsigned int body1 = actor1->GetBodyIndex();
+			unsigned int body2 = actor2->GetBodyIndex();
+
+			// touching a moving body wakes a sleeping one, and dynamic bodies in
+			// contact share an island
+			if (!m_bodies.IsAwake(body1))
+				m_bodies.Wake(body1);
+			if (!m_bodies.IsAwake(body2))
+				m_bodies.Wake(body2);
+			if (m_bodies.dynamic[body1] && m_bodies.dynamic[body2])
+				m_islands.Join(body1, body2);
+
+			const Actor::Material& material1 = actor1->GetMaterial();
+			const Actor::Material& material2 = actor2->GetMaterial();
+			float friction = (material1.dynamicFriction + material2.dynamicFriction) / 2;
+			float restitution = fmin(material1.elasticity, material2.elasticity);
+			for (unsigned int j = 0; j < m_pairContacts[i]; ++j, ++next)
+			{
+				m_contacts.Append() = contacts[next];
+				m_solver.AddContact(m_bodies, body1, body2, contacts[next], friction, restitution,
+									contacts[next].feature);
+			}
 		}
 	}
 }
 
-void Scene::Render() const
+void Scene::BeginSweeps()
 {
+	m_sweepBodies.clear();
+	m_sweepStarts.clear();
+	for (unsigned int i = 0; i < m_bodies.Size(); ++i)
+	{
+		const Geometry* geometry = m_bodies.geometry[i];
+		if (m_bodies.continuous[i] && m_bodies.dynamic[i] && m_bodies.awake[i] &&
+			nullptr != geometry && Geometry::SPHERE == geometry->GetShape())
+		{
+			m_sweepBodies.push_back(i);
+			m_sweepStarts.push_back(m_bodies.position[i]);
+		}
+	}
+}
+
+void Scene::EndSweeps()
+{
+	// everything else has moved, and that's what the paths are tested against
+	if (!m_sweepBodies.empty())
+		m_broadphase->UpdateBounds();
+	for (unsigned int k = 0; k < m_sweepBodies.size(); ++k)
+	{
+		unsigned int i = m_sweepBodies[k];
+		glm::vec3 displacement = m_bodies.position[i] - m_sweepStarts[k];
+		float distance = glm::length(displacement);
+		if (0 == distance)
+			continue;
+
+		// the sphere where it started
+		Geometry::Sphere sphere(static_cast<const Geometry::Sphere*>(m_bodies.geometry[i])->radius, m_sweepStarts[k]);
+
+		// anything touched at the start is already a contact, so it's left to the solver
+		float first = 1;
+		m_broadphase->Query(Broadphase::Segment(sphere.position, displacement, sphere.radius), m_queryActors);
+		for (auto actor : m_queryActors)
+		{
+			float time;
+			if (actor->GetBodyIndex() != i &&
+				Geometry::Sweep(sphere, displacement, actor->GetGeometry(), time) && 0 < time && time < first)
+				first = time;
+		}
+
+		// stop just inside, so the next step's narrowphase finds the contact
+		if (1 > first)
+		{
+			m_bodies.position[i] = m_sweepStarts[k] + displacement * glm::min(first + CONTINUOUS_SKIN / distance, 1.0f);
+			m_bodies.WriteBack(i);
+		}
+	}
+}
+
+//
+// Queries
+//
+
+bool Scene::CastRay(const Ray& a_ray, Actor* const* a_candidates, unsigned int a_count, RayHit& a_hit)
+{
+	Geometry::Sphere sphere(a_ray.radius, a_ray.origin);
+	glm::vec3 displacement = a_ray.direction * a_ray.maxDistance;
+	float first = 2;
+	glm::vec3 normal;
+	a_hit.actor = nullptr;
+	for (unsigned int i = 0; i < a_count; ++i)
+	{
+		float time;
+		if (a_candidates[i] != a_ray.ignore &&
+			Geometry::Sweep(sphere, displacement, a_candidates[i]->GetGeometry(), time, &normal) && time < first)
+		{
+			first = time;
+			a_hit.actor = a_candidates[i];
+			a_hit.normal = normal;
+		}
+	}
+	if (nullptr == a_hit.actor)
+		return false;
+	a_hit.distance = first * a_ray.maxDistance;
+	a_hit.point = a_ray.origin + a_ray.direction * a_hit.distance - a_hit.normal * a_ray.radius;
+	return true;
+}
+
+bool Scene::Raycast(const glm::vec3& a_origin, const glm::vec3& a_direction, float a_maxDistance,
+					RayHit& a_hit, const Actor* a_ignore)
+{
+	Ray ray(a_origin, a_direction, a_maxDistance, 0, a_ignore);
+	m_broadphase->UpdateBounds();
+	m_broadphase->Query(Broadphase::Segment(ray.origin, ray.direction * ray.maxDistance), m_queryActors);
+	return CastRay(ray, m_queryActors.data(), (unsigned int)m_queryActors.size(), a_hit);
+}
+
+bool Scene::Sweep(const Geometry::Sphere& a_sphere, const glm::vec3& a_direction, float a_maxDistance,
+				  RayHit& a_hit, const Actor* a_ignore)
+{
+	Ray ray(a_sphere.position, a_direction, a_maxDistance, a_sphere.radius, a_ignore);
+	m_broadphase->UpdateBounds();
+	m_broadphase->Query(Broadphase::Segment(ray.origin, ray.direction * ray.maxDistance, ray.radius), m_queryActors);
+	return CastRay(ray, m_queryActors.data(), (unsigned int)m_queryActors.size(), a_hit);
+}
+
+void Scene::Raycast(const Ray* a_rays, unsigned int a_count, RayHit* a_hits)
+{
+	// the bounds are brought up to date and the tree walked once for the batch
+	m_broadphase->UpdateBounds();
+	m_querySegments.resize(a_count);
+	for (unsigned int i = 0; i < a_count; ++i)
+		m_querySegments[i] = Broadphase::Segment(a_rays[i].origin, a_rays[i].direction * a_rays[i].maxDistance,
+												 a_rays[i].radius);
+	m_broadphase->Query(m_querySegments.data(), a_count, m_queryActors, m_queryStarts);
+	for (unsigned int i = 0; i < a_count; ++i)
+		CastRay(a_rays[i], m_queryActors.data() + m_queryStarts[i], m_queryStarts[i + 1] - m_queryStarts[i], a_hits[i]);
+}
+
+unsigned int Scene::Overlap(const Geometry& a_geometry, std::vector<Actor*>& a_actors, const Actor* a_ignore)
+{
+	m_broadphase->UpdateBounds();
+	m_broadphase->Query(Broadphase::Bounds(a_geometry), a_actors);
+	unsigned int count = 0;
+	for (auto actor : a_actors)
+	{
+		if (actor != a_ignore &&
+			Geometry::DetectCollision(a_geometry, actor->GetGeometry()))
+			a_actors[count++] = actor;
+	}
+	a_actors.resize(count);
+	return count;
+}
+
+void Scene::Render()
+{
+	// geometry is only posed for drawing, then put back where the bodies are
+	float alpha = GetInterpolationAlpha();
 	for (auto actor : m_actors)
+	{
+		unsigned int index = actor->GetBodyIndex();
+		Geometry& geometry = actor->GetGeometry();
+		geometry.position = glm::mix(m_bodies.previousPosition[index], m_bodies.position[index], alpha);
+		geometry.orientation(glm::mix(m_bodies.previousOrientation[index], m_bodies.orientation[index], alpha));
 		actor->Render();
-}
\ No newline at end of file
+		m_bodies.WriteBack(index);
+	}
+}
@@ -1,17 +1,23 @@
 #pragma once
 #include "Actor.h"
-#include "Utilities.h"
+#include "Broadphase.h"
+#include "ContactSolver.h"
+#include "IslandBuilder.h"
+#include "RigidBodyStore.h"
+#include "TaskDispatcher.h"
 #include <set>
+#include <vector>
 
 class Scene
 {
 public:
 
 	Scene(const glm::vec3& a_gravity = glm::vec3(0.0f, -9.81f, 0.0f),
-		  float a_timeStep = 0.01f)
-		: m_gravity(a_gravity), m_timeStep(a_timeStep),
-		  m_lastUpdate(Utility::getTotalTime()) {}
-	~Scene() { ClearActors(); }
+		  float a_timeStep = 0.01f, unsigned int a_maxSubsteps = 8)
+		: m_gravity(a_gravity), m_timeStep(a_timeStep), m_maxSubsteps(a_maxSubsteps),
+		  m_accumulator(0), m_timeToSleep(0.5f),
+		  m_broadphase(new Broadphase::DynamicTree()), m_dispatcher(nullptr) {}
+	~Scene() { ClearActors(); delete m_broadphase; }
 
 	void AddActor(Actor* a_actor);
 	void ClearActors();
@@ -19,16 +25,144 @@ public:
 	const std::set<Actor*>& GetActors() const { return m_actors; }
 	bool HasActor(Actor* a_actor) const { return nullptr != a_actor && 0 != m_actors.count(a_actor); }
 
-	void Update();
-	void Render() const;
+	// the scene takes ownership of the broadphase and deletes the previous one
+	void SetBroadphase(Broadphase* a_broadphase);
+	const Broadphase& GetBroadphase() const { return *m_broadphase; }
+	const RigidBodyStore& GetBodies() const { return m_bodies; }
+	const Geometry::ContactBuffer& GetContacts() const { return m_contacts; }	// from the last step
+	ContactSolver& GetSolver() { return m_solver; }
+	const IslandBuilder& GetIslands() const { return m_islands; }	// from the last step
+
+	// the scene doesn't take ownership, so one dispatcher can be shared with other
+	// scenes or a PhysX host - null runs everything on the calling thread
+	void SetDispatcher(TaskDispatcher* a_dispatcher) { m_dispatcher = a_dispatcher; }
+	TaskDispatcher& GetDispatcher() { return (nullptr != m_dispatcher ? *m_dispatcher : m_serialDispatcher); }
+
+	// islands that stay below their bodies' minimum speeds for this long are put
+	// to sleep - zero disables sleeping
+	float GetTimeToSleep() const { return m_timeToSleep; }
+	void SetTimeToSleep(float a_seconds) { m_timeToSleep = a_seconds; }
+
+	// Advances the simulation by real time, in as many fixed steps as fit, up to
+	// the substep budget.  Time that doesn't fit in the budget is dropped rather
+	// than carried over, so a hitch slows the simulation down for a frame instead
+	// of making every later frame catch up.  Returns the number of steps taken.
+	unsigned int Advance(float a_realDeltaTime);
+
+	// runs exactly one step, without touching the accumulated time
+	void Step(float a_deltaTime);
+
+	float GetTimeStep() const { return m_timeStep; }
+	void SetTimeStep(float a_timeStep) { m_timeStep = a_timeStep; }
+	unsigned int GetMaxSubsteps() const { return m_maxSubsteps; }
+	void SetMaxSubsteps(unsigned int a_maxSubsteps) { m_maxSubsteps = a_maxSubsteps; }
+
+	// how far real time is between the last step and the next one, from 0 to 1
+	float GetInterpolationAlpha() const { return (0 < m_timeStep ? m_accumulator / m_timeStep : 0.0f); }
+
+	// draws every actor blended between its last two steps by the interpolation alpha
+	void Render();
+
+	// what the last step found, and how long each of its phases took in seconds
+	struct StepStats
+	{
+		unsigned int pairs;		// from the broadphase
+		unsigned int contacts;
+		unsigned int islands;
+		double broadphase;
+		double narrowphase;
+		double solver;			// including island building
+		double integration;		// including continuous sweeps
+		double sleeping;
+
+		StepStats() : pairs(0), contacts(0), islands(0), broadphase(0), narrowphase(0),
+					  solver(0), integration(0), sleeping(0) {}
+	};
+	const StepStats& GetStepStats() const { return m_stepStats; }
+
+	// A ray from origin along a unit direction, or a sphere swept along it when
+	// the radius isn't zero.  The ignored actor is skipped, for casting out from
+	// an actor without hitting it.
+	struct Ray
+	{
+		glm::vec3 origin;
+		glm::vec3 direction;
+		float maxDistance;
+		float radius;
+		const Actor* ignore;
+
+		Ray(const glm::vec3& a_origin = glm::vec3(0), const glm::vec3& a_direction = glm::vec3(0, 0, -1),
+			float a_maxDistance = 1000.0f, float a_radius = 0, const Actor* a_ignore = nullptr)
+			: origin(a_origin), direction(a_direction), maxDistance(a_maxDistance), radius(a_radius),
+			  ignore(a_ignore) {}
+	};
+
+	// the first actor a ray hit, how far along it was, and the surface there -
+	// for sweeps the point is where the sphere touched
+	struct RayHit
+	{
+		Actor* actor;
+		float distance;
+		glm::vec3 point;
+		glm::vec3 normal;
+
+		RayHit() : actor(nullptr), distance(0), point(0), normal(0) {}
+	};
+
+	// Queries go through the broadphase, so they see every actor where it is
+	// now, and starting inside an actor counts as hitting it at distance zero.
+	bool Raycast(const glm::vec3& a_origin, const glm::vec3& a_direction, float a_maxDistance,
+				 RayHit& a_hit, const Actor* a_ignore = nullptr);
+	bool Sweep(const Geometry::Sphere& a_sphere, const glm::vec3& a_direction, float a_maxDistance,
+			   RayHit& a_hit, const Actor* a_ignore = nullptr);
+
+	// casts a batch of rays together, with a_hits[i].actor null where ray i missed
+	void Raycast(const Ray* a_rays, unsigned int a_count, RayHit* a_hits);
+
+	// replaces the contents of a_actors with every actor that touches a_geometry
+	unsigned int Overlap(const Geometry& a_geometry, std::vector<Actor*>& a_actors, const Actor* a_ignore = nullptr);
 
 
 protected:
 
+	// how work is split into jobs for the dispatcher
+	static const unsigned int PAIRS_PER_JOB = 64;
+	static const unsigned int BODIES_PER_JOB = 256;
+
+	void Narrowphase(TaskDispatcher& a_dispatcher);
+
+	// continuous bodies note where they start from before integration, then
+	// are pulled back to their first impact along the way
+	void BeginSweeps();
+	void EndSweeps();
+
+	// finds a ray's first hit among the candidates the broadphase gave it
+	static bool CastRay(const Ray& a_ray, Actor* const* a_candidates, unsigned int a_count, RayHit& a_hit);
+
 	glm::vec3 m_gravity;
 	float m_timeStep;
-	float m_lastUpdate;
+	unsigned int m_maxSubsteps;
+	float m_accumulator;	// real time not yet simulated
+	float m_timeToSleep;
+	StepStats m_stepStats;
 
 	std::set<Actor*> m_actors;
+	RigidBodyStore m_bodies;
+
+	Broadphase* m_broadphase;
+	std::vector<Broadphase::Pair> m_pairs;
+	Geometry::ContactBuffer m_contacts;
+	std::vector<Geometry::ContactBuffer> m_batchContacts;	// per narrowphase job
+	std::vector<unsigned int> m_pairContacts;				// per pair, how many contacts it had
+	ContactSolver m_solver;
+	IslandBuilder m_islands;
+	std::vector<unsigned int> m_sweepBodies;
+	std::vector<glm::vec3> m_sweepStarts;
+	std::vector<Actor*> m_queryActors;
+	std::vector<Broadphase::Segment> m_querySegments;
+	std::vector<unsigned int> m_queryStarts;
+
+	TaskDispatcher* m_dispatcher;
+	TaskDispatcher::Serial m_serialDispatcher;
 
 };
@@ -0,0 +1,30 @@
+#include "TaskDispatcher.h"
+
+TaskDispatcher::Batch::Batch(Job& a_job, unsigned int a_count, unsigned int a_threadCount)
+	: m_job(a_job), m_rangeCount(0 < a_threadCount ? a_threadCount : 1), m_remaining(a_count)
+{
+	// contiguous ranges, so each thread mostly works on neighbouring data
+	m_ranges = new Range[m_rangeCount];
+	for (unsigned int i = 0; i < m_rangeCount; ++i)
+	{
+		m_ranges[i].next.store((unsigned int)((unsigned long long)a_count * i / m_rangeCount));
+		m_ranges[i].end = (unsigned int)((unsigned long long)a_count * (i + 1) / m_rangeCount);
+	}
+}
+
+void TaskDispatcher::Batch::Work(unsigned int a_thread)
+{
+	for (unsigned int i = 0; i < m_rangeCount && !IsDone(); ++i)
+	{
+		Range& range = m_ranges[(a_thread + i) % m_rangeCount];
+		for (;;)
+		{
+			// taking past the end is harmless, the index is just ignored
+			unsigned int index = range.next.fetch_add(1);
+			if (index >= range.end)
+				break;
+			m_job.Run(index);
+			m_remaining.fetch_sub(1);
+		}
+	}
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs batches of independent jobs for Scene.  Jobs in a batch are identified
+// by index, and may run in any order on any thread, so each one should only
+// write to what its index owns - that way the results don't depend on which
+// thread ran what.
+class TaskDispatcher
+{
+public:
+
+	class Job
+	{
+	public:
+		virtual ~Job() {}
+		virtual void Run(unsigned int a_index) = 0;
+	};
+
+	// implemented dispatcher types
+	class Serial;
+	class ThreadPool;
+	class PhysX;	// in TaskDispatcher_PhysX.h, so only hosts that link PhysX need it
+
+	virtual ~TaskDispatcher() {}
+
+	// threads that jobs run on, including the one that calls Run()
+	virtual unsigned int GetThreadCount() const = 0;
+
+	// runs a_job for every index below a_count, and returns once they're all done
+	virtual void Run(Job& a_job, unsigned int a_count) = 0;
+
+	// runs a_function(begin, end) over every index below a_count, in chunks of
+	// up to a_chunkSize - chunk i always starts at i * a_chunkSize
+	template <typename Function>
+	void RunChunks(unsigned int a_count, unsigned int a_chunkSize, const Function& a_function)
+	{
+		if (0 == a_count)
+			return;
+		unsigned int chunkSize = (0 < a_chunkSize ? a_chunkSize : 1);
+		ChunkJob<Function> job(a_count, chunkSize, a_function);
+		Run(job, (a_count + chunkSize - 1) / chunkSize);
+	}
+
+protected:
+
+	template <typename Function>
+	class ChunkJob : public Job
+	{
+	public:
+		ChunkJob(unsigned int a_count, unsigned int a_chunkSize, const Function& a_function)
+			: m_count(a_count), m_chunkSize(a_chunkSize), m_function(a_function) {}
+		virtual void Run(unsigned int a_index)
+		{
+			unsigned int begin = a_index * m_chunkSize;
+			unsigned int end = (m_count - begin > m_chunkSize ? begin + m_chunkSize : m_count);
+			m_function(begin, end);
+		}
+	private:
+		ChunkJob& operator=(const ChunkJob&);
+		unsigned int m_count;
+		unsigned int m_chunkSize;
+		const Function& m_function;
+	};
+
+	// A batch's indices, split into one range per thread.  Each thread works
+	// through its own range, then steals what's left of the others'.
+	class Batch
+	{
+	public:
+
+		Batch(Job& a_job, unsigned int a_count, unsigned int a_threadCount);
+		~Batch() { delete[] m_ranges; }
+
+		// runs jobs until there are none left to take
+		void Work(unsigned int a_thread);
+		bool IsDone() const { return 0 == m_remaining.load(); }
+
+	protected:
+
+		Batch(const Batch&);
+		Batch& operator=(const Batch&);
+
+		// on separate cache lines, since every thread hammers its own
+		struct Range
+		{
+			std::atomic<unsigned int> next;
+			unsigned int end;
+			char padding[64 - sizeof(std::atomic<unsigned int>) - sizeof(unsigned int)];
+		};
+
+		Job& m_job;
+		Range* m_ranges;
+		unsigned int m_rangeCount;
+		std::atomic<unsigned int> m_remaining;
+	};
+};
+
+// runs every job on the calling thread, in index order
+class TaskDispatcher::Serial : public TaskDispatcher
+{
+public:
+
+	virtual unsigned int GetThreadCount() const { return 1; }
+	virtual void Run(Job& a_job, unsigned int a_count)
+	{
+		for (unsigned int i = 0; i < a_count; ++i)
+			a_job.Run(i);
+	}
+};
+
+// Runs batches over a fixed set of worker threads, with the calling thread
+// joining in.  Small batches aren't worth waking the workers for, so batches
+// of fewer than a_minParallelJobs jobs just run on the calling thread.
+class TaskDispatcher::ThreadPool : public TaskDispatcher
+{
+public:
+
+	// a thread count of zero uses one thread per hardware thread
+	ThreadPool(unsigned int a_threadCount = 0, unsigned int a_minParallelJobs = 2);
+	virtual ~ThreadPool();
+
+	virtual unsigned int GetThreadCount() const { return (unsigned int)m_workers.size() + 1; }
+	virtual void Run(Job& a_job, unsigned int a_count);
+
+protected:
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void WorkerMain(unsigned int a_thread);
+
+	std::vector<std::thread> m_workers;
+	unsigned int m_minParallelJobs;
+
+	// workers sleep until the generation changes, then work on the batch
+	std::mutex m_mutex;
+	std::condition_variable m_batchReady;
+	std::condition_variable m_batchFinished;
+	Batch* m_batch;
+	unsigned int m_generation;
+	unsigned int m_busyWorkers;
+	bool m_quit;
+};
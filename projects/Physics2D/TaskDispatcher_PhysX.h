@@ -0,0 +1,69 @@
+#pragma once
+#include "TaskDispatcher.h"
+#include <pxtask/PxCpuDispatcher.h>
+#include <pxtask/PxTask.h>
+#include <thread>
+
+// Runs batches on the workers of a PhysX CPU dispatcher (e.g. the
+// PxDefaultCpuDispatcher a host already created for its PxScene), so the two
+// simulations share threads instead of oversubscribing the CPU.  The
+// dispatcher should be created without profiling, since these tasks aren't
+// submitted through a PxTaskManager.
+class TaskDispatcher::PhysX : public TaskDispatcher
+{
+public:
+
+	PhysX(physx::PxCpuDispatcher& a_dispatcher) : m_dispatcher(a_dispatcher) {}
+
+	virtual unsigned int GetThreadCount() const { return m_dispatcher.getWorkerCount() + 1; }
+	virtual void Run(Job& a_job, unsigned int a_count)
+	{
+		unsigned int workers = m_dispatcher.getWorkerCount();
+		if (0 == workers || a_count < 2)
+		{
+			for (unsigned int i = 0; i < a_count; ++i)
+				a_job.Run(i);
+			return;
+		}
+
+		// one task per worker, each working on the same batch as this thread
+		Batch batch(a_job, a_count, workers + 1);
+		std::atomic<unsigned int> pending(workers);
+		std::vector<Task> tasks(workers, Task(batch, pending));
+		for (unsigned int i = 0; i < workers; ++i)
+		{
+			tasks[i].m_thread = i + 1;
+			m_dispatcher.submitTask(tasks[i]);
+		}
+		batch.Work(0);
+
+		// the tasks live on this stack, so wait until the dispatcher is done with them
+		while (0 != pending.load())
+			std::this_thread::yield();
+	}
+
+protected:
+
+	class Task : public physx::PxBaseTask
+	{
+	public:
+
+		Task(Batch& a_batch, std::atomic<unsigned int>& a_pending)
+			: m_batch(&a_batch), m_pending(&a_pending), m_thread(0) {}
+		Task(const Task& a_task)
+			: m_batch(a_task.m_batch), m_pending(a_task.m_pending), m_thread(a_task.m_thread) {}
+
+		virtual void run() { m_batch->Work(m_thread); }
+		virtual const char* getName() const { return "Physics2D"; }
+		virtual void addReference() {}
+		virtual void removeReference() {}
+		virtual physx::PxI32 getReference() const { return 1; }
+		virtual void release() { m_pending->fetch_sub(1); }
+
+		Batch* m_batch;
+		std::atomic<unsigned int>* m_pending;
+		unsigned int m_thread;
+	};
+
+	physx::PxCpuDispatcher& m_dispatcher;
+};
@@ -0,0 +1,69 @@
+#include "TaskDispatcher.h"
+
+TaskDispatcher::ThreadPool::ThreadPool(unsigned int a_threadCount, unsigned int a_minParallelJobs)
+	: m_minParallelJobs(a_minParallelJobs), m_batch(nullptr),
+	  m_generation(0), m_busyWorkers(0), m_quit(false)
+{
+	unsigned int threadCount = a_threadCount;
+	if (0 == threadCount)
+		threadCount = std::thread::hardware_concurrency();
+	for (unsigned int i = 1; i < threadCount; ++i)
+		m_workers.push_back(std::thread(&ThreadPool::WorkerMain, this, i));
+}
+
+TaskDispatcher::ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_batchReady.notify_all();
+	for (auto& worker : m_workers)
+		worker.join();
+}
+
+void TaskDispatcher::ThreadPool::Run(Job& a_job, unsigned int a_count)
+{
+	if (m_workers.empty() || a_count < m_minParallelJobs)
+	{
+		for (unsigned int i = 0; i < a_count; ++i)
+			a_job.Run(i);
+		return;
+	}
+
+	Batch batch(a_job, a_count, GetThreadCount());
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_batch = &batch;
+		m_busyWorkers = (unsigned int)m_workers.size();
+		++m_generation;
+	}
+	m_batchReady.notify_all();
+	batch.Work(0);
+
+	// the batch lives on this stack, so wait until no worker can still touch it
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_batchFinished.wait(lock, [this]() { return 0 == m_busyWorkers; });
+	m_batch = nullptr;
+}
+
+void TaskDispatcher::ThreadPool::WorkerMain(unsigned int a_thread)
+{
+	unsigned int generation = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_batchReady.wait(lock, [&]() { return m_quit || generation != m_generation; });
+		if (m_quit)
+			return;
+		generation = m_generation;
+		Batch* batch = m_batch;
+
+		lock.unlock();
+		batch->Work(a_thread);
+		lock.lock();
+
+		if (0 == --m_busyWorkers)
+			m_batchFinished.notify_one();
+	}
+}
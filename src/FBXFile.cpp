@@ -2,6 +2,21 @@
 #include <fbxsdk.h>
 #include <algorithm>
 #include <set>
+#include <deque>
+#include <condition_variable>
+#include <xmmintrin.h>
+#include <sys/stat.h>
+
+// for memory mapping caches
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 // only needed for texture cleanup
 #define GLEW_NO_GLU
@@ -36,6 +51,14 @@ struct ImportAssistor
 
 void FBXFile::unload()
 {
+	cancelTextures();
+
+	if (m_uploadBuffer != 0)
+	{
+		glDeleteBuffers(1, &m_uploadBuffer);
+		m_uploadBuffer = 0;
+	}
+
 	delete m_root;
 	m_root = nullptr;
 
@@ -58,7 +81,8 @@ void FBXFile::unload()
 }
 
 bool FBXFile::load(const char* a_filename, UNIT_SCALE a_scale /* = FBXFile::UNITS_METER */, 
-	bool a_loadTextures /* = true */, bool a_loadAnimations /* = true */, bool a_flipTextureY /*= true*/)
+	bool a_loadTextures /* = true */, bool a_loadAnimations /* = true */, bool a_flipTextureY /*= true*/,
+	bool a_useCache /* = true */)
 {
 	if (m_root != nullptr)
 	{
@@ -66,6 +90,15 @@ bool FBXFile::load(const char* a_filename, UNIT_SCALE a_scale /* = FBXFile::UNIT
 		return false;
 	}
 
+	// skip the import entirely if there's a cache for this file and these options
+	CacheKey cacheKey;
+	bool useCache = a_useCache && makeCacheKey(a_filename, a_scale, a_loadTextures, a_loadAnimations, a_flipTextureY, cacheKey);
+	if (useCache && loadCache(a_filename, cacheKey))
+	{
+		loadTextures();
+		return true;
+	}
+
 	FbxManager* lSdkManager = nullptr;
 	FbxScene* lScene = nullptr;
 
@@ -255,25 +288,395 @@ bool FBXFile::load(const char* a_filename, UNIT_SCALE a_scale /* = FBXFile::UNIT
 
 	lSdkManager->Destroy();
 
-	// load textures!
-	for (auto texture : m_textures)
-		m_threads.push_back( new std::thread( [](FBXTexture* t){
+	if (useCache && m_root != nullptr)
+		saveCache(a_filename, cacheKey);
+
+	loadTextures();
+
+	return true;
+}
+
+// Decodes texture images on a fixed set of threads shared by every FBXFile.
+// Requests for a path that's queued or decoding join that job rather than
+// decoding the image again.  The budget covers images being decoded and those
+// decoded but not yet uploaded, and a decode only starts once it fits, unless
+// nothing is held or a blocked load() needs it to make progress.
+class TextureDecoder
+{
+public:
+
+	static TextureDecoder&	get()
+	{
+		// never destroyed, so FBXFiles destroyed during exit can still cancel
+		static TextureDecoder* decoder = new TextureDecoder();
+		return *decoder;
+	}
+
+	void	queue(FBXFile* a_file, FBXTexture* a_texture, FBXFile::TextureListener* a_listener)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if (m_threads.empty())
+		{
+			unsigned int count = std::max(2u, std::thread::hardware_concurrency());
+			for (unsigned int i = 0; i < count; ++i)
+				m_threads.push_back(new std::thread(&TextureDecoder::work, this));
+		}
+
+		FileState& file = m_files[a_file];
+		file.total++;
+		file.listener = a_listener;
+
+		Job*& job = m_jobs[a_texture->path];
+		if (job == nullptr)
+		{
+			job = new Job();
+			job->path = a_texture->path;
+			job->decoding = false;
+			m_queue.push_back(job);
+			m_workAvailable.notify_one();
+		}
+		Request request = { a_file, a_texture };
+		job->requests.push_back(request);
+	}
+
+	void	wait(FBXFile* a_file)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		// the file's images can't be uploaded until this returns, so while
+		// it waits decodes mustn't hold out for its memory to be released
+		m_waiting++;
+		m_budgetFreed.notify_all();
+
+		auto iter = m_files.find(a_file);
+		while ((iter != m_files.end() &&
+				iter->second.loaded < iter->second.total) ||
+			   m_notifying > 0)
+		{
+			m_progress.wait(lock);
+			iter = m_files.find(a_file);
+		}
+
+		m_waiting--;
+	}
+
+	// drops the file's requests, its textures are about to be deleted
+	void	cancel(FBXFile* a_file)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		for (auto iter = m_jobs.begin(); iter != m_jobs.end(); )
+		{
+			Job* job = iter->second;
+			job->requests.erase(std::remove_if(job->requests.begin(), job->requests.end(),
+				[a_file](const Request& r) { return r.file == a_file; }), job->requests.end());
 
-		t->data = stbi_load(t->path.c_str(), &t->width, &t->height, &t->format, STBI_default);
-		//	t->data = SOIL_load_image(t->path.c_str(), &t->width, &t->height, &t->channels, SOIL_LOAD_AUTO);
-			if (t->data == nullptr)
+			// a decoding job cleans itself up when it finishes
+			if (job->requests.empty() &&
+				job->decoding == false)
 			{
-				printf("Failed to load texture: %s\n", t->path.c_str());
+				m_queue.erase(std::find(m_queue.begin(), m_queue.end(), job));
+				delete job;
+				iter = m_jobs.erase(iter);
 			}
-	}, texture.second));
+			else
+				++iter;
+		}
+
+		// decoded images not yet handed over are freed with their textures
+		auto file = m_files.find(a_file);
+		if (file != m_files.end())
+		{
+			for (auto texture : file->second.decoded)
+				m_decodedBytes -= texture->size;
+			m_files.erase(file);
+			m_budgetFreed.notify_all();
+		}
 
-	for (auto t : m_threads)
-		t->join();
-	m_threads.clear();
+		// listeners may still be told about the file's textures until they're done
+		while (m_notifying > 0)
+			m_progress.wait(lock);
+	}
 
+	// an uploaded or deleted image's memory no longer counts against the budget
+	void	release(size_t a_bytes)
+	{
+		if (a_bytes == 0)
+			return;
 
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_decodedBytes -= a_bytes;
+		m_budgetFreed.notify_all();
+	}
 
-	return true;
+	bool	finished(const FBXFile* a_file)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		auto iter = m_files.find(const_cast<FBXFile*>(a_file));
+		return iter == m_files.end() ||
+			(iter->second.loaded == iter->second.total && iter->second.decoded.empty());
+	}
+
+	// hands over the textures decoded since the last call
+	void	takeDecoded(FBXFile* a_file, std::vector<FBXTexture*>& a_textures)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		auto iter = m_files.find(a_file);
+		if (iter != m_files.end())
+		{
+			a_textures.swap(iter->second.decoded);
+			if (iter->second.loaded == iter->second.total)
+				m_files.erase(iter);
+		}
+	}
+
+	void	setBudget(size_t a_bytes)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_budget = a_bytes;
+		m_budgetFreed.notify_all();
+	}
+
+private:
+
+	TextureDecoder() : m_budget(256 << 20), m_decodingBytes(0), m_decodedBytes(0), m_waiting(0), m_notifying(0) {}
+
+	struct Request
+	{
+		FBXFile*	file;
+		FBXTexture*	texture;
+	};
+
+	struct Job
+	{
+		std::string				path;
+		std::vector<Request>	requests;
+		bool					decoding;
+	};
+
+	struct Notification
+	{
+		FBXFile::TextureListener*	listener;
+		FBXFile*					file;
+		FBXTexture*					texture;
+		unsigned int				loaded;
+		unsigned int				total;
+	};
+
+	struct FileState
+	{
+		FileState() : total(0), loaded(0), listener(nullptr) {}
+
+		unsigned int				total;
+		unsigned int				loaded;
+		FBXFile::TextureListener*	listener;
+		std::vector<FBXTexture*>	decoded;
+	};
+
+	void	work()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while (true)
+		{
+			while (m_queue.empty())
+				m_workAvailable.wait(lock);
+
+			Job* job = m_queue.front();
+			m_queue.pop_front();
+			job->decoding = true;
+			std::string path = job->path;
+
+			// size the image from its header before waiting for room to decode it;
+			// building the mips briefly holds the image and the whole chain
+			lock.unlock();
+			int width = 0, height = 0, format = 0;
+			size_t bytes = 0;
+			if (stbi_info(path.c_str(), &width, &height, &format) != 0)
+				bytes = (size_t)width * height * format * 7 / 3;
+			lock.lock();
+
+			while (m_decodingBytes + m_decodedBytes > 0 &&
+				   m_decodingBytes + m_decodedBytes + bytes > m_budget &&
+				   (m_waiting == 0 || m_decodingBytes > 0))
+				m_budgetFreed.wait(lock);
+			m_decodingBytes += bytes;
+
+			lock.unlock();
+			unsigned char* data = stbi_load(path.c_str(), &width, &height, &format, STBI_default);
+			unsigned int size = 0, levels = 0;
+			if (data != nullptr)
+				data = buildMipChain(data, width, height, format, size, levels);
+			lock.lock();
+
+			m_decodingBytes -= bytes;
+			m_budgetFreed.notify_all();
+
+			if (data == nullptr)
+				printf("Failed to load texture: %s\n", path.c_str());
+
+			// the first request takes the image, later ones get copies
+			std::vector<Notification> notifications;
+			for (unsigned int i = 0; i < job->requests.size(); ++i)
+			{
+				FBXTexture* texture = job->requests[i].texture;
+				texture->width = width;
+				texture->height = height;
+				texture->format = format;
+				texture->size = size;
+				texture->levels = levels;
+				if (i == 0 || data == nullptr)
+					texture->data = data;
+				else
+				{
+					texture->data = (unsigned char*)malloc(size);
+					memcpy(texture->data, data, size);
+				}
+
+				m_decodedBytes += size;
+
+				FileState& file = m_files[job->requests[i].file];
+				file.loaded++;
+				file.decoded.push_back(texture);
+				if (file.listener != nullptr)
+				{
+					Notification notification = { file.listener, job->requests[i].file, texture, file.loaded, file.total };
+					notifications.push_back(notification);
+				}
+			}
+			if (job->requests.empty())
+				stbi_image_free(data);
+
+			m_jobs.erase(path);
+			delete job;
+			m_progress.notify_all();
+
+			// listeners are called unlocked, so a slow one only holds up this worker
+			if (notifications.empty() == false)
+			{
+				m_notifying++;
+				lock.unlock();
+				for (auto& notification : notifications)
+				{
+					notification.listener->textureLoaded(notification.file, notification.texture, notification.loaded, notification.total);
+					if (notification.loaded == notification.total)
+						notification.listener->texturesLoaded(notification.file);
+				}
+				lock.lock();
+				m_notifying--;
+				m_progress.notify_all();
+			}
+		}
+	}
+
+	// replaces a decoded image with it followed by each smaller mip level,
+	// box filtered, so GL doesn't have to generate them on the main thread
+	static unsigned char*	buildMipChain(unsigned char* a_image, int a_width, int a_height, int a_channels,
+										  unsigned int& a_size, unsigned int& a_levels)
+	{
+		a_size = 0;
+		a_levels = 0;
+		for (int w = a_width, h = a_height; ; w = std::max(1, w / 2), h = std::max(1, h / 2))
+		{
+			a_size += w * h * a_channels;
+			a_levels++;
+			if (w == 1 && h == 1)
+				break;
+		}
+
+		unsigned char* chain = (unsigned char*)malloc(a_size);
+		if (chain == nullptr)
+		{
+			a_size = a_width * a_height * a_channels;
+			a_levels = 1;
+			return a_image;
+		}
+		memcpy(chain, a_image, a_width * a_height * a_channels);
+		stbi_image_free(a_image);
+
+		unsigned char* source = chain;
+		int w = a_width, h = a_height;
+		for (unsigned int level = 1; level < a_levels; ++level)
+		{
+			int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+			unsigned char* target = source + w * h * a_channels;
+
+			for (int y = 0; y < nh; ++y)
+			{
+				const unsigned char* row0 = source + std::min(y * 2, h - 1) * w * a_channels;
+				const unsigned char* row1 = source + std::min(y * 2 + 1, h - 1) * w * a_channels;
+				for (int x = 0; x < nw; ++x)
+				{
+					int x0 = std::min(x * 2, w - 1) * a_channels;
+					int x1 = std::min(x * 2 + 1, w - 1) * a_channels;
+					for (int c = 0; c < a_channels; ++c)
+						target[(y * nw + x) * a_channels + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+				}
+			}
+
+			source = target;
+			w = nw;
+			h = nh;
+		}
+
+		return chain;
+	}
+
+	std::mutex					m_mutex;
+	std::condition_variable		m_workAvailable;
+	std::condition_variable		m_budgetFreed;
+	std::condition_variable		m_progress;
+
+	std::vector<std::thread*>	m_threads;
+	std::deque<Job*>			m_queue;
+	std::map<std::string,Job*>	m_jobs;
+	std::map<FBXFile*,FileState>	m_files;
+
+	size_t						m_budget;
+	size_t						m_decodingBytes;
+	size_t						m_decodedBytes;		// decoded but not yet uploaded
+	unsigned int				m_waiting;			// files blocked in wait()
+	unsigned int				m_notifying;		// workers calling listeners
+};
+
+void FBXFile::loadTextures()
+{
+	TextureDecoder& decoder = TextureDecoder::get();
+
+	// nothing will be decoded, so there's no worker to report completion
+	if (m_textures.empty())
+	{
+		if (m_textureListener != nullptr)
+			m_textureListener->texturesLoaded(this);
+		return;
+	}
+
+	for (auto texture : m_textures)
+		decoder.queue(this, texture.second, m_textureListener);
+
+	if (m_textureListener == nullptr)
+		decoder.wait(this);
+}
+
+void FBXFile::cancelTextures()
+{
+	TextureDecoder& decoder = TextureDecoder::get();
+	decoder.cancel(this);
+
+	for (auto texture : m_textureUploads)
+		decoder.release(texture->size);
+	m_textureUploads.clear();
+}
+
+bool FBXFile::texturesLoaded() const
+{
+	return m_textureUploads.empty() && TextureDecoder::get().finished(this);
+}
+
+void FBXFile::setTextureDecodeBudget(size_t a_bytes)
+{
+	TextureDecoder::get().setBudget(a_bytes);
 }
 
 bool FBXFile::loadAnimationsOnly(const char* a_filename, UNIT_SCALE a_scale /* = FBXFile::UNITS_METER */)
@@ -990,7 +1393,7 @@ void FBXFile::extractMeshes(void* a_object, void* a_aieNode)
 	}
 	
 	for (int i = 0 ; i < materialCount ; ++i )
-		m_threads.push_back( new std::thread( optimiseMesh, meshes[i] ) );
+		m_threads.push_back( new std::thread( optimiseMesh, meshes[i], m_weldMode, m_weldEpsilon ) );
 	
 	// set mesh names, vertex attributes, extract material and add to mesh map
 	for ( j = 0 ; j < materialCount ; ++j )
@@ -1024,7 +1427,21 @@ void FBXFile::extractMeshes(void* a_object, void* a_aieNode)
 	delete[] nextIndex;
 }
 
-void FBXFile::optimiseMesh(FBXMeshNode* a_mesh)
+void FBXFile::optimiseMesh(FBXMeshNode* a_mesh, WELD_MODE a_weldMode, float a_weldEpsilon)
+{
+	if (a_weldMode == WELD_HASHED)
+		weldHashed(a_mesh, a_weldEpsilon);
+	else
+		weldSorted(a_mesh);
+
+	if ((a_mesh->m_vertexAttributes & FBXVertex::eTEXCOORD1) != 0)
+	{
+		a_mesh->m_vertexAttributes |= FBXVertex::eTANGENT|FBXVertex::eBINORMAL;
+		calculateTangentsBinormals(a_mesh->m_vertices,a_mesh->m_indices);
+	}
+}
+
+void FBXFile::weldSorted(FBXMeshNode* a_mesh)
 {
 	//sort the vertex array so all common verts are adjacent in the array
 	std::sort(a_mesh->m_vertices.begin(), a_mesh->m_vertices.end());
@@ -1053,12 +1470,138 @@ void FBXFile::optimiseMesh(FBXMeshNode* a_mesh)
 		}
 	}
 	a_mesh->m_vertices.resize(j+1);
+}
 
-	if ((a_mesh->m_vertexAttributes & FBXVertex::eTEXCOORD1) != 0)
+// Welded vertices are found through a hash of the cell their position falls
+// in, with cells the size of the epsilon, so anything within the epsilon is
+// in the same cell or a neighbouring one.  Matches are then confirmed by
+// comparing every attribute against the epsilon.  Tangents and binormals
+// aren't compared as they're only calculated after welding.
+static long long weldCell(float a_value, float a_epsilon)
+{
+	if (a_epsilon > 0)
 	{
-		a_mesh->m_vertexAttributes |= FBXVertex::eTANGENT|FBXVertex::eBINORMAL;
-		calculateTangentsBinormals(a_mesh->m_vertices,a_mesh->m_indices);
+		double cell = floor((double)a_value / a_epsilon);
+		if (cell != cell)
+			return 0;
+		return (long long)glm::clamp(cell, -4.0e18, 4.0e18);
+	}
+
+	// an epsilon of 0 welds exact copies, with -0 the same as 0
+	if (a_value == 0)
+		return 0;
+	unsigned int bits;
+	memcpy(&bits, &a_value, sizeof(float));
+	return bits;
+}
+
+static unsigned int weldHash(long long a_x, long long a_y, long long a_z)
+{
+	// FNV-1a over the cell coordinates
+	const long long cell[] = { a_x, a_y, a_z };
+	unsigned int hash = 2166136261u;
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		unsigned long long value = (unsigned long long)cell[i];
+		for (unsigned int byte = 0; byte < 8; ++byte)
+			hash = (hash ^ (unsigned int)((value >> (byte * 8)) & 0xff)) * 16777619u;
+	}
+	return hash;
+}
+
+static bool weldMatch(const FBXVertex& a_lhs, const FBXVertex& a_rhs, float a_epsilon)
+{
+	const glm::vec4* lhs4[] = { &a_lhs.position, &a_lhs.colour, &a_lhs.normal, &a_lhs.indices, &a_lhs.weights };
+	const glm::vec4* rhs4[] = { &a_rhs.position, &a_rhs.colour, &a_rhs.normal, &a_rhs.indices, &a_rhs.weights };
+	for (unsigned int i = 0; i < 5; ++i)
+	{
+		glm::vec4 difference = glm::abs(*lhs4[i] - *rhs4[i]);
+		if (glm::max(glm::max(difference.x, difference.y), glm::max(difference.z, difference.w)) > a_epsilon)
+			return false;
 	}
+
+	glm::vec2 difference1 = glm::abs(a_lhs.texCoord1 - a_rhs.texCoord1);
+	glm::vec2 difference2 = glm::abs(a_lhs.texCoord2 - a_rhs.texCoord2);
+	return glm::max(glm::max(difference1.x, difference1.y), glm::max(difference2.x, difference2.y)) <= a_epsilon;
+}
+
+void FBXFile::weldHashed(FBXMeshNode* a_mesh, float a_epsilon)
+{
+	std::vector<FBXVertex>& vertices = a_mesh->m_vertices;
+	unsigned int vertexCount = (unsigned int)vertices.size();
+	if (vertexCount == 0)
+		return;
+
+	// open addressing, at most half full, each entry a cell's hash and a welded vertex
+	struct Entry
+	{
+		unsigned int	hash;
+		unsigned int	vertex;
+	};
+	unsigned int tableSize = 1;
+	while (tableSize < vertexCount * 2)
+		tableSize <<= 1;
+	const unsigned int EMPTY = 0xffffffff;
+	Entry empty = { 0, EMPTY };
+	std::vector<Entry> table(tableSize, empty);
+
+	std::vector<unsigned int> remap(vertexCount);
+	unsigned int weldedCount = 0;
+
+	// exact welding only needs the vertex's own cell
+	int range = (a_epsilon > 0 ? 1 : 0);
+
+	for (unsigned int i = 0; i < vertexCount; ++i)
+	{
+		const FBXVertex& vertex = vertices[i];
+		long long x = weldCell(vertex.position.x, a_epsilon);
+		long long y = weldCell(vertex.position.y, a_epsilon);
+		long long z = weldCell(vertex.position.z, a_epsilon);
+
+		// the first welded vertex within the epsilon, in this cell or a neighbour
+		unsigned int match = EMPTY;
+		for (int dx = -range; dx <= range && match == EMPTY; ++dx)
+		{
+			for (int dy = -range; dy <= range && match == EMPTY; ++dy)
+			{
+				for (int dz = -range; dz <= range && match == EMPTY; ++dz)
+				{
+					unsigned int hash = weldHash(x + dx, y + dy, z + dz);
+					for (unsigned int slot = hash & (tableSize - 1); table[slot].vertex != EMPTY; slot = (slot + 1) & (tableSize - 1))
+					{
+						if (table[slot].hash == hash &&
+							weldMatch(vertices[ table[slot].vertex ], vertex, a_epsilon))
+						{
+							match = table[slot].vertex;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		if (match == EMPTY)
+		{
+			// first occurrence, kept in place so the original order survives
+			unsigned int hash = weldHash(x, y, z);
+			unsigned int slot = hash & (tableSize - 1);
+			while (table[slot].vertex != EMPTY)
+				slot = (slot + 1) & (tableSize - 1);
+			table[slot].hash = hash;
+			table[slot].vertex = weldedCount;
+
+			match = weldedCount;
+			if (weldedCount != i)
+				vertices[weldedCount] = vertices[i];
+			++weldedCount;
+		}
+		remap[i] = match;
+	}
+	vertices.resize(weldedCount);
+
+	// vertices were numbered in the order they were added, so an index is the vertex's original position
+	for (auto& index : a_mesh->m_indices)
+		index = remap[index];
 }
 
 void FBXFile::extractLight(FBXLightNode* a_light, void* a_object)
@@ -1318,28 +1861,104 @@ FBXMaterial* FBXFile::extractMaterial(void* a_mesh, int a_materialIndex)
 	return nullptr;
 }
 
-void FBXFile::initialiseOpenGLTextures()
+void FBXFile::initialiseOpenGLTextures(size_t a_byteBudget /* = 0 */)
 {
-	for (auto texture : m_textures)
+	std::vector<FBXTexture*> decoded;
+	TextureDecoder::get().takeDecoded(this, decoded);
+	m_textureUploads.insert(m_textureUploads.end(), decoded.begin(), decoded.end());
+
+	if (m_textureUploads.empty())
+		return;
+
+	if (m_uploadBuffer == 0)
+		glGenBuffers(1, &m_uploadBuffer);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadBuffer);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	size_t uploaded = 0;
+	unsigned int count = 0;
+	for ( ; count < m_textureUploads.size(); ++count)
 	{
-	//	texture.second->handle = SOIL_create_OGL_texture(texture.second->data, texture.second->width, texture.second->height, texture.second->channels, 
+		FBXTexture* texture = m_textureUploads[count];
+
+		if (a_byteBudget != 0 &&
+			uploaded > 0 &&
+			uploaded + texture->size > a_byteBudget)
+			break;
+		uploaded += texture->size;
+
+	//	texture->handle = SOIL_create_OGL_texture(texture->data, texture->width, texture->height, texture->channels, 
 	//		SOIL_CREATE_NEW_ID, SOIL_FLAG_MIPMAPS | SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
-		switch (texture.second->format)
+		int channels = texture->format;
+		switch (texture->format)
 		{
-		case STBI_grey: texture.second->format = GL_LUMINANCE; break;
-		case STBI_grey_alpha: texture.second->format = GL_LUMINANCE_ALPHA; break;
-		case STBI_rgb: texture.second->format = GL_RGB; break;
-		case STBI_rgb_alpha: texture.second->format = GL_RGBA; break;
+		case STBI_grey: texture->format = GL_LUMINANCE; break;
+		case STBI_grey_alpha: texture->format = GL_LUMINANCE_ALPHA; break;
+		case STBI_rgb: texture->format = GL_RGB; break;
+		case STBI_rgb_alpha: texture->format = GL_RGBA; break;
 		};
 
-		glGenTextures(1, &texture.second->handle);
-		glBindTexture(GL_TEXTURE_2D, texture.second->handle);
-		glTexImage2D(GL_TEXTURE_2D, 0, texture.second->format, texture.second->width, texture.second->height, 0, texture.second->format, GL_UNSIGNED_BYTE, texture.second->data);
+		glGenTextures(1, &texture->handle);
+		glBindTexture(GL_TEXTURE_2D, texture->handle);
+
+		// orphan the last upload's storage rather than wait for GL to finish reading it
+		const unsigned char* source = nullptr;
+		if (texture->data != nullptr)
+		{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, texture->size, nullptr, GL_STREAM_DRAW);
+			void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, texture->size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			if (mapped != nullptr)
+			{
+				memcpy(mapped, texture->data, texture->size);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			}
+			else
+			{
+				// upload straight from memory instead
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				source = texture->data;
+			}
+		}
+
+		// with the buffer bound, pixel pointers are offsets into it
+		size_t offset = 0;
+		int width = texture->width, height = texture->height;
+		unsigned int levels = std::max(1u, texture->levels);
+		for (unsigned int level = 0; level < levels; ++level)
+		{
+			const void* pixels = nullptr;
+			if (texture->data != nullptr)
+				pixels = source != nullptr ? (const void*)(source + offset) : (const void*)offset;
+
+			glTexImage2D(GL_TEXTURE_2D, level, texture->format, width, height, 0, texture->format, GL_UNSIGNED_BYTE, pixels);
+
+			offset += width * height * channels;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+
+		if (levels > 1)
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		else
+			glGenerateMipmap(GL_TEXTURE_2D);
 	//	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	//	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glGenerateMipmap(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, 0);
+
+		if (source != nullptr)
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadBuffer);
+
+		// GL has its own copy now
+		stbi_image_free(texture->data);
+		texture->data = nullptr;
+		TextureDecoder::get().release(texture->size);
 	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	m_textureUploads.erase(m_textureUploads.begin(), m_textureUploads.begin() + count);
 }
 
 void FBXFile::extractAnimation(void* a_scene)
@@ -1407,6 +2026,9 @@ void FBXFile::extractAnimation(void* a_scene)
 			}
 		}
 
+		for (unsigned int track = 0 ; track < anim->m_trackCount ; ++track )
+			anim->m_tracks[track].calculateTimes(anim->m_startFrame);
+
 		m_animations[ anim->m_name ] = anim;
 	}
 }
@@ -1618,71 +2240,434 @@ void FBXFile::extractSkeleton(FBXSkeleton* a_skeleton, void* a_scene)
 }
 
 void FBXSkeleton::evaluate(const FBXAnimation* a_animation, float a_time, bool a_loop, float a_FPS)
+{
+	evaluate(a_animation, a_time, m_cursor, a_loop, a_FPS);
+}
+
+// the frame a_time falls on, counted from the animation's start
+static float animationFrame(const FBXAnimation* a_animation, float a_time, bool a_loop, float a_FPS)
+{
+	// determine frame we're on
+	int totalFrames = a_animation->m_endFrame - a_animation->m_startFrame;
+	float animDuration = totalFrames / a_FPS;
+
+	// get time through frame
+	float frameTime = 0;
+	if (a_loop)
+		frameTime = glm::max(glm::mod(a_time,animDuration),0.0f);
+	else
+		frameTime = glm::min(glm::max(a_time,0.0f),animDuration);
+
+	// key times are in frames
+	return frameTime * a_FPS;
+}
+
+static void resetCursor(FBXSkeleton::Cursor& a_cursor, const FBXAnimation* a_animation)
+{
+	if (a_cursor.m_animation != a_animation ||
+		a_cursor.m_keys.size() != a_animation->m_trackCount)
+	{
+		a_cursor.m_animation = a_animation;
+		a_cursor.m_keys.assign(a_animation->m_trackCount, 0);
+	}
+}
+
+// interpolates a track's keys at a_frame, false if the track doesn't cover it
+static bool sampleTrack(const FBXTrack* a_track, float a_frame, unsigned int& a_key,
+						glm::vec3& a_translation, glm::quat& a_rotation, glm::vec3& a_scale)
+{
+	// determine the two keyframes we're between
+	if (a_track->m_keyframeCount < 2 ||
+		a_frame < a_track->m_times[0] ||
+		a_frame > a_track->m_times[a_track->m_keyframeCount - 1])
+		return false;
+
+	a_key = a_track->findKey(a_frame, a_key);
+
+	const FBXKeyFrame* start = &(a_track->m_keyframes[a_key]);
+	const FBXKeyFrame* end = &(a_track->m_keyframes[a_key + 1]);
+	float startTime = a_track->m_times[a_key];
+	float endTime = a_track->m_times[a_key + 1];
+
+	// interpolate between them
+	float fScale = glm::max(0.0f,glm::min(1.0f,(a_frame - startTime) / (endTime - startTime)));
+
+	a_translation = glm::mix(start->m_translation,end->m_translation,fScale);
+	a_scale = glm::mix(start->m_scale,end->m_scale,fScale);
+
+	// rotation (quaternion slerp)
+	a_rotation = glm::normalize(glm::slerp(start->m_rotation,end->m_rotation,fScale));
+	return true;
+}
+
+// translate * scale * rotate, the order local transforms are built in
+static glm::mat4 composeTransform(const glm::vec3& a_translation, const glm::quat& a_rotation, const glm::vec3& a_scale)
+{
+	glm::mat4 mRot = glm::mat4_cast( a_rotation );
+	glm::mat4 mScale = glm::scale( a_scale );
+	glm::mat4 mTranslate = glm::translate( a_translation );
+	return mTranslate * mScale * mRot;
+}
+
+void FBXSkeleton::evaluate(const FBXAnimation* a_animation, float a_time, Cursor& a_cursor, bool a_loop, float a_FPS)
 {
 	if (a_animation != nullptr)
 	{
-		// determine frame we're on
-		int totalFrames = a_animation->m_endFrame - a_animation->m_startFrame;
-		float animDuration = totalFrames / a_FPS;
+		float frame = animationFrame(a_animation, a_time, a_loop, a_FPS);
+		resetCursor(a_cursor, a_animation);
 
-		// get time through frame
-		float frameTime = 0;
-		if (a_loop)
-			frameTime = glm::max(glm::mod(a_time,animDuration),0.0f);
-		else
-			frameTime = glm::min(glm::max(a_time,0.0f),animDuration);
-				
-		const FBXTrack* track = nullptr;
-		const FBXKeyFrame* start = nullptr;
-		const FBXKeyFrame* end = nullptr;
+		glm::vec3 T, S;
+		glm::quat R;
+		for ( unsigned int i = 0 ; i < a_animation->m_trackCount ; ++i )
+		{
+			const FBXTrack* track = &(a_animation->m_tracks[i]);
+
+			if (sampleTrack(track, frame, a_cursor.m_keys[i], T, R, S))
+				m_nodes[ track->m_boneIndex ]->m_localTransform = composeTransform(T, R, S);
+		}
+	}
+}
+
+void FBXSkeleton::evaluate(const FBXAnimation* a_animation, float a_time, FBXPose& a_pose, Cursor& a_cursor, bool a_loop, float a_FPS) const
+{
+	if (a_animation != nullptr)
+	{
+		float frame = animationFrame(a_animation, a_time, a_loop, a_FPS);
+		resetCursor(a_cursor, a_animation);
 
 		for ( unsigned int i = 0 ; i < a_animation->m_trackCount ; ++i )
 		{
-			track = &(a_animation->m_tracks[i]);
+			const FBXTrack* track = &(a_animation->m_tracks[i]);
+			if (track->m_boneIndex >= a_pose.m_boneCount)
+				continue;
 
-			start = nullptr;
-			end = nullptr;
-			float startTime, endTime;
+			unsigned int bone = track->m_boneIndex;
+			sampleTrack(track, frame, a_cursor.m_keys[i], a_pose.m_translations[bone], a_pose.m_rotations[bone], a_pose.m_scales[bone]);
+		}
+	}
+}
+
+void FBXSkeleton::getLocalPose(FBXPose& a_pose) const
+{
+	a_pose.resize(m_boneCount);
+
+	for ( unsigned int i = 0 ; i < m_boneCount ; ++i )
+	{
+		const glm::mat4& local = m_nodes[i]->m_localTransform;
+
+		// rows of the scaled rotation are unit rows scaled by each axis
+		glm::mat3 m(local);
+		glm::vec3 scale(glm::length(glm::vec3(m[0][0], m[1][0], m[2][0])),
+						glm::length(glm::vec3(m[0][1], m[1][1], m[2][1])),
+						glm::length(glm::vec3(m[0][2], m[1][2], m[2][2])));
+		for (int c = 0; c < 3; ++c)
+			m[c] /= scale;
+
+		a_pose.m_translations[i] = glm::vec3(local[3]);
+		a_pose.m_rotations[i] = glm::normalize(glm::quat_cast(m));
+		a_pose.m_scales[i] = scale;
+	}
+}
+
+void FBXSkeleton::updateBones(const FBXPose& a_pose)
+{
+	// one matrix per bone, built straight from the pose; bones the pose
+	// doesn't cover keep their node's local transform
+	for ( unsigned int i = 0 ; i < m_boneCount ; ++i )
+	{
+		glm::mat4 local = i < a_pose.m_boneCount ?
+			composeTransform(a_pose.m_translations[i], a_pose.m_rotations[i], a_pose.m_scales[i]) :
+			m_nodes[i]->m_localTransform;
+		if ( m_parentIndex[i] == -1 )
+			m_bones[ i ] = local;
+		else
+			m_bones[i] = m_bones[ m_parentIndex[ i ] ] * local;
+	}
+	// combine bind pose
+	for ( unsigned int i = 0 ; i < m_boneCount ; ++i )
+	{
+		m_bones[ i ] = m_bones[ i ] * m_bindPoses[ i ];
+	}
+}
+
+void FBXPose::resize(unsigned int a_boneCount)
+{
+	// vectors keep their capacity, so reused poses don't reallocate
+	m_boneCount = a_boneCount;
+	m_translations.resize(a_boneCount, glm::vec3(0));
+	m_rotations.resize(a_boneCount, glm::quat(1,0,0,0));
+	m_scales.resize(a_boneCount, glm::vec3(1));
+}
+
+void FBXPose::blend(const FBXPose& a_from, const FBXPose& a_to, float a_weight)
+{
+	unsigned int count = glm::min(a_from.m_boneCount, a_to.m_boneCount);
+	resize(count);
+
+	for ( unsigned int i = 0 ; i < count ; ++i )
+	{
+		m_translations[i] = glm::mix(a_from.m_translations[i], a_to.m_translations[i], a_weight);
+		m_scales[i] = glm::mix(a_from.m_scales[i], a_to.m_scales[i], a_weight);
+		m_rotations[i] = glm::normalize(glm::slerp(a_from.m_rotations[i], a_to.m_rotations[i], a_weight));
+	}
+}
+
+void FBXPose::add(const FBXPose& a_additive, const FBXPose& a_reference, float a_weight)
+{
+	unsigned int count = glm::min(m_boneCount, glm::min(a_additive.m_boneCount, a_reference.m_boneCount));
 
-			// determine the two keyframes we're between
-			for ( unsigned int j = 0 ; j < track->m_keyframeCount - 1 ; ++j )
+	for ( unsigned int i = 0 ; i < count ; ++i )
+	{
+		// how far the additive pose moves from its reference, scaled by the weight
+		glm::quat rotation = glm::inverse(a_reference.m_rotations[i]) * a_additive.m_rotations[i];
+		rotation = glm::slerp(glm::quat(1,0,0,0), rotation, a_weight);
+
+		m_translations[i] += (a_additive.m_translations[i] - a_reference.m_translations[i]) * a_weight;
+		// a zero reference scale has no ratio, so that axis is left as it is
+		glm::vec3 scale(1);
+		for ( int c = 0 ; c < 3 ; ++c )
+		{
+			if (a_reference.m_scales[i][c] != 0)
+				scale[c] = a_additive.m_scales[i][c] / a_reference.m_scales[i][c];
+		}
+		m_scales[i] *= glm::mix(glm::vec3(1), scale, a_weight);
+		m_rotations[i] = glm::normalize(m_rotations[i] * rotation);
+	}
+}
+
+// a_result = a_lhs * a_rhs for column-major 4x4 matrices, a_result may be either
+static inline void multiplyMatrices(const float* a_lhs, const float* a_rhs, float* a_result)
+{
+	__m128 c0 = _mm_loadu_ps(a_lhs);
+	__m128 c1 = _mm_loadu_ps(a_lhs + 4);
+	__m128 c2 = _mm_loadu_ps(a_lhs + 8);
+	__m128 c3 = _mm_loadu_ps(a_lhs + 12);
+
+	__m128 columns[4];
+	for (int j = 0; j < 4; ++j)
+	{
+		const float* r = a_rhs + j * 4;
+		columns[j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(r[0])), _mm_mul_ps(c1, _mm_set1_ps(r[1]))),
+								_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(r[2])), _mm_mul_ps(c3, _mm_set1_ps(r[3]))));
+	}
+	for (int j = 0; j < 4; ++j)
+		_mm_storeu_ps(a_result + j * 4, columns[j]);
+}
+
+// one register per component, lane i holding a_values[i]
+static inline void gatherLanes(const glm::vec3* const a_values[4], __m128& a_x, __m128& a_y, __m128& a_z)
+{
+	a_x = _mm_setr_ps(a_values[0]->x, a_values[1]->x, a_values[2]->x, a_values[3]->x);
+	a_y = _mm_setr_ps(a_values[0]->y, a_values[1]->y, a_values[2]->y, a_values[3]->y);
+	a_z = _mm_setr_ps(a_values[0]->z, a_values[1]->z, a_values[2]->z, a_values[3]->z);
+}
+
+// quats are four packed floats, so a load and a transpose does the gather
+static inline void gatherLanes(const glm::quat* const a_values[4], __m128& a_x, __m128& a_y, __m128& a_z, __m128& a_w)
+{
+	a_x = _mm_loadu_ps(&a_values[0]->x);
+	a_y = _mm_loadu_ps(&a_values[1]->x);
+	a_z = _mm_loadu_ps(&a_values[2]->x);
+	a_w = _mm_loadu_ps(&a_values[3]->x);
+	_MM_TRANSPOSE4_PS(a_x, a_y, a_z, a_w);
+}
+
+static inline __m128 lerpLanes(__m128 a_from, __m128 a_to, __m128 a_blend)
+{
+	return _mm_add_ps(a_from, _mm_mul_ps(_mm_sub_ps(a_to, a_from), a_blend));
+}
+
+void FBXSkeleton::evaluateBatch(const FBXAnimation* a_animation, const float* a_times, unsigned int a_count, glm::mat4* a_palettes,
+								Cursor* a_cursors /* = nullptr */, bool a_loop /* = true */, float a_FPS /* = 24.0f */) const
+{
+	if (a_animation == nullptr ||
+		a_count == 0)
+		return;
+
+	// bones without tracks keep the skeleton's local transforms
+	for (unsigned int n = 0; n < a_count; ++n)
+		for (unsigned int b = 0; b < m_boneCount; ++b)
+			a_palettes[n * m_boneCount + b] = m_nodes[b]->m_localTransform;
+
+	if (a_cursors != nullptr)
+	{
+		for (unsigned int n = 0; n < a_count; ++n)
+			resetCursor(a_cursors[n], a_animation);
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+
+	// four instances at a time, one per lane
+	for (unsigned int n = 0; n < a_count; n += 4)
+	{
+		// lanes past the last instance repeat the first and are dropped;
+		// an instance's frame is the same for every track
+		float frames[4];
+		for (unsigned int lane = 0; lane < 4; ++lane)
+			frames[lane] = animationFrame(a_animation, a_times[n + lane < a_count ? n + lane : n], a_loop, a_FPS);
+
+		for (unsigned int i = 0; i < a_animation->m_trackCount; ++i)
+		{
+			const FBXTrack* track = &(a_animation->m_tracks[i]);
+			if (track->m_keyframeCount < 2)
+				continue;
+
+			const glm::quat* startRotations[4];
+			const glm::quat* endRotations[4];
+			const glm::vec3* startTranslations[4];
+			const glm::vec3* endTranslations[4];
+			const glm::vec3* startScales[4];
+			const glm::vec3* endScales[4];
+			float blend[4];
+			bool valid[4];
+
+			for (unsigned int lane = 0; lane < 4; ++lane)
 			{
-				startTime = (track->m_keyframes[j].m_key - a_animation->m_startFrame) / a_FPS;
-				endTime = (track->m_keyframes[j + 1].m_key - a_animation->m_startFrame) / a_FPS;
+				unsigned int instance = n + lane < a_count ? n + lane : n;
+				valid[lane] = n + lane < a_count;
 
-				if (startTime <= frameTime &&
-					endTime >= frameTime)
+				float frame = frames[lane];
+
+				if (frame < track->m_times[0] ||
+					frame > track->m_times[track->m_keyframeCount - 1])
 				{
-					// found?
-					start = &(track->m_keyframes[j]);
-					end = &(track->m_keyframes[j+1]);
-					break;
+					valid[lane] = false;
+					frame = track->m_times[0];
 				}
+
+				unsigned int key = track->findKey(frame, a_cursors != nullptr ? a_cursors[instance].m_keys[i] : 0);
+				if (a_cursors != nullptr && valid[lane])
+					a_cursors[instance].m_keys[i] = key;
+
+				const FBXKeyFrame& start = track->m_keyframes[key];
+				const FBXKeyFrame& end = track->m_keyframes[key + 1];
+				startRotations[lane] = &start.m_rotation;
+				endRotations[lane] = &end.m_rotation;
+				startTranslations[lane] = &start.m_translation;
+				endTranslations[lane] = &end.m_translation;
+				startScales[lane] = &start.m_scale;
+				endScales[lane] = &end.m_scale;
+				blend[lane] = glm::max(0.0f,glm::min(1.0f,(frame - track->m_times[key]) / (track->m_times[key + 1] - track->m_times[key])));
 			}
 
-			// interpolate between them
-			if (start != nullptr &&
-				end != nullptr)
+			__m128 s = _mm_loadu_ps(blend);
+
+			// rotation, normalised lerp along the shorter arc
+			__m128 ax, ay, az, aw, bx, by, bz, bw;
+			gatherLanes(startRotations, ax, ay, az, aw);
+			gatherLanes(endRotations, bx, by, bz, bw);
+
+			__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+			__m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, zero), signBit);
+			bx = _mm_xor_ps(bx, flip);
+			by = _mm_xor_ps(by, flip);
+			bz = _mm_xor_ps(bz, flip);
+			bw = _mm_xor_ps(bw, flip);
+
+			__m128 qx = lerpLanes(ax, bx, s);
+			__m128 qy = lerpLanes(ay, by, s);
+			__m128 qz = lerpLanes(az, bz, s);
+			__m128 qw = lerpLanes(aw, bw, s);
+
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_add_ps(_mm_mul_ps(qz, qz), _mm_mul_ps(qw, qw))));
+			__m128 inverse = _mm_div_ps(one, length);
+			qx = _mm_mul_ps(qx, inverse);
+			qy = _mm_mul_ps(qy, inverse);
+			qz = _mm_mul_ps(qz, inverse);
+			qw = _mm_mul_ps(qw, inverse);
+
+			// translation and scale
+			gatherLanes(startTranslations, ax, ay, az);
+			gatherLanes(endTranslations, bx, by, bz);
+			__m128 tx = lerpLanes(ax, bx, s), ty = lerpLanes(ay, by, s), tz = lerpLanes(az, bz, s);
+
+			gatherLanes(startScales, ax, ay, az);
+			gatherLanes(endScales, bx, by, bz);
+			__m128 sx = lerpLanes(ax, bx, s), sy = lerpLanes(ay, by, s), sz = lerpLanes(az, bz, s);
+
+			// translate * scale * rotate, as evaluate() builds it
+			__m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+			__m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+			__m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+
+			__m128 m[16];
+			m[0] = _mm_mul_ps(sx, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+			m[1] = _mm_mul_ps(sy, _mm_mul_ps(two, _mm_add_ps(xy, wz)));
+			m[2] = _mm_mul_ps(sz, _mm_mul_ps(two, _mm_sub_ps(xz, wy)));
+			m[3] = zero;
+			m[4] = _mm_mul_ps(sx, _mm_mul_ps(two, _mm_sub_ps(xy, wz)));
+			m[5] = _mm_mul_ps(sy, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+			m[6] = _mm_mul_ps(sz, _mm_mul_ps(two, _mm_add_ps(yz, wx)));
+			m[7] = zero;
+			m[8] = _mm_mul_ps(sx, _mm_mul_ps(two, _mm_add_ps(xz, wy)));
+			m[9] = _mm_mul_ps(sy, _mm_mul_ps(two, _mm_sub_ps(yz, wx)));
+			m[10] = _mm_mul_ps(sz, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+			m[11] = zero;
+			m[12] = tx;
+			m[13] = ty;
+			m[14] = tz;
+			m[15] = one;
+
+			// transpose back to one matrix per instance
+			for (unsigned int e = 0; e < 16; e += 4)
+				_MM_TRANSPOSE4_PS(m[e], m[e + 1], m[e + 2], m[e + 3]);
+
+			for (unsigned int lane = 0; lane < 4; ++lane)
 			{
-				float fScale = glm::max(0.0f,glm::min(1.0f,(frameTime - startTime) / (endTime - startTime)));
-
-				// translation
-				glm::vec3 T = glm::mix(start->m_translation,end->m_translation,fScale);
-				
-				// scale
-				glm::vec3 S = glm::mix(start->m_scale,end->m_scale,fScale);
-				
-				// rotation (quaternion slerp)
-				glm::quat R = glm::normalize(glm::slerp(start->m_rotation,end->m_rotation,fScale));
-
-				// build matrix
-				glm::mat4 mRot = glm::mat4_cast( R );
-				glm::mat4 mScale = glm::scale( S );
-				glm::mat4 mTranslate = glm::translate( T );
-				m_nodes[ track->m_boneIndex ]->m_localTransform = mTranslate * mScale * mRot;
+				if (valid[lane] == false)
+					continue;
+
+				float* local = &a_palettes[(n + lane) * m_boneCount + track->m_boneIndex][0][0];
+				for (unsigned int c = 0; c < 4; ++c)
+					_mm_storeu_ps(local + c * 4, m[c * 4 + lane]);
 			}
 		}
 	}
+
+	// parents come before their children, so each local becomes global in place
+	for (unsigned int n = 0; n < a_count; ++n)
+	{
+		glm::mat4* palette = a_palettes + n * m_boneCount;
+
+		for (unsigned int b = 0; b < m_boneCount; ++b)
+		{
+			if (m_parentIndex[b] != -1)
+				multiplyMatrices(&palette[ m_parentIndex[b] ][0][0], &palette[b][0][0], &palette[b][0][0]);
+		}
+		for (unsigned int b = 0; b < m_boneCount; ++b)
+			multiplyMatrices(&palette[b][0][0], &m_bindPoses[b][0][0], &palette[b][0][0]);
+	}
+}
+
+void FBXTrack::calculateTimes(unsigned int a_startFrame)
+{
+	delete[] m_times;
+	m_times = new float[ m_keyframeCount ];
+	for ( unsigned int i = 0 ; i < m_keyframeCount ; ++i )
+		m_times[i] = (float)m_keyframes[i].m_key - (float)a_startFrame;
+}
+
+unsigned int FBXTrack::findKey(float a_time, unsigned int a_cursor) const
+{
+	unsigned int last = m_keyframeCount - 2;
+
+	// playing forward usually stays within a key or moves to the next
+	if (a_cursor <= last &&
+		m_times[a_cursor] <= a_time)
+	{
+		if (a_time <= m_times[a_cursor + 1])
+			return a_cursor;
+		if (a_cursor < last &&
+			a_time <= m_times[a_cursor + 2])
+			return a_cursor + 1;
+	}
+
+	// otherwise the last key at or before the time
+	unsigned int key = (unsigned int)(std::upper_bound(m_times, m_times + m_keyframeCount, a_time) - m_times);
+	return key == 0 ? 0 : std::min(key - 1, last);
 }
 
 void FBXSkeleton::updateBones()
@@ -1928,7 +2913,7 @@ void FBXCameraNode::updateGlobalTransform()
 
 FBXTexture::~FBXTexture()
 {
-	delete[] data;
+	stbi_image_free(data);
 	glDeleteTextures(1, &handle);
 }
 
@@ -1948,7 +2933,561 @@ FBXAnimation* FBXAnimation::clone() const
 		copy->m_tracks[i].m_keyframes = new FBXKeyFrame[ m_tracks[i].m_keyframeCount ];
 
 		memcpy(copy->m_tracks[i].m_keyframes,m_tracks[i].m_keyframes,sizeof(FBXKeyFrame) * m_tracks[i].m_keyframeCount);
+		copy->m_tracks[i].calculateTimes(m_startFrame);
 	}
 
 	return copy;
 }
+
+//////////////////////////////////////////////////////////////////////////
+// Binary cache
+//
+// A cache holds the scene as it is after import: the node tree in depth
+// first order with each mesh's final vertices and indices, then materials,
+// textures, skeletons and animations.  Pointers between them are stored as
+// indices.  Arrays are aligned in the file so they can be copied straight
+// out of the mapping, and nothing is parsed per vertex.
+
+static const unsigned int CACHE_MAGIC = 0x43584246;	// "FBXC"
+static const unsigned int CACHE_VERSION = 3;
+
+// a whole file, read only, memory mapped where possible
+struct CacheMapping
+{
+	CacheMapping() : data(nullptr), size(0) {}
+	~CacheMapping() { close(); }
+
+	bool open(const char* a_filename);
+	void close();
+
+	const unsigned char*	data;
+	size_t					size;
+
+#ifdef _WIN32
+	HANDLE					file;
+	HANDLE					mapping;
+#endif
+};
+
+bool CacheMapping::open(const char* a_filename)
+{
+#ifdef _WIN32
+	file = CreateFileA(a_filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	mapping = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping != nullptr)
+		data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr)
+	{
+		if (mapping != nullptr)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	return true;
+#else
+	int file = ::open(a_filename, O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0)
+	{
+		void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (view != MAP_FAILED)
+		{
+			data = (const unsigned char*)view;
+			size = (size_t)status.st_size;
+		}
+	}
+	::close(file);
+	return data != nullptr;
+#endif
+}
+
+void CacheMapping::close()
+{
+	if (data == nullptr)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	CloseHandle(file);
+#else
+	munmap((void*)data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+struct CacheWriter
+{
+	std::vector<unsigned char>	buffer;
+
+	void write(const void* a_data, size_t a_size)
+	{
+		const unsigned char* bytes = (const unsigned char*)a_data;
+		buffer.insert(buffer.end(), bytes, bytes + a_size);
+	}
+	template <typename T>
+	void write(const T& a_value)			{	write(&a_value, sizeof(T));	}
+	void write(const std::string& a_string)
+	{
+		write((unsigned int)a_string.size());
+		write(a_string.data(), a_string.size());
+	}
+	void align()							{	buffer.resize((buffer.size() + 15) & ~(size_t)15, 0);	}
+};
+
+// reads fail, and keep failing, once anything would run past the end
+struct CacheReader
+{
+	CacheReader(const unsigned char* a_data, size_t a_size) : data(a_data), size(a_size), offset(0), ok(true) {}
+
+	const void* readBytes(size_t a_size)
+	{
+		if (!ok || size - offset < a_size)
+		{
+			ok = false;
+			return nullptr;
+		}
+		const void* bytes = data + offset;
+		offset += a_size;
+		return bytes;
+	}
+	template <typename T>
+	bool read(T& a_value)
+	{
+		const void* bytes = readBytes(sizeof(T));
+		if (bytes != nullptr)
+			memcpy(&a_value, bytes, sizeof(T));
+		return bytes != nullptr;
+	}
+	bool read(std::string& a_string)
+	{
+		unsigned int length = 0;
+		const char* bytes = (read(length) ? (const char*)readBytes(length) : nullptr);
+		if (bytes != nullptr)
+			a_string.assign(bytes, length);
+		return bytes != nullptr;
+	}
+	void align()
+	{
+		size_t aligned = (offset + 15) & ~(size_t)15;
+		if (aligned > size)
+			ok = false;
+		else
+			offset = aligned;
+	}
+
+	const unsigned char*	data;
+	size_t					size;
+	size_t					offset;
+	bool					ok;
+};
+
+template <typename T>
+static int indexOf(const std::vector<T>& a_items, const T& a_item)
+{
+	auto iter = std::find(a_items.begin(), a_items.end(), a_item);
+	return iter != a_items.end() ? (int)(iter - a_items.begin()) : -1;
+}
+
+static void gatherNodes(FBXNode* a_node, std::vector<FBXNode*>& a_nodes)
+{
+	a_nodes.push_back(a_node);
+	for (auto child : a_node->m_children)
+		gatherNodes(child, a_nodes);
+}
+
+static void writeNode(CacheWriter& a_writer, const FBXNode* a_node, const std::vector<FBXMaterial*>& a_materials)
+{
+	a_writer.write((unsigned int)a_node->m_nodeType);
+	a_writer.write(a_node->m_name);
+	a_writer.write(a_node->m_localTransform);
+	a_writer.write((unsigned int)a_node->m_children.size());
+
+	switch (a_node->m_nodeType)
+	{
+	case FBXNode::MESH:
+		{
+			const FBXMeshNode* mesh = (const FBXMeshNode*)a_node;
+			a_writer.write(mesh->m_vertexAttributes);
+			a_writer.write(indexOf(a_materials, mesh->m_material));
+			a_writer.write((unsigned int)mesh->m_vertices.size());
+			a_writer.write((unsigned int)mesh->m_indices.size());
+			a_writer.align();
+			a_writer.write(mesh->m_vertices.data(), mesh->m_vertices.size() * sizeof(FBXVertex));
+			a_writer.write(mesh->m_indices.data(), mesh->m_indices.size() * sizeof(unsigned int));
+		}
+		break;
+	case FBXNode::LIGHT:
+		{
+			const FBXLightNode* light = (const FBXLightNode*)a_node;
+			a_writer.write((unsigned int)light->m_type);
+			a_writer.write((unsigned int)light->m_on);
+			a_writer.write(light->m_colour);
+			a_writer.write(light->m_attenuation);
+			a_writer.write(light->m_innerAngle);
+			a_writer.write(light->m_outerAngle);
+		}
+		break;
+	case FBXNode::CAMERA:
+		{
+			const FBXCameraNode* camera = (const FBXCameraNode*)a_node;
+			a_writer.write(camera->m_fieldOfView);
+			a_writer.write(camera->m_aspectRatio);
+			a_writer.write(camera->m_near);
+			a_writer.write(camera->m_far);
+		}
+		break;
+	default: break;
+	}
+
+	for (auto child : a_node->m_children)
+		writeNode(a_writer, child, a_materials);
+}
+
+// reads a node and its children, adding each to a_nodes in the order they were written
+static FBXNode* readNode(CacheReader& a_reader, FBXNode* a_parent, std::vector<FBXNode*>& a_nodes,
+						 const std::vector<FBXMaterial*>& a_materials)
+{
+	unsigned int type = 0, childCount = 0;
+	if (!a_reader.read(type))
+		return nullptr;
+
+	FBXNode* node = nullptr;
+	switch (type)
+	{
+	case FBXNode::MESH:		node = new FBXMeshNode();	break;
+	case FBXNode::LIGHT:	node = new FBXLightNode();	break;
+	case FBXNode::CAMERA:	node = new FBXCameraNode();	break;
+	default:				node = new FBXNode();		break;
+	}
+	node->m_parent = a_parent;
+	if (a_parent != nullptr)
+		a_parent->m_children.push_back(node);
+	a_nodes.push_back(node);
+
+	a_reader.read(node->m_name);
+	a_reader.read(node->m_localTransform);
+	a_reader.read(childCount);
+
+	if (type == FBXNode::MESH)
+	{
+		FBXMeshNode* mesh = (FBXMeshNode*)node;
+		int material = -1;
+		unsigned int vertexCount = 0, indexCount = 0;
+		a_reader.read(mesh->m_vertexAttributes);
+		a_reader.read(material);
+		a_reader.read(vertexCount);
+		a_reader.read(indexCount);
+		a_reader.align();
+		const FBXVertex* vertices = (const FBXVertex*)a_reader.readBytes((size_t)vertexCount * sizeof(FBXVertex));
+		const unsigned int* indices = (const unsigned int*)a_reader.readBytes((size_t)indexCount * sizeof(unsigned int));
+		if (vertices != nullptr && indices != nullptr)
+		{
+			mesh->m_vertices.assign(vertices, vertices + vertexCount);
+			mesh->m_indices.assign(indices, indices + indexCount);
+		}
+		if (material >= 0 && material < (int)a_materials.size())
+			mesh->m_material = a_materials[material];
+	}
+	else if (type == FBXNode::LIGHT)
+	{
+		FBXLightNode* light = (FBXLightNode*)node;
+		unsigned int lightType = 0, on = 0;
+		a_reader.read(lightType);
+		a_reader.read(on);
+		light->m_type = (FBXLightNode::LightType)lightType;
+		light->m_on = (on != 0);
+		a_reader.read(light->m_colour);
+		a_reader.read(light->m_attenuation);
+		a_reader.read(light->m_innerAngle);
+		a_reader.read(light->m_outerAngle);
+	}
+	else if (type == FBXNode::CAMERA)
+	{
+		FBXCameraNode* camera = (FBXCameraNode*)node;
+		a_reader.read(camera->m_fieldOfView);
+		a_reader.read(camera->m_aspectRatio);
+		a_reader.read(camera->m_near);
+		a_reader.read(camera->m_far);
+	}
+
+	for (unsigned int i = 0; i < childCount && a_reader.ok; ++i)
+		readNode(a_reader, node, a_nodes, a_materials);
+	return node;
+}
+
+bool FBXFile::makeCacheKey(const char* a_filename, UNIT_SCALE a_scale, bool a_loadTextures, bool a_loadAnimations, bool a_flipTextureY, CacheKey& a_key) const
+{
+#ifdef _WIN32
+	struct _stat64 status;
+	if (_stat64(a_filename, &status) != 0)
+		return false;
+#else
+	struct stat status;
+	if (stat(a_filename, &status) != 0)
+		return false;
+#endif
+
+	memset(&a_key, 0, sizeof(CacheKey));
+	a_key.magic = CACHE_MAGIC;
+	a_key.version = CACHE_VERSION;
+	a_key.vertexSize = sizeof(FBXVertex);
+	a_key.options = (unsigned int)a_scale | (a_loadTextures ? 1 << 8 : 0) | (a_loadAnimations ? 1 << 9 : 0) | (a_flipTextureY ? 1 << 10 : 0);
+	a_key.weldEpsilon = (m_weldMode == WELD_HASHED ? m_weldEpsilon : -1.0f);
+	a_key.sourceTime = (long long)status.st_mtime;
+	a_key.sourceSize = (long long)status.st_size;
+	return true;
+}
+
+bool FBXFile::saveCache(const char* a_filename, const CacheKey& a_key) const
+{
+	std::vector<FBXNode*> nodes;
+	gatherNodes(m_root, nodes);
+
+	std::vector<FBXTexture*> textures;
+	for (auto t : m_textures)
+		textures.push_back(t.second);
+	std::vector<FBXMaterial*> materials;
+	for (auto m : m_materials)
+		materials.push_back(m.second);
+
+	CacheWriter writer;
+	writer.write(a_key);
+	writer.write(std::string(a_filename));
+	writer.write(m_path);
+	writer.write(m_ambientLight);
+
+	writer.write((unsigned int)textures.size());
+	for (auto texture : textures)
+	{
+		writer.write(texture->name);
+		writer.write(texture->path);
+	}
+
+	writer.write((unsigned int)materials.size());
+	for (auto material : materials)
+	{
+		writer.write(material->name);
+		writer.write(material->ambient);
+		writer.write(material->diffuse);
+		writer.write(material->specular);
+		writer.write(material->emissive);
+		for (unsigned int i = 0; i < FBXMaterial::TextureTypes_Count; ++i)
+			writer.write(indexOf(textures, material->textures[i]));
+		writer.write(material->textureOffsets);
+		writer.write(material->textureTiling);
+		writer.write(material->textureRotation);
+	}
+
+	writeNode(writer, m_root, materials);
+
+	writer.write((unsigned int)m_meshes.size());
+	for (auto mesh : m_meshes)
+		writer.write(indexOf(nodes, (FBXNode*)mesh));
+
+	writer.write((unsigned int)m_skeletons.size());
+	for (auto skeleton : m_skeletons)
+	{
+		writer.write(skeleton->m_boneCount);
+		for (unsigned int i = 0; i < skeleton->m_boneCount; ++i)
+			writer.write(indexOf(nodes, skeleton->m_nodes[i]));
+		writer.write(skeleton->m_parentIndex, skeleton->m_boneCount * sizeof(int));
+		writer.align();
+		writer.write(skeleton->m_bones, skeleton->m_boneCount * sizeof(glm::mat4));
+		writer.write(skeleton->m_bindPoses, skeleton->m_boneCount * sizeof(glm::mat4));
+	}
+
+	writer.write((unsigned int)m_animations.size());
+	for (auto a : m_animations)
+	{
+		const FBXAnimation* animation = a.second;
+		writer.write(animation->m_name);
+		writer.write(animation->m_startFrame);
+		writer.write(animation->m_endFrame);
+		writer.write(animation->m_trackCount);
+		for (unsigned int i = 0; i < animation->m_trackCount; ++i)
+		{
+			const FBXTrack& track = animation->m_tracks[i];
+			writer.write(track.m_boneIndex);
+			writer.write(track.m_keyframeCount);
+			writer.align();
+			writer.write(track.m_keyframes, track.m_keyframeCount * sizeof(FBXKeyFrame));
+		}
+	}
+
+	std::string cacheName = std::string(a_filename) + ".cache";
+	FILE* file = fopen(cacheName.c_str(), "wb");
+	if (file == nullptr)
+	{
+		printf("Unable to write FBX cache: %s\n", cacheName.c_str());
+		return false;
+	}
+	bool written = fwrite(writer.buffer.data(), 1, writer.buffer.size(), file) == writer.buffer.size();
+	fclose(file);
+	if (!written)
+		remove(cacheName.c_str());
+	return written;
+}
+
+bool FBXFile::loadCache(const char* a_filename, const CacheKey& a_key)
+{
+	std::string cacheName = std::string(a_filename) + ".cache";
+	CacheMapping mapping;
+	if (!mapping.open(cacheName.c_str()))
+		return false;
+
+	CacheReader reader(mapping.data, mapping.size);
+	CacheKey key;
+	std::string source;
+	if (!reader.read(key) || memcmp(&key, &a_key, sizeof(CacheKey)) != 0 ||
+		!reader.read(source) || source != a_filename)
+		return false;
+
+	reader.read(m_path);
+	reader.read(m_ambientLight);
+
+	unsigned int count = 0;
+	std::vector<FBXTexture*> textures;
+	reader.read(count);
+	for (unsigned int i = 0; i < count && reader.ok; ++i)
+	{
+		FBXTexture* texture = new FBXTexture();
+		reader.read(texture->name);
+		reader.read(texture->path);
+		textures.push_back(texture);
+		m_textures[texture->path] = texture;
+	}
+
+	std::vector<FBXMaterial*> materials;
+	reader.read(count);
+	for (unsigned int i = 0; i < count && reader.ok; ++i)
+	{
+		FBXMaterial* material = new FBXMaterial();
+		reader.read(material->name);
+		reader.read(material->ambient);
+		reader.read(material->diffuse);
+		reader.read(material->specular);
+		reader.read(material->emissive);
+		for (unsigned int j = 0; j < FBXMaterial::TextureTypes_Count; ++j)
+		{
+			int texture = -1;
+			reader.read(texture);
+			if (texture >= 0 && texture < (int)textures.size())
+				material->textures[j] = textures[texture];
+		}
+		reader.read(material->textureOffsets);
+		reader.read(material->textureTiling);
+		reader.read(material->textureRotation);
+		materials.push_back(material);
+		m_materials[material->name] = material;
+	}
+
+	std::vector<FBXNode*> nodes;
+	m_root = readNode(reader, nullptr, nodes, materials);
+	for (auto node : nodes)
+	{
+		if (node->m_nodeType == FBXNode::LIGHT)
+			m_lights[node->m_name] = (FBXLightNode*)node;
+		else if (node->m_nodeType == FBXNode::CAMERA)
+			m_cameras[node->m_name] = (FBXCameraNode*)node;
+	}
+
+	reader.read(count);
+	for (unsigned int i = 0; i < count && reader.ok; ++i)
+	{
+		int node = -1;
+		reader.read(node);
+		if (node >= 0 && node < (int)nodes.size() && nodes[node]->m_nodeType == FBXNode::MESH)
+			m_meshes.push_back((FBXMeshNode*)nodes[node]);
+		else
+			reader.ok = false;
+	}
+
+	reader.read(count);
+	for (unsigned int i = 0; i < count && reader.ok; ++i)
+	{
+		FBXSkeleton* skeleton = new FBXSkeleton();
+		m_skeletons.push_back(skeleton);
+		reader.read(skeleton->m_boneCount);
+		if (skeleton->m_boneCount > reader.size)
+		{
+			skeleton->m_boneCount = 0;
+			reader.ok = false;
+			break;
+		}
+		skeleton->m_nodes = new FBXNode*[ skeleton->m_boneCount ];
+		skeleton->m_parentIndex = new int[ skeleton->m_boneCount ];
+		skeleton->m_bones = new glm::mat4[ skeleton->m_boneCount ];
+		skeleton->m_bindPoses = new glm::mat4[ skeleton->m_boneCount ];
+		for (unsigned int j = 0; j < skeleton->m_boneCount; ++j)
+		{
+			int node = -1;
+			reader.read(node);
+			skeleton->m_nodes[j] = (node >= 0 && node < (int)nodes.size() ? nodes[node] : nullptr);
+			if (skeleton->m_nodes[j] == nullptr)
+				reader.ok = false;
+		}
+		const void* parents = reader.readBytes(skeleton->m_boneCount * sizeof(int));
+		reader.align();
+		const void* bones = reader.readBytes(skeleton->m_boneCount * sizeof(glm::mat4));
+		const void* bindPoses = reader.readBytes(skeleton->m_boneCount * sizeof(glm::mat4));
+		if (reader.ok)
+		{
+			memcpy(skeleton->m_parentIndex, parents, skeleton->m_boneCount * sizeof(int));
+			memcpy(skeleton->m_bones, bones, skeleton->m_boneCount * sizeof(glm::mat4));
+			memcpy(skeleton->m_bindPoses, bindPoses, skeleton->m_boneCount * sizeof(glm::mat4));
+		}
+	}
+
+	reader.read(count);
+	for (unsigned int i = 0; i < count && reader.ok; ++i)
+	{
+		FBXAnimation* animation = new FBXAnimation();
+		reader.read(animation->m_name);
+		reader.read(animation->m_startFrame);
+		reader.read(animation->m_endFrame);
+		reader.read(animation->m_trackCount);
+		if (animation->m_trackCount > reader.size)
+		{
+			animation->m_trackCount = 0;
+			reader.ok = false;
+		}
+		animation->m_tracks = new FBXTrack[ animation->m_trackCount ];
+		for (unsigned int j = 0; j < animation->m_trackCount && reader.ok; ++j)
+		{
+			FBXTrack& track = animation->m_tracks[j];
+			unsigned int keyframeCount = 0;
+			reader.read(track.m_boneIndex);
+			reader.read(keyframeCount);
+			reader.align();
+			const void* keyframes = reader.readBytes((size_t)keyframeCount * sizeof(FBXKeyFrame));
+			if (keyframes != nullptr)
+			{
+				track.m_keyframeCount = keyframeCount;
+				track.m_keyframes = new FBXKeyFrame[ keyframeCount ];
+				memcpy(track.m_keyframes, keyframes, keyframeCount * sizeof(FBXKeyFrame));
+				track.calculateTimes(animation->m_startFrame);
+			}
+		}
+		m_animations[animation->m_name] = animation;
+	}
+
+	// a damaged cache is thrown away, and the FBX file imported instead
+	if (!reader.ok || m_root == nullptr)
+	{
+		printf("FBX cache is damaged, ignoring it: %s\n", cacheName.c_str());
+		unload();
+		return false;
+	}
+
+	m_root->updateGlobalTransform();
+	return true;
+}
@@ -1,25 +1,84 @@
 #include "Gizmos.h"
 #include <GL/glew.h>
 #include <glm/ext.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
 
 Gizmos* Gizmos::sm_singleton = nullptr;
 
+// older MSVC only has its own thread local storage, which is fine for a pointer
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define GIZMOS_THREAD_LOCAL __declspec(thread)
+#else
+#define GIZMOS_THREAD_LOCAL thread_local
+#endif
+
+// the recorder that the add functions on this thread write to, if any
+static GIZMOS_THREAD_LOCAL Gizmos::Recorder* s_recorder = nullptr;
+
+// builds a program from vertex and fragment source, binding its attributes to locations in order
+static unsigned int createProgram(const char* a_vsSource, const char* a_fsSource,
+								  const char** a_attributes, unsigned int a_attributeCount,
+								  const char** a_outputs = nullptr, unsigned int a_outputCount = 0)
+{
+	unsigned int vs = glCreateShader(GL_VERTEX_SHADER);
+	unsigned int fs = glCreateShader(GL_FRAGMENT_SHADER);
+
+	glShaderSource(vs, 1, (const char**)&a_vsSource, 0);
+	glCompileShader(vs);
+
+	glShaderSource(fs, 1, (const char**)&a_fsSource, 0);
+	glCompileShader(fs);
+
+	unsigned int program = glCreateProgram();
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	for (unsigned int i = 0; i < a_attributeCount; ++i)
+		glBindAttribLocation(program, i, a_attributes[i]);
+	for (unsigned int i = 0; i < a_outputCount; ++i)
+		glBindFragDataLocation(program, i, a_outputs[i]);
+	glLinkProgram(program);
+    
+	int success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (success == GL_FALSE)
+	{
+		int infoLogLength = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLength);
+		char* infoLog = new char[infoLogLength];
+        
+		glGetProgramInfoLog(program, infoLogLength, 0, infoLog);
+		printf("Error: Failed to link Gizmo shader program!\n");
+		printf("%s",infoLog);
+		printf("\n");
+		delete[] infoLog;
+	}
+
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	return program;
+}
+
 Gizmos::Gizmos(unsigned int a_maxLines, unsigned int a_maxTris,
-			   unsigned int a_max2DLines, unsigned int a_max2DTris)
-	: m_maxLines(a_maxLines),
+			   unsigned int a_max2DLines, unsigned int a_max2DTris,
+			   unsigned int a_maxInstances)
+	: m_region(0),
+	m_dropped(0),
+	m_stats(),
+	m_recordings(nullptr),
+	m_freeRecordings(nullptr),
 	m_lineCount(0),
-	m_lines(new GizmoLine[a_maxLines]),
-	m_maxTris(a_maxTris),
+	m_lines(nullptr),
 	m_triCount(0),
-	m_tris(new GizmoTri[a_maxTris]),
+	m_tris(nullptr),
 	m_transparentTriCount(0),
-	m_transparentTris(new GizmoTri[a_maxTris]),
-	m_max2DLines(a_max2DLines),
+	m_transparentTris(nullptr),
 	m_2DlineCount(0),
-	m_2Dlines(new GizmoLine[a_max2DLines]),
-	m_max2DTris(a_max2DTris),
+	m_2Dlines(nullptr),
 	m_2DtriCount(0),
-	m_2Dtris(new GizmoTri[a_max2DTris])
+	m_2Dtris(nullptr)
 {
 	// create shaders
 	const char* vsSource = "#version 150\n \
@@ -33,132 +92,544 @@ Gizmos::Gizmos(unsigned int a_maxLines, unsigned int a_maxTris,
 					 in vec4 vColour; \
                      out vec4 FragColor; \
 					 void main()	{ FragColor = vColour; }";
+
+	const char* attributes[] = { "Position", "Colour" };
+	m_shader = createProgram(vsSource, fsSource, attributes, 2);
+
+	// instances scale the unit mesh, push a capsule's ends apart along Y by the
+	// mesh's w (-1 or 1), then transform by their rows
+	const char* instanceVSSource = "#version 150\n \
+					 in vec4 Position; \
+					 in vec4 Colour; \
+					 in vec4 Row0; \
+					 in vec4 Row1; \
+					 in vec4 Row2; \
+					 in vec4 Scale; \
+					 out vec4 vColour; \
+					 uniform mat4 ProjectionView; \
+					 uniform float Outline; \
+					 void main() { \
+						vec4 local = vec4(Position.xyz * Scale.xyz + vec3(0, Position.w * Scale.w, 0), 1); \
+						vColour = mix(Colour, vec4(1), Outline); \
+						gl_Position = ProjectionView * vec4(dot(Row0, local), dot(Row1, local), dot(Row2, local), 1); }";
+
+	const char* instanceAttributes[] = { "Position", "Colour", "Row0", "Row1", "Row2", "Scale" };
+	m_instanceShader = createProgram(instanceVSSource, fsSource, instanceAttributes, 6);
+
+	// Transparent fills accumulate into a TransparencyTarget, weighted so that
+	// nearer surfaces count for more, and are resolved in one composite pass.
+	// The blend is ONE, ONE for colour and ZERO, ONE_MINUS_SRC_ALPHA for alpha,
+	// so Accum's alpha ends up as the product of every (1 - alpha).
+	const char* weightedFSSource = "#version 150\n \
+					 in vec4 vColour; \
+					 out vec4 Accum; \
+					 out vec4 Weight; \
+					 void main() { \
+						float a = vColour.a; \
+						float w = a * clamp(3e3 * pow(1 - gl_FragCoord.z, 3), 1e-2, 3e3); \
+						Accum = vec4(vColour.rgb * a * w, a); \
+						Weight = vec4(a * w); }";
+
+	const char* compositeVSSource = "#version 150\n \
+					 void main() { gl_Position = vec4((gl_VertexID & 1) * 4 - 1, (gl_VertexID >> 1) * 4 - 1, 0, 1); }";
+
+	const char* compositeFSSource = "#version 150\n \
+					 uniform sampler2D Accum; \
+					 uniform sampler2D Weight; \
+					 out vec4 FragColor; \
+					 void main() { \
+						ivec2 texel = ivec2(gl_FragCoord.xy); \
+						vec4 accum = texelFetch(Accum, texel, 0); \
+						if (accum.a >= 1) discard; \
+						FragColor = vec4(accum.rgb / max(texelFetch(Weight, texel, 0).r, 1e-5), 1 - accum.a); }";
+
+	const char* weightedOutputs[] = { "Accum", "Weight" };
+	m_weightedShader = createProgram(vsSource, weightedFSSource, attributes, 2, weightedOutputs, 2);
+	m_weightedInstanceShader = createProgram(instanceVSSource, weightedFSSource, instanceAttributes, 6, weightedOutputs, 2);
+	m_compositeShader = createProgram(compositeVSSource, compositeFSSource, nullptr, 0);
+	glUseProgram(m_compositeShader);
+	glUniform1i(glGetUniformLocation(m_compositeShader, "Accum"), 0);
+	glUniform1i(glGetUniformLocation(m_compositeShader, "Weight"), 1);
+	glUseProgram(0);
+
+	// the target's storage is made when first drawn, at the viewport's size
+	m_transparency.fbo = 0;
+	m_transparency.width = 0;
+	m_transparency.height = 0;
+	m_transparency.supported = true;
+	glGenVertexArrays(1, &m_transparency.vao);
     
-    
-	unsigned int vs = glCreateShader(GL_VERTEX_SHADER);
-	unsigned int fs = glCreateShader(GL_FRAGMENT_SHADER);
+	// create a stream per buffer
+	bool persistent = (GLEW_ARB_buffer_storage == GL_TRUE);
+	m_lineStream.create(a_maxLines, sizeof(GizmoLine), persistent);
+	m_triStream.create(a_maxTris, sizeof(GizmoTri), persistent);
+	m_transparentTriStream.create(a_maxTris, sizeof(GizmoTri), persistent);
+	m_2DlineStream.create(a_max2DLines, sizeof(GizmoLine), persistent);
+	m_2DtriStream.create(a_max2DTris, sizeof(GizmoTri), persistent);
+	for (unsigned int shape = 0; shape < INSTANCE_SHAPE_COUNT; ++shape)
+	{
+		for (unsigned int transparent = 0; transparent < 2; ++transparent)
+		{
+			m_instanceStreams[shape][transparent].create(a_maxInstances, sizeof(GizmoInstance), persistent);
+			m_instanceCounts[shape][transparent] = 0;
+			m_instanceOffsets[shape][transparent] = 0;
+		}
+	}
+	createInstanceMeshes();
 
-	glShaderSource(vs, 1, (const char**)&vsSource, 0);
-	glCompileShader(vs);
+	for (unsigned int i = 0; i < STREAM_REGIONS; ++i)
+		m_fences[i] = nullptr;
+	useRegion(0);
+}
 
-	glShaderSource(fs, 1, (const char**)&fsSource, 0);
-	glCompileShader(fs);
+Gizmos::~Gizmos()
+{
+	for (unsigned int i = 0; i < STREAM_REGIONS; ++i)
+	{
+		if (m_fences[i] != nullptr)
+			glDeleteSync((GLsync)m_fences[i]);
+	}
+	m_lineStream.destroy();
+	m_triStream.destroy();
+	m_transparentTriStream.destroy();
+	m_2DlineStream.destroy();
+	m_2DtriStream.destroy();
+	for (unsigned int shape = 0; shape < INSTANCE_SHAPE_COUNT; ++shape)
+	{
+		m_instanceStreams[shape][0].destroy();
+		m_instanceStreams[shape][1].destroy();
+	}
+	glDeleteBuffers(1, &m_instanceMeshVBO);
+	glDeleteVertexArrays(1, &m_instanceVAO);
+	glDeleteProgram(m_instanceShader);
+	glDeleteProgram(m_shader);
+	glDeleteProgram(m_weightedShader);
+	glDeleteProgram(m_weightedInstanceShader);
+	glDeleteProgram(m_compositeShader);
+	m_transparency.destroy();
+	glDeleteVertexArrays(1, &m_transparency.vao);
+
+	Recording* lists[] = { m_recordings, m_freeRecordings };
+	for (Recording* recording : lists)
+	{
+		while (recording != nullptr)
+		{
+			Recording* next = recording->next;
+			delete recording;
+			recording = next;
+		}
+	}
+}
 
-	m_shader = glCreateProgram();
-	glAttachShader(m_shader, vs);
-	glAttachShader(m_shader, fs);
-	glBindAttribLocation(m_shader, 0, "Position");
-	glBindAttribLocation(m_shader, 1, "Colour");
-	glLinkProgram(m_shader);
-    
-	int success = GL_FALSE;
-    glGetProgramiv(m_shader, GL_LINK_STATUS, &success);
-	if (success == GL_FALSE)
+void Gizmos::Stream::create(unsigned int a_capacity, unsigned int a_primitiveSize, bool a_persistent)
+{
+	capacity = std::max(a_capacity, 1u);
+	primitiveSize = a_primitiveSize;
+	initialCapacity = capacity;
+	maxCapacity = std::max(capacity, (unsigned int)(MAX_STREAM_REGION_BYTES / primitiveSize));
+	idleFrames = 0;
+	uploaded = 0;
+	mapped = nullptr;
+	cpu = nullptr;
+	GLsizeiptr size = (GLsizeiptr)capacity * primitiveSize;
+
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	if (a_persistent)
 	{
-		int infoLogLength = 0;
-		glGetShaderiv(m_shader, GL_INFO_LOG_LENGTH, &infoLogLength);
-		char* infoLog = new char[infoLogLength];
-        
-		glGetShaderInfoLog(m_shader, infoLogLength, 0, infoLog);
-		printf("Error: Failed to link Gizmo shader program!\n");
-		printf("%s",infoLog);
-		printf("\n");
-		delete[] infoLog;
+		// coherent, so writes are seen by the next draw without flushing
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, size * STREAM_REGIONS, nullptr, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size * STREAM_REGIONS, flags);
+		if (mapped == nullptr)
+		{
+			// storage is immutable, so start again with a buffer that can be orphaned
+			glDeleteBuffers(1, &vbo);
+			glGenBuffers(1, &vbo);
+			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		}
+	}
+	if (mapped == nullptr)
+	{
+		glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		cpu = new unsigned char[size];
 	}
 
-	glDeleteShader(vs);
-	glDeleteShader(fs);
-    
-    // create VBOs
-	glGenBuffers( 1, &m_lineVBO );
-	glBindBuffer(GL_ARRAY_BUFFER, m_lineVBO);
-	glBufferData(GL_ARRAY_BUFFER, m_maxLines * sizeof(GizmoLine), m_lines, GL_DYNAMIC_DRAW);
-
-	glGenBuffers( 1, &m_triVBO );
-	glBindBuffer(GL_ARRAY_BUFFER, m_triVBO);
-	glBufferData(GL_ARRAY_BUFFER, m_maxTris * sizeof(GizmoTri), m_tris, GL_DYNAMIC_DRAW);
-
-	glGenBuffers( 1, &m_transparentTriVBO );
-	glBindBuffer(GL_ARRAY_BUFFER, m_transparentTriVBO);
-	glBufferData(GL_ARRAY_BUFFER, m_maxTris * sizeof(GizmoTri), m_transparentTris, GL_DYNAMIC_DRAW);
-
-	glGenBuffers( 1, &m_2DlineVBO );
-	glBindBuffer(GL_ARRAY_BUFFER, m_2DlineVBO);
-	glBufferData(GL_ARRAY_BUFFER, m_max2DLines * sizeof(GizmoLine), m_2Dlines, GL_DYNAMIC_DRAW);
-
-	glGenBuffers( 1, &m_2DtriVBO );
-	glBindBuffer(GL_ARRAY_BUFFER, m_2DtriVBO);
-	glBufferData(GL_ARRAY_BUFFER, m_max2DTris * sizeof(GizmoTri), m_2Dtris, GL_DYNAMIC_DRAW);
-
-	glGenVertexArrays(1, &m_lineVAO);
-	glBindVertexArray(m_lineVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_lineVBO);
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GizmoVertex), 0);
 	glVertexAttribPointer(1, 4, GL_FLOAT, GL_TRUE, sizeof(GizmoVertex), ((char*)0) + 16);
 
-	glGenVertexArrays(1, &m_triVAO);
-	glBindVertexArray(m_triVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_triVBO);
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GizmoVertex), 0);
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_TRUE, sizeof(GizmoVertex), ((char*)0) + 16);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-	glGenVertexArrays(1, &m_transparentTriVAO);
-	glBindVertexArray(m_transparentTriVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_transparentTriVBO);
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GizmoVertex), 0);
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_TRUE, sizeof(GizmoVertex), ((char*)0) + 16);
+void Gizmos::Stream::destroy()
+{
+	if (mapped != nullptr)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		mapped = nullptr;
+	}
+	delete[] cpu;
+	cpu = nullptr;
+	glDeleteBuffers(1, &vbo);
+	glDeleteVertexArrays(1, &vao);
+}
 
-	glGenVertexArrays(1, &m_2DlineVAO);
-	glBindVertexArray(m_2DlineVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_2DlineVBO);
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GizmoVertex), 0);
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_TRUE, sizeof(GizmoVertex), ((char*)0) + 16);
+void* Gizmos::Stream::region(unsigned int a_region) const
+{
+	if (mapped != nullptr)
+		return mapped + (size_t)a_region * capacity * primitiveSize;
+	return cpu;
+}
 
-	glGenVertexArrays(1, &m_2DtriVAO);
-	glBindVertexArray(m_2DtriVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_2DtriVBO);
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GizmoVertex), 0);
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_TRUE, sizeof(GizmoVertex), ((char*)0) + 16);
+size_t Gizmos::Stream::allocated() const
+{
+	// mapped streams keep every region on the GPU, otherwise it's one region on each side
+	size_t size = (size_t)capacity * primitiveSize;
+	return mapped != nullptr ? size * STREAM_REGIONS : size * 2;
+}
+
+void Gizmos::Stream::resize(unsigned int a_capacity, unsigned int a_region, unsigned int a_count)
+{
+	// the old buffer's other regions may still be in flight, but GL keeps a
+	// deleted buffer alive until the commands reading it are done
+	Stream old = *this;
+	create(a_capacity, old.primitiveSize, old.mapped != nullptr);
+
+	// the persistent mapping is write-only, so mapped regions are copied on the GPU
+	size_t bytes = (size_t)a_count * primitiveSize;
+	if (bytes > 0 && old.mapped != nullptr)
+	{
+		GLintptr offset = (GLintptr)a_region * old.capacity * primitiveSize;
+		glBindBuffer(GL_COPY_READ_BUFFER, old.vbo);
+		if (mapped != nullptr)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset,
+								(GLintptr)a_region * capacity * primitiveSize, (GLsizeiptr)bytes);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		else
+		{
+			// the new buffer couldn't be mapped, so read back into its CPU copy
+			glGetBufferSubData(GL_COPY_READ_BUFFER, offset, (GLsizeiptr)bytes, cpu);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	else if (bytes > 0)
+		memcpy(cpu, old.cpu, bytes);
+	initialCapacity = old.initialCapacity;
+	maxCapacity = old.maxCapacity;
+	uploaded = old.uploaded;
+	old.destroy();
+}
+
+bool Gizmos::Stream::trim(unsigned int a_used)
+{
+	if (capacity <= initialCapacity || a_used > capacity / 4)
+	{
+		idleFrames = 0;
+		return false;
+	}
+	if (++idleFrames < STREAM_IDLE_FRAMES)
+		return false;
+
+	resize(std::max(capacity / 2, initialCapacity), 0, 0);
+	return true;
+}
+
+size_t Gizmos::Stream::upload(unsigned int a_region, unsigned int a_count)
+{
+	uploaded += (size_t)a_count * primitiveSize;
+	if (mapped != nullptr)
+		return (size_t)a_region * capacity * primitiveSize;
+
+	// orphaning gives the driver fresh storage rather than waiting on the old
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)capacity * primitiveSize, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)a_count * primitiveSize, cpu);
+	return 0;
+}
+
+int Gizmos::Stream::bind(unsigned int a_region, unsigned int a_count, unsigned int a_primitiveVertices)
+{
+	glBindVertexArray(vao);
+	return (int)(upload(a_region, a_count) / (primitiveSize / a_primitiveVertices));
+}
+
+void Gizmos::useRegion(unsigned int a_region)
+{
+	m_region = a_region;
+	m_lines = (GizmoLine*)m_lineStream.region(a_region);
+	m_tris = (GizmoTri*)m_triStream.region(a_region);
+	m_transparentTris = (GizmoTri*)m_transparentTriStream.region(a_region);
+	m_2Dlines = (GizmoLine*)m_2DlineStream.region(a_region);
+	m_2Dtris = (GizmoTri*)m_2DtriStream.region(a_region);
+	for (unsigned int shape = 0; shape < INSTANCE_SHAPE_COUNT; ++shape)
+	{
+		m_instances[shape][0] = (GizmoInstance*)m_instanceStreams[shape][0].region(a_region);
+		m_instances[shape][1] = (GizmoInstance*)m_instanceStreams[shape][1].region(a_region);
+	}
+}
+
+bool Gizmos::reserve(Stream& a_stream, unsigned int a_count, unsigned int a_extra /* = 1 */)
+{
+	size_t needed = (size_t)a_count + a_extra;
+	if (needed <= a_stream.capacity)
+		return true;
+
+	unsigned int capacity = a_stream.capacity;
+	while (capacity < needed && capacity < a_stream.maxCapacity)
+		capacity = (capacity > a_stream.maxCapacity / 2 ? a_stream.maxCapacity : capacity * 2);
+	if (capacity != a_stream.capacity)
+	{
+		a_stream.resize(capacity, m_region, a_count);
+		useRegion(m_region);
+	}
+
+	if (needed <= capacity)
+		return true;
+	m_dropped += (unsigned int)(needed - capacity);
+	return false;
+}
+
+void Gizmos::append(Stream& a_stream, unsigned int& a_count, const void* a_primitives, size_t a_primitiveCount)
+{
+	if (a_primitiveCount == 0)
+		return;
+
+	unsigned int extra = (unsigned int)std::min<size_t>(a_primitiveCount, a_stream.maxCapacity);
+	m_dropped += (unsigned int)(a_primitiveCount - extra);
+	reserve(a_stream, a_count, extra);
+	extra = std::min(extra, a_stream.capacity - a_count);
+	memcpy((unsigned char*)a_stream.region(m_region) + (size_t)a_count * a_stream.primitiveSize,
+		   a_primitives, (size_t)extra * a_stream.primitiveSize);
+	a_count += extra;
+}
+
+Gizmos::Recording* Gizmos::newRecording()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_recordingMutex);
+		if (m_freeRecordings != nullptr)
+		{
+			Recording* recording = m_freeRecordings;
+			m_freeRecordings = recording->next;
+			return recording;
+		}
+	}
+	return new Recording();
+}
+
+void Gizmos::mergeRecordings()
+{
+	Recording* recordings = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_recordingMutex);
+		std::swap(recordings, m_recordings);
+	}
+	if (recordings == nullptr)
+		return;
+
+	// one copy per buffer per recording, however many gizmos each holds
+	Recording* last = recordings;
+	for (Recording* recording = recordings; recording != nullptr; recording = recording->next)
+	{
+		append(m_lineStream, m_lineCount, recording->lines.data(), recording->lines.size());
+		append(m_triStream, m_triCount, recording->tris.data(), recording->tris.size());
+		append(m_transparentTriStream, m_transparentTriCount, recording->transparentTris.data(), recording->transparentTris.size());
+		append(m_2DlineStream, m_2DlineCount, recording->lines2D.data(), recording->lines2D.size());
+		append(m_2DtriStream, m_2DtriCount, recording->tris2D.data(), recording->tris2D.size());
+		for (unsigned int shape = 0; shape < INSTANCE_SHAPE_COUNT; ++shape)
+		{
+			for (unsigned int transparent = 0; transparent < 2; ++transparent)
+			{
+				std::vector<GizmoInstance>& instances = recording->instances[shape][transparent];
+				append(m_instanceStreams[shape][transparent], m_instanceCounts[shape][transparent],
+					   instances.data(), instances.size());
+				instances.clear();
+			}
+		}
+
+		// cleared rather than freed, so a reused recording keeps its capacity
+		recording->lines.clear();
+		recording->tris.clear();
+		recording->transparentTris.clear();
+		recording->lines2D.clear();
+		recording->tris2D.clear();
+		last = recording;
+	}
+
+	std::lock_guard<std::mutex> lock(m_recordingMutex);
+	last->next = m_freeRecordings;
+	m_freeRecordings = recordings;
+}
+
+Gizmos::Recorder::Recorder()
+	: m_recording(nullptr),
+	m_previous(s_recorder)
+{
+	s_recorder = this;
+}
+
+Gizmos::Recorder::~Recorder()
+{
+	flush();
+	s_recorder = m_previous;
+}
+
+Gizmos::Recording& Gizmos::Recorder::recording()
+{
+	if (m_recording == nullptr)
+		m_recording = (sm_singleton != nullptr ? sm_singleton->newRecording() : new Recording());
+	return *m_recording;
+}
+
+void Gizmos::Recorder::flush()
+{
+	if (m_recording == nullptr)
+		return;
+
+	if (sm_singleton == nullptr)
+	{
+		delete m_recording;
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(sm_singleton->m_recordingMutex);
+		m_recording->next = sm_singleton->m_recordings;
+		sm_singleton->m_recordings = m_recording;
+	}
+	m_recording = nullptr;
+}
+
+// Rings of latitude from the bottom pole to the top, as triangles and as lines
+// around the rings and down the meridians.  A capsule's rings are tagged -1 or
+// 1 in w for the end they belong to, with the equator in both so the side wall
+// joins them.
+static void addRoundMesh(std::vector<glm::vec4>& a_tris, std::vector<glm::vec4>& a_lines, bool a_capsule)
+{
+	const int rows = 8, columns = 16;
+	std::vector<glm::vec4> rings;
+	for (int row = 0; row <= rows; ++row)
+	{
+		float latitude = glm::pi<float>() * (float(row) / rows - 0.5f);
+		int copies = (a_capsule && row * 2 == rows ? 2 : 1);
+		for (int copy = 0; copy < copies; ++copy)
+		{
+			float end = 0;
+			if (a_capsule)
+				end = (row * 2 < rows || (row * 2 == rows && copy == 0) ? -1.0f : 1.0f);
+			for (int column = 0; column < columns; ++column)
+			{
+				float theta = glm::pi<float>() * 2 * float(column) / columns;
+				rings.push_back(glm::vec4(cosf(latitude) * sinf(theta), sinf(latitude),
+										  cosf(latitude) * cosf(theta), end));
+			}
+		}
+	}
+
+	int ringCount = (int)rings.size() / columns;
+	for (int ring = 0; ring < ringCount; ++ring)
+	{
+		for (int column = 0; column < columns; ++column)
+		{
+			int v0 = ring * columns + column;
+			int v1 = ring * columns + (column + 1) % columns;
+			if (ring > 0 && ring < ringCount - 1)
+			{
+				a_lines.push_back(rings[v0]);
+				a_lines.push_back(rings[v1]);
+			}
+			if (ring + 1 == ringCount)
+				continue;
+			int v2 = v0 + columns, v3 = v1 + columns;
+			a_lines.push_back(rings[v0]);
+			a_lines.push_back(rings[v2]);
+			a_tris.push_back(rings[v0]);
+			a_tris.push_back(rings[v3]);
+			a_tris.push_back(rings[v1]);
+			a_tris.push_back(rings[v0]);
+			a_tris.push_back(rings[v2]);
+			a_tris.push_back(rings[v3]);
+		}
+	}
+}
+
+void Gizmos::createInstanceMeshes()
+{
+	std::vector<glm::vec4> vertices;
+	for (unsigned int shape = 0; shape < INSTANCE_SHAPE_COUNT; ++shape)
+	{
+		std::vector<glm::vec4> tris, lines;
+		if (shape == BOX_INSTANCE)
+		{
+			// corner i has x, y and z from bits 0, 1 and 2
+			glm::vec4 corners[8];
+			for (int i = 0; i < 8; ++i)
+				corners[i] = glm::vec4(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1, 0);
+			const int faces[6][4] = { { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 },
+									  { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 } };
+			for (auto& face : faces)
+			{
+				const int order[6] = { 0, 1, 2, 0, 2, 3 };
+				for (int i : order)
+					tris.push_back(corners[face[i]]);
+				for (int i = 0; i < 4; ++i)
+				{
+					lines.push_back(corners[face[i]]);
+					lines.push_back(corners[face[(i + 1) % 4]]);
+				}
+			}
+		}
+		else
+			addRoundMesh(tris, lines, shape == CAPSULE_INSTANCE);
+
+		InstanceMesh& mesh = m_instanceMeshes[shape];
+		mesh.triFirst = (int)vertices.size();
+		mesh.triCount = (int)tris.size();
+		vertices.insert(vertices.end(), tris.begin(), tris.end());
+		mesh.lineFirst = (int)vertices.size();
+		mesh.lineCount = (int)lines.size();
+		vertices.insert(vertices.end(), lines.begin(), lines.end());
+	}
 
+	glGenBuffers(1, &m_instanceMeshVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceMeshVBO);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec4), vertices.data(), GL_STATIC_DRAW);
+
+	// the per instance attributes are pointed at a stream's region when drawn
+	glGenVertexArrays(1, &m_instanceVAO);
+	glBindVertexArray(m_instanceVAO);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
+	for (unsigned int i = 1; i < 6; ++i)
+	{
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-Gizmos::~Gizmos()
+void Gizmos::create(unsigned int a_maxLines /* = 0x4000 */, unsigned int a_maxTris /* = 0x4000 */,
+					unsigned int a_max2DLines /* = 0xff */, unsigned int a_max2DTris /* = 0xff */,
+					unsigned int a_maxInstances /* = 0x400 */)
 {
-	delete[] m_lines;
-	delete[] m_tris;
-	delete[] m_transparentTris;
-	glDeleteBuffers( 1, &m_lineVBO );
-	glDeleteBuffers( 1, &m_triVBO );
-	glDeleteBuffers( 1, &m_transparentTriVBO );
-	glDeleteVertexArrays( 1, &m_lineVAO );
-	glDeleteVertexArrays( 1, &m_triVAO );
-	glDeleteVertexArrays( 1, &m_transparentTriVAO );
-	delete[] m_2Dlines;
-	delete[] m_2Dtris;
-	glDeleteBuffers( 1, &m_2DlineVBO );
-	glDeleteBuffers( 1, &m_2DtriVBO );
-	glDeleteVertexArrays( 1, &m_2DlineVAO );
-	glDeleteVertexArrays( 1, &m_2DtriVAO );
-	glDeleteProgram(m_shader);
+	if (sm_singleton == nullptr)
+		sm_singleton = new Gizmos(a_maxLines,a_maxTris,a_max2DLines,a_max2DTris,a_maxInstances);
 }
 
-void Gizmos::create(unsigned int a_maxLines /* = 0xffff */, unsigned int a_maxTris /* = 0xffff */,
-					unsigned int a_max2DLines /* = 0xff */, unsigned int a_max2DTris /* = 0xff */)
+const Gizmos::Stats& Gizmos::getStats()
 {
-	if (sm_singleton == nullptr)
-		sm_singleton = new Gizmos(a_maxLines,a_maxTris,a_max2DLines,a_max2DTris);
+	static const Stats empty = {};
+	return sm_singleton != nullptr ? sm_singleton->m_stats : empty;
 }
 
 void Gizmos::destroy()
@@ -169,11 +640,70 @@ void Gizmos::destroy()
 
 void Gizmos::clear()
 {
+	Gizmos* gizmos = sm_singleton;
+
+	// the frame being cleared becomes the reported one
+	Stats& stats = gizmos->m_stats;
+	stats.lines = gizmos->m_lineCount;
+	stats.tris = gizmos->m_triCount;
+	stats.transparentTris = gizmos->m_transparentTriCount;
+	stats.instances = gizmos->instanceCount(false) + gizmos->instanceCount(true);
+	stats.lines2D = gizmos->m_2DlineCount;
+	stats.tris2D = gizmos->m_2DtriCount;
+	stats.dropped = gizmos->m_dropped;
+	stats.bytesUploaded = 0;
+	stats.bytesAllocated = 0;
+	gizmos->m_dropped = 0;
+
+	// trimming throws away what a stream holds, which is about to be cleared anyway
+	Stream* streams[] = { &gizmos->m_lineStream, &gizmos->m_triStream, &gizmos->m_transparentTriStream,
+						  &gizmos->m_2DlineStream, &gizmos->m_2DtriStream };
+	unsigned int counts[] = { gizmos->m_lineCount, gizmos->m_triCount, gizmos->m_transparentTriCount,
+							  gizmos->m_2DlineCount, gizmos->m_2DtriCount };
+	for (unsigned int i = 0; i < 5; ++i)
+	{
+		stats.bytesUploaded += streams[i]->uploaded;
+		streams[i]->uploaded = 0;
+		streams[i]->trim(counts[i]);
+		stats.bytesAllocated += streams[i]->allocated();
+	}
+	for (unsigned int shape = 0; shape < INSTANCE_SHAPE_COUNT; ++shape)
+	{
+		for (unsigned int transparent = 0; transparent < 2; ++transparent)
+		{
+			Stream& stream = gizmos->m_instanceStreams[shape][transparent];
+			stats.bytesUploaded += stream.uploaded;
+			stream.uploaded = 0;
+			stream.trim(gizmos->m_instanceCounts[shape][transparent]);
+			stats.bytesAllocated += stream.allocated();
+		}
+	}
+
+	// Fence the region that was just drawn from and move on to the next one,
+	// waiting if the GPU is still reading it from STREAM_REGIONS frames ago.
+	// Gizmos that are never cleared stay in their region and keep drawing.
+	if (gizmos->m_lineStream.mapped != nullptr || gizmos->m_triStream.mapped != nullptr)
+	{
+		gizmos->m_fences[gizmos->m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		unsigned int next = (gizmos->m_region + 1) % STREAM_REGIONS;
+		GLsync fence = (GLsync)gizmos->m_fences[next];
+		if (fence != nullptr)
+		{
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(fence);
+			gizmos->m_fences[next] = nullptr;
+		}
+		gizmos->m_region = next;
+	}
+	gizmos->useRegion(gizmos->m_region);
+
 	sm_singleton->m_lineCount = 0;
 	sm_singleton->m_triCount = 0;
 	sm_singleton->m_transparentTriCount = 0;
 	sm_singleton->m_2DlineCount = 0;
 	sm_singleton->m_2DtriCount = 0;
+	for (auto& counts : sm_singleton->m_instanceCounts)
+		counts[0] = counts[1] = 0;
 }
 
 // Adds 3 unit-length lines (red,green,blue) representing the 3 axis of a transform, 
@@ -597,6 +1127,55 @@ void Gizmos::addSphere(const glm::vec3& a_center, float a_radius, int a_rows, in
 	delete[] v4Array;	
 }
 
+void Gizmos::addSphereInstance(const glm::vec3& a_center, float a_radius,
+	const glm::vec4& a_fillColour, const glm::mat4* a_transform /* = nullptr */)
+{
+	addInstance(SPHERE_INSTANCE, a_center, glm::vec4(a_radius, a_radius, a_radius, 0), a_fillColour, a_transform);
+}
+
+void Gizmos::addBoxInstance(const glm::vec3& a_center, const glm::vec3& a_extents,
+	const glm::vec4& a_fillColour, const glm::mat4* a_transform /* = nullptr */)
+{
+	addInstance(BOX_INSTANCE, a_center, glm::vec4(a_extents, 0), a_fillColour, a_transform);
+}
+
+void Gizmos::addCapsuleInstance(const glm::vec3& a_center, float a_radius, float a_halfLength,
+	const glm::vec4& a_fillColour, const glm::mat4* a_transform /* = nullptr */)
+{
+	addInstance(CAPSULE_INSTANCE, a_center, glm::vec4(a_radius, a_radius, a_radius, a_halfLength), a_fillColour, a_transform);
+}
+
+void Gizmos::addInstance(InstanceShape a_shape, const glm::vec3& a_center, const glm::vec4& a_scale,
+	const glm::vec4& a_colour, const glm::mat4* a_transform)
+{
+	glm::mat4 transform = (a_transform != nullptr ? *a_transform : glm::mat4(1));
+	GizmoInstance instance;
+	for (int i = 0; i < 3; ++i)
+		instance.rows[i] = glm::vec4(transform[0][i], transform[1][i], transform[2][i], a_center[i]);
+	instance.colour = a_colour;
+	instance.scale = a_scale;
+
+	unsigned int transparent = (a_colour.w < 1.0f ? 1 : 0);
+	if (s_recorder != nullptr)
+	{
+		s_recorder->recording().instances[a_shape][transparent].push_back(instance);
+	}
+	else if (sm_singleton != nullptr)
+	{
+		unsigned int& count = sm_singleton->m_instanceCounts[a_shape][transparent];
+		if (sm_singleton->reserve(sm_singleton->m_instanceStreams[a_shape][transparent], count))
+			sm_singleton->m_instances[a_shape][transparent][count++] = instance;
+	}
+}
+
+unsigned int Gizmos::instanceCount(bool a_transparent) const
+{
+	unsigned int count = 0;
+	for (unsigned int shape = 0; shape < INSTANCE_SHAPE_COUNT; ++shape)
+		count += m_instanceCounts[shape][a_transparent ? 1 : 0];
+	return count;
+}
+
 void Gizmos::addHermiteSpline(const glm::vec3& a_start, const glm::vec3& a_end,
 	const glm::vec3& a_tangentStart, const glm::vec3& a_tangentEnd, unsigned int a_segments, const glm::vec4& a_colour)
 {
@@ -628,49 +1207,45 @@ void Gizmos::addLine(const glm::vec3& a_rv0,  const glm::vec3& a_rv1, const glm:
 
 void Gizmos::addLine(const glm::vec3& a_rv0, const glm::vec3& a_rv1, const glm::vec4& a_colour0, const glm::vec4& a_colour1)
 {
-	if (sm_singleton != nullptr &&
-		sm_singleton->m_lineCount < sm_singleton->m_maxLines)
-	{
-		sm_singleton->m_lines[ sm_singleton->m_lineCount ].v0.position = glm::vec4(a_rv0,1);
-		sm_singleton->m_lines[ sm_singleton->m_lineCount ].v0.colour = a_colour0;
-		sm_singleton->m_lines[ sm_singleton->m_lineCount ].v1.position = glm::vec4(a_rv1,1);
-		sm_singleton->m_lines[ sm_singleton->m_lineCount ].v1.colour = a_colour1;
-
-		sm_singleton->m_lineCount++;
-	}
+	GizmoLine line;
+	line.v0.position = glm::vec4(a_rv0,1);
+	line.v0.colour = a_colour0;
+	line.v1.position = glm::vec4(a_rv1,1);
+	line.v1.colour = a_colour1;
+
+	if (s_recorder != nullptr)
+		s_recorder->recording().lines.push_back(line);
+	else if (sm_singleton != nullptr &&
+			 sm_singleton->reserve(sm_singleton->m_lineStream, sm_singleton->m_lineCount))
+		sm_singleton->m_lines[ sm_singleton->m_lineCount++ ] = line;
 }
 
 void Gizmos::addTri(const glm::vec3& a_rv0, const glm::vec3& a_rv1, const glm::vec3& a_rv2, const glm::vec4& a_colour)
 {
-	if (sm_singleton != nullptr)
+	GizmoTri tri;
+	tri.v0.position = glm::vec4(a_rv0,1);
+	tri.v1.position = glm::vec4(a_rv1,1);
+	tri.v2.position = glm::vec4(a_rv2,1);
+	tri.v0.colour = a_colour;
+	tri.v1.colour = a_colour;
+	tri.v2.colour = a_colour;
+
+	if (s_recorder != nullptr)
+	{
+		Recording& recording = s_recorder->recording();
+		(a_colour.w == 1 ? recording.tris : recording.transparentTris).push_back(tri);
+	}
+	else if (sm_singleton != nullptr)
 	{
 		if (a_colour.w == 1)
 		{
-			if (sm_singleton->m_triCount < sm_singleton->m_maxTris)
-			{
-				sm_singleton->m_tris[ sm_singleton->m_triCount ].v0.position = glm::vec4(a_rv0,1);
-				sm_singleton->m_tris[ sm_singleton->m_triCount ].v1.position = glm::vec4(a_rv1,1);
-				sm_singleton->m_tris[ sm_singleton->m_triCount ].v2.position = glm::vec4(a_rv2,1);
-				sm_singleton->m_tris[ sm_singleton->m_triCount ].v0.colour = a_colour;
-				sm_singleton->m_tris[ sm_singleton->m_triCount ].v1.colour = a_colour;
-				sm_singleton->m_tris[ sm_singleton->m_triCount ].v2.colour = a_colour;
-
-				sm_singleton->m_triCount++;
-			}
+			if (sm_singleton->reserve(sm_singleton->m_triStream, sm_singleton->m_triCount))
+				sm_singleton->m_tris[ sm_singleton->m_triCount++ ] = tri;
 		}
 		else
 		{
-			if (sm_singleton->m_transparentTriCount < sm_singleton->m_maxTris)
-			{
-				sm_singleton->m_transparentTris[ sm_singleton->m_transparentTriCount ].v0.position = glm::vec4(a_rv0,1);
-				sm_singleton->m_transparentTris[ sm_singleton->m_transparentTriCount ].v1.position = glm::vec4(a_rv1,1);
-				sm_singleton->m_transparentTris[ sm_singleton->m_transparentTriCount ].v2.position = glm::vec4(a_rv2,1);
-				sm_singleton->m_transparentTris[ sm_singleton->m_transparentTriCount ].v0.colour = a_colour;
-				sm_singleton->m_transparentTris[ sm_singleton->m_transparentTriCount ].v1.colour = a_colour;
-				sm_singleton->m_transparentTris[ sm_singleton->m_transparentTriCount ].v2.colour = a_colour;
-
-				sm_singleton->m_transparentTriCount++;
-			}
+			if (sm_singleton->reserve(sm_singleton->m_transparentTriStream, sm_singleton->m_transparentTriCount))
+				sm_singleton->m_transparentTris[ sm_singleton->m_transparentTriCount++ ] = tri;
 		}
 	}
 }
@@ -757,39 +1332,43 @@ void Gizmos::add2DLine(const glm::vec2& a_rv0,  const glm::vec2& a_rv1, const gl
 
 void Gizmos::add2DLine(const glm::vec2& a_rv0, const glm::vec2& a_rv1, const glm::vec4& a_colour0, const glm::vec4& a_colour1)
 {
-	if (sm_singleton != nullptr &&
-		sm_singleton->m_2DlineCount < sm_singleton->m_max2DLines)
-	{
-		sm_singleton->m_2Dlines[ sm_singleton->m_2DlineCount ].v0.position = glm::vec4(a_rv0,1,1);
-		sm_singleton->m_2Dlines[ sm_singleton->m_2DlineCount ].v0.colour = a_colour0;
-		sm_singleton->m_2Dlines[ sm_singleton->m_2DlineCount ].v1.position = glm::vec4(a_rv1,1,1);
-		sm_singleton->m_2Dlines[ sm_singleton->m_2DlineCount ].v1.colour = a_colour1;
-
-		sm_singleton->m_2DlineCount++;
-	}
+	GizmoLine line;
+	line.v0.position = glm::vec4(a_rv0,1,1);
+	line.v0.colour = a_colour0;
+	line.v1.position = glm::vec4(a_rv1,1,1);
+	line.v1.colour = a_colour1;
+
+	if (s_recorder != nullptr)
+		s_recorder->recording().lines2D.push_back(line);
+	else if (sm_singleton != nullptr &&
+			 sm_singleton->reserve(sm_singleton->m_2DlineStream, sm_singleton->m_2DlineCount))
+		sm_singleton->m_2Dlines[ sm_singleton->m_2DlineCount++ ] = line;
 }
 
 void Gizmos::add2DTri(const glm::vec2& a_rv0, const glm::vec2& a_rv1, const glm::vec2& a_rv2, const glm::vec4& a_colour)
 {
-	if (sm_singleton != nullptr)
-	{
-		if (sm_singleton->m_2DtriCount < sm_singleton->m_max2DTris)
-		{
-			sm_singleton->m_2Dtris[ sm_singleton->m_2DtriCount ].v0.position = glm::vec4(a_rv0,1,1);
-			sm_singleton->m_2Dtris[ sm_singleton->m_2DtriCount ].v1.position = glm::vec4(a_rv1,1,1);
-			sm_singleton->m_2Dtris[ sm_singleton->m_2DtriCount ].v2.position = glm::vec4(a_rv2,1,1);
-			sm_singleton->m_2Dtris[ sm_singleton->m_2DtriCount ].v0.colour = a_colour;
-			sm_singleton->m_2Dtris[ sm_singleton->m_2DtriCount ].v1.colour = a_colour;
-			sm_singleton->m_2Dtris[ sm_singleton->m_2DtriCount ].v2.colour = a_colour;
-
-			sm_singleton->m_2DtriCount++;
-		}
-	}
+	GizmoTri tri;
+	tri.v0.position = glm::vec4(a_rv0,1,1);
+	tri.v1.position = glm::vec4(a_rv1,1,1);
+	tri.v2.position = glm::vec4(a_rv2,1,1);
+	tri.v0.colour = a_colour;
+	tri.v1.colour = a_colour;
+	tri.v2.colour = a_colour;
+
+	if (s_recorder != nullptr)
+		s_recorder->recording().tris2D.push_back(tri);
+	else if (sm_singleton != nullptr &&
+			 sm_singleton->reserve(sm_singleton->m_2DtriStream, sm_singleton->m_2DtriCount))
+		sm_singleton->m_2Dtris[ sm_singleton->m_2DtriCount++ ] = tri;
 }
 
 void Gizmos::draw(const glm::mat4& a_projectionView)
 {
-	if ( sm_singleton != nullptr && (sm_singleton->m_lineCount > 0 || sm_singleton->m_triCount > 0 || sm_singleton->m_transparentTriCount > 0))
+	if (sm_singleton != nullptr)
+		sm_singleton->mergeRecordings();
+
+	if ( sm_singleton != nullptr && (sm_singleton->m_lineCount > 0 || sm_singleton->m_triCount > 0 || sm_singleton->m_transparentTriCount > 0 ||
+									 sm_singleton->instanceCount(false) > 0 || sm_singleton->instanceCount(true) > 0))
 	{
 		glUseProgram(sm_singleton->m_shader);
 		
@@ -798,23 +1377,20 @@ void Gizmos::draw(const glm::mat4& a_projectionView)
 
 		if (sm_singleton->m_lineCount > 0)
 		{
-			glBindBuffer(GL_ARRAY_BUFFER, sm_singleton->m_lineVBO);
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sm_singleton->m_lineCount * sizeof(GizmoLine), sm_singleton->m_lines);
-
-			glBindVertexArray(sm_singleton->m_lineVAO);
-			glDrawArrays(GL_LINES, 0, sm_singleton->m_lineCount * 2);
+			int first = sm_singleton->m_lineStream.bind(sm_singleton->m_region, sm_singleton->m_lineCount, 2);
+			glDrawArrays(GL_LINES, first, sm_singleton->m_lineCount * 2);
 		}
 
 		if (sm_singleton->m_triCount > 0)
 		{
-			glBindBuffer(GL_ARRAY_BUFFER, sm_singleton->m_triVBO);
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sm_singleton->m_triCount * sizeof(GizmoTri), sm_singleton->m_tris);
-
-			glBindVertexArray(sm_singleton->m_triVAO);
-			glDrawArrays(GL_TRIANGLES, 0, sm_singleton->m_triCount * 3);
+			int first = sm_singleton->m_triStream.bind(sm_singleton->m_region, sm_singleton->m_triCount, 3);
+			glDrawArrays(GL_TRIANGLES, first, sm_singleton->m_triCount * 3);
 		}
 
-		if (sm_singleton->m_transparentTriCount > 0)
+		sm_singleton->uploadInstances();
+		sm_singleton->drawInstances(a_projectionView, false, sm_singleton->m_instanceShader);
+
+		if (sm_singleton->m_transparentTriCount > 0 || sm_singleton->instanceCount(true) > 0)
 		{
 			// not ideal to store these, but Gizmos must work stand-alone
 			GLboolean blendEnabled = glIsEnabled(GL_BLEND);
@@ -824,17 +1400,38 @@ void Gizmos::draw(const glm::mat4& a_projectionView)
 			glGetIntegerv(GL_BLEND_SRC, &src);
 			glGetIntegerv(GL_BLEND_DST, &dst);
 
+			// weighted blending needs no sorting, but if the target can't be
+			// used, fall back to blending in the order the gizmos were added
+			int framebuffer = 0;
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+			bool weighted = sm_singleton->m_transparency.begin(framebuffer);
+			unsigned int shader = (weighted ? sm_singleton->m_weightedShader : sm_singleton->m_shader);
+
 			// setup blend states
 			if (blendEnabled == GL_FALSE)
 				glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			if (weighted)
+				glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+			else
+				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 			glDepthMask(GL_FALSE);
 
-			glBindBuffer(GL_ARRAY_BUFFER, sm_singleton->m_transparentTriVBO);
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sm_singleton->m_transparentTriCount * sizeof(GizmoTri), sm_singleton->m_transparentTris);
+			if (sm_singleton->m_transparentTriCount > 0)
+			{
+				glUseProgram(shader);
+				glUniformMatrix4fv(glGetUniformLocation(shader, "ProjectionView"), 1, false, glm::value_ptr(a_projectionView));
+				int first = sm_singleton->m_transparentTriStream.bind(sm_singleton->m_region, sm_singleton->m_transparentTriCount, 3);
+				glDrawArrays(GL_TRIANGLES, first, sm_singleton->m_transparentTriCount * 3);
+			}
+
+			sm_singleton->drawInstances(a_projectionView, true,
+										weighted ? sm_singleton->m_weightedInstanceShader : sm_singleton->m_instanceShader);
 
-			glBindVertexArray(sm_singleton->m_transparentTriVAO);
-			glDrawArrays(GL_TRIANGLES, 0, sm_singleton->m_transparentTriCount * 3);
+			if (weighted)
+			{
+				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				sm_singleton->m_transparency.end(framebuffer, sm_singleton->m_compositeShader);
+			}
 
 			// reset state
 			glDepthMask(depthMask);
@@ -843,12 +1440,189 @@ void Gizmos::draw(const glm::mat4& a_projectionView)
 				glDisable(GL_BLEND);
 		}
 
+		glBindVertexArray(0);
 		glUseProgram(0);
 	}
 }
 
+void Gizmos::uploadInstances()
+{
+	for (unsigned int shape = 0; shape < INSTANCE_SHAPE_COUNT; ++shape)
+	{
+		for (unsigned int list = 0; list < 2; ++list)
+		{
+			unsigned int count = m_instanceCounts[shape][list];
+			m_instanceOffsets[shape][list] = (count > 0 ? m_instanceStreams[shape][list].upload(m_region, count) : 0);
+		}
+	}
+}
+
+void Gizmos::drawInstances(const glm::mat4& a_projectionView, bool a_transparent, unsigned int a_shader)
+{
+	if (instanceCount(false) == 0 && instanceCount(true) == 0)
+		return;
+
+	glUseProgram(a_shader);
+	glUniformMatrix4fv(glGetUniformLocation(a_shader, "ProjectionView"), 1, false, glm::value_ptr(a_projectionView));
+	int outlineUniform = glGetUniformLocation(a_shader, "Outline");
+	glBindVertexArray(m_instanceVAO);
+
+	// fill, then for the opaque pass outline both lists so transparent
+	// instances get their outline before anything is blended over them
+	for (int pass = 0; pass < (a_transparent ? 1 : 3); ++pass)
+	{
+		bool outline = pass > 0;
+		unsigned int list = (pass == 0 ? a_transparent : pass - 1);
+		glUniform1f(outlineUniform, outline ? 1.0f : 0.0f);
+
+		for (unsigned int shape = 0; shape < INSTANCE_SHAPE_COUNT; ++shape)
+		{
+			unsigned int count = m_instanceCounts[shape][list];
+			if (count == 0)
+				continue;
+
+			glBindBuffer(GL_ARRAY_BUFFER, m_instanceStreams[shape][list].vbo);
+			char* base = (char*)0 + m_instanceOffsets[shape][list];
+			glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(GizmoInstance), base + offsetof(GizmoInstance, colour));
+			for (unsigned int row = 0; row < 3; ++row)
+				glVertexAttribPointer(2 + row, 4, GL_FLOAT, GL_FALSE, sizeof(GizmoInstance),
+									  base + offsetof(GizmoInstance, rows) + row * sizeof(glm::vec4));
+			glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(GizmoInstance), base + offsetof(GizmoInstance, scale));
+
+			const InstanceMesh& mesh = m_instanceMeshes[shape];
+			if (outline)
+				glDrawArraysInstanced(GL_LINES, mesh.lineFirst, mesh.lineCount, count);
+			else
+				glDrawArraysInstanced(GL_TRIANGLES, mesh.triFirst, mesh.triCount, count);
+		}
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool Gizmos::TransparencyTarget::begin(int a_framebuffer)
+{
+	if (!supported)
+		return false;
+
+	// sized to reach the viewport's far corner, so gl_FragCoord addresses it directly
+	int viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	int targetWidth = viewport[0] + viewport[2];
+	int targetHeight = viewport[1] + viewport[3];
+	bool created = false;
+	if (fbo == 0 || targetWidth != width || targetHeight != height)
+	{
+		destroy();
+		create(targetWidth, targetHeight);
+		created = true;
+
+		// clear any earlier errors, so the check below only sees the copy's
+		while (glGetError() != GL_NO_ERROR);
+	}
+
+	// the scene's depth is copied in, so opaque geometry still hides what's behind it
+	int readFramebuffer = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, a_framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+
+	// a framebuffer whose depth format doesn't match can't be copied from
+	if (created && (glGetError() != GL_NO_ERROR ||
+					glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE))
+	{
+		supported = false;
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, a_framebuffer);
+		destroy();
+		return false;
+	}
+
+	const float accumClear[] = { 0, 0, 0, 1 };
+	const float weightClear[] = { 0, 0, 0, 0 };
+	glClearBufferfv(GL_COLOR, 0, accumClear);
+	glClearBufferfv(GL_COLOR, 1, weightClear);
+	return true;
+}
+
+void Gizmos::TransparencyTarget::end(int a_framebuffer, unsigned int a_compositeShader)
+{
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, a_framebuffer);
+
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+
+	glUseProgram(a_compositeShader);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, weightTexture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, accumTexture);
+	glBindVertexArray(vao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	if (depthTest == GL_TRUE)
+		glEnable(GL_DEPTH_TEST);
+}
+
+// makes a texture that's only ever read with texelFetch
+static unsigned int createTargetTexture(int a_internalFormat, unsigned int a_format, int a_width, int a_height)
+{
+	unsigned int texture = 0;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, a_internalFormat, a_width, a_height, 0, a_format, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+void Gizmos::TransparencyTarget::create(int a_width, int a_height)
+{
+	width = a_width;
+	height = a_height;
+	accumTexture = createTargetTexture(GL_RGBA16F, GL_RGBA, width, height);
+	weightTexture = createTargetTexture(GL_R16F, GL_RED, width, height);
+
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	int framebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTexture, 0);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, weightTexture, 0);
+	glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+}
+
+void Gizmos::TransparencyTarget::destroy()
+{
+	if (fbo == 0)
+		return;
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &accumTexture);
+	glDeleteTextures(1, &weightTexture);
+	glDeleteRenderbuffers(1, &depthBuffer);
+	fbo = 0;
+	width = 0;
+	height = 0;
+}
+
 void Gizmos::draw2D(const glm::mat4& a_projection)
 {
+	if (sm_singleton != nullptr)
+		sm_singleton->mergeRecordings();
+
 	if ( sm_singleton != nullptr && (sm_singleton->m_2DlineCount > 0 || sm_singleton->m_2DtriCount > 0))
 	{
 		glUseProgram(sm_singleton->m_shader);
@@ -858,11 +1632,8 @@ void Gizmos::draw2D(const glm::mat4& a_projection)
 
 		if (sm_singleton->m_2DlineCount > 0)
 		{
-			glBindBuffer(GL_ARRAY_BUFFER, sm_singleton->m_2DlineVBO);
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sm_singleton->m_2DlineCount * sizeof(GizmoLine), sm_singleton->m_2Dlines);
-
-			glBindVertexArray(sm_singleton->m_2DlineVAO);
-			glDrawArrays(GL_LINES, 0, sm_singleton->m_2DlineCount * 2);
+			int first = sm_singleton->m_2DlineStream.bind(sm_singleton->m_region, sm_singleton->m_2DlineCount, 2);
+			glDrawArrays(GL_LINES, first, sm_singleton->m_2DlineCount * 2);
 		}
 
 		if (sm_singleton->m_2DtriCount > 0)
@@ -883,11 +1654,8 @@ void Gizmos::draw2D(const glm::mat4& a_projection)
 
 			glDepthMask(GL_FALSE);
 
-			glBindBuffer(GL_ARRAY_BUFFER, sm_singleton->m_2DtriVBO);
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sm_singleton->m_2DtriCount * sizeof(GizmoTri), sm_singleton->m_2Dtris);
-
-			glBindVertexArray(sm_singleton->m_2DtriVAO);
-			glDrawArrays(GL_TRIANGLES, 0, sm_singleton->m_2DtriCount * 3);
+			int first = sm_singleton->m_2DtriStream.bind(sm_singleton->m_region, sm_singleton->m_2DtriCount, 3);
+			glDrawArrays(GL_TRIANGLES, first, sm_singleton->m_2DtriCount * 3);
 
 			glDepthMask(depthMask);
 